@@ -0,0 +1,185 @@
+/*                  A H O C O R A S I C K . C P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file AhoCorasick.cpp
+ *
+ * Aho-Corasick multi-pattern matcher
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <queue>
+#include "AhoCorasick.hpp"
+
+AhoCorasick::AhoCorasick(const std::vector<std::string> &pats)
+{
+    patterns = pats;
+    max_len = 0;
+
+    // Assign byte classes - class 0 is every byte not used by any pattern
+    memset(bclass, 0, sizeof(bclass));
+    nclasses = 1;
+    for (size_t i = 0; i < patterns.size(); i++) {
+	for (size_t j = 0; j < patterns[i].length(); j++) {
+	    unsigned char c = (unsigned char)patterns[i][j];
+	    if (!bclass[c])
+		bclass[c] = (uint8_t)nclasses++;
+	}
+	if (patterns[i].length() > max_len)
+	    max_len = patterns[i].length();
+    }
+
+    // Build the trie.  A 0 transition means "no edge yet" - the root can't
+    // be the target of a trie edge, so that's unambiguous.
+    delta.assign(nclasses, 0);
+    out.assign(1, -1);
+    for (size_t i = 0; i < patterns.size(); i++) {
+	if (!patterns[i].length())
+	    continue;
+	uint32_t s = 0;
+	for (size_t j = 0; j < patterns[i].length(); j++) {
+	    size_t ind = s * nclasses + bclass[(unsigned char)patterns[i][j]];
+	    if (!delta[ind]) {
+		delta[ind] = (uint32_t)out.size();
+		delta.resize(delta.size() + nclasses, 0);
+		out.push_back(-1);
+	    }
+	    s = delta[ind];
+	}
+	// Duplicate patterns report the first instance only
+	if (out[s] < 0)
+	    out[s] = (int32_t)i;
+    }
+
+    // Breadth first pass to compute failure links, fill in the missing
+    // transitions from them and chain the outputs.
+    size_t nstates = out.size();
+    std::vector<uint32_t> fail(nstates, 0);
+    dict.assign(nstates, -1);
+    std::queue<uint32_t> q;
+    for (size_t c = 0; c < nclasses; c++) {
+	if (delta[c])
+	    q.push(delta[c]);
+    }
+    while (!q.empty()) {
+	uint32_t s = q.front();
+	q.pop();
+	for (size_t c = 0; c < nclasses; c++) {
+	    uint32_t t = delta[s * nclasses + c];
+	    uint32_t f = delta[fail[s] * nclasses + c];
+	    if (!t) {
+		delta[s * nclasses + c] = f;
+		continue;
+	    }
+	    fail[t] = f;
+	    dict[t] = (out[f] >= 0) ? (int32_t)f : dict[f];
+	    q.push(t);
+	}
+    }
+
+    (void)memsearch_prefilter_init(&pf, patterns);
+}
+
+size_t
+AhoCorasick::scan(const char *buf, size_t start, size_t end, std::vector<Match> &matches, size_t max_matches) const
+{
+    size_t mcnt = 0;
+    const unsigned char *ubuf = (const unsigned char *)buf;
+    uint32_t s = 0;
+    for (size_t i = start; i < end; i++) {
+	s = next_state(s, ubuf[i]);
+	int32_t o = (out[s] >= 0) ? (int32_t)s : dict[s];
+	while (o >= 0) {
+	    size_t plen = patterns[out[o]].length();
+	    matches.push_back({i + 1 - plen, (size_t)out[o]});
+	    if (++mcnt == max_matches)
+		return mcnt;
+	    o = dict[o];
+	}
+    }
+    return mcnt;
+}
+
+size_t
+AhoCorasick::find_all(const char *buf, size_t buflen, std::vector<Match> &matches, size_t max_matches) const
+{
+    if (!buf || !max_len)
+	return 0;
+    if (!pf.flen)
+	return scan(buf, 0, buflen, matches, max_matches);
+
+    // Only run the automaton over the regions that could hold a match -
+    // max_len bytes from each candidate start the prefilter finds, runs
+    // of overlapping regions merged.  Every match lies wholly within one
+    // region, so starting each from the root state finds them all, and in
+    // the same order as a scan of the whole buffer would.
+    size_t mcnt = 0;
+    size_t rstart = 0, rend = 0;
+    size_t covered = 0;
+    const char *c = memsearch_prefilter_next(&pf, buf, buflen);
+    while (c) {
+	size_t cpos = (size_t)(c - buf);
+	if (rend && cpos <= rend) {
+	    rend = std::min(buflen, std::max(rend, cpos + max_len));
+	} else {
+	    if (rend) {
+		mcnt += scan(buf, rstart, rend, matches, (max_matches) ? max_matches - mcnt : 0);
+		if (max_matches && mcnt == max_matches)
+		    return mcnt;
+		covered += rend - rstart;
+	    }
+	    rstart = cpos;
+	    rend = std::min(buflen, cpos + max_len);
+	}
+	// Where candidates are everywhere the filter is just overhead, so
+	// the rest of the buffer is scanned whole
+	if (cpos > 65536 && covered > cpos / 4) {
+	    rend = buflen;
+	    break;
+	}
+	c = memsearch_prefilter_next(&pf, c + 1, buflen - cpos - 1);
+    }
+    if (rend)
+	mcnt += scan(buf, rstart, rend, matches, (max_matches) ? max_matches - mcnt : 0);
+    return mcnt;
+}
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
@@ -0,0 +1,103 @@
+/*                  A H O C O R A S I C K . H P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file AhoCorasick.hpp
+ *
+ * Aho-Corasick automaton for finding every occurrence of a set of target
+ * strings in a buffer with a single pass.
+ *
+ * The automaton is compiled into a dense DFA over byte equivalence classes
+ * (each byte appearing in some pattern gets its own class, everything else
+ * shares one) which keeps the transition table small enough to stay in
+ * cache for the typical handful of build paths.
+ *
+ * Searches are run through a vectorized prefilter on the patterns' first
+ * bytes where possible (see memsearch_prefilter), so the automaton only
+ * steps through the bytes around places a pattern might start - in data
+ * holding none of the patterns, usually none at all.
+ */
+
+#ifndef AHOCORASICK_HPP
+#define AHOCORASICK_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "memsearch.hpp"
+
+class AhoCorasick {
+    public:
+	AhoCorasick(const std::vector<std::string> &patterns);
+
+	struct Match {
+	    size_t pos;     /**< offset of the first byte of the match */
+	    size_t pattern; /**< index of the matching pattern */
+	};
+
+	/* Append every occurrence of every pattern in buf to matches,
+	 * including overlapping ones, in order of their end offsets.  If
+	 * max_matches is non-zero, stop once that many have been found.
+	 * Returns the number of matches found. */
+	size_t find_all(const char *buf, size_t buflen, std::vector<Match> &matches, size_t max_matches = 0) const;
+
+	std::vector<std::string> patterns; /**< copy of the pattern set */
+	size_t max_len;                    /**< length of the longest pattern */
+    private:
+	/* Run the automaton over [start, end) of buf, from the root */
+	size_t scan(const char *buf, size_t start, size_t end, std::vector<Match> &matches, size_t max_matches) const;
+
+	uint32_t next_state(uint32_t state, unsigned char c) const {
+	    return delta[state * nclasses + bclass[c]];
+	}
+
+	uint8_t bclass[256];          /**< byte -> equivalence class */
+	size_t nclasses;              /**< number of byte classes */
+	std::vector<uint32_t> delta;  /**< DFA transitions, nstates * nclasses */
+	std::vector<int32_t> out;     /**< pattern ending at each state, or -1 */
+	std::vector<int32_t> dict;    /**< nearest proper suffix state with output, or -1 */
+	memsearch_prefilter pf;       /**< candidate filter on the patterns' prefixes */
+};
+
+#endif /* AHOCORASICK_HPP */
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
@@ -0,0 +1,1116 @@
+/*                  A R C H I V E . C P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file Archive.cpp
+ *
+ * Tar, gzipped tar and zip member clearing.
+ *
+ * Clearing never changes a member's length, so a tar file keeps its exact
+ * layout and only the compressed stream around it (if any) is rebuilt.
+ * Zip members are compressed individually, so only the members that
+ * actually had strings cleared are recompressed - everything else is
+ * copied straight from the original - and the central directory is
+ * rewritten with the new offsets, sizes and CRCs.
+ *
+ * The members are scanned before anything is written, stopping at the
+ * first hit, so an archive with nothing to clear is neither copied nor
+ * recompressed.
+ */
+
+#include <algorithm>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#ifdef HAVE_ZLIB
+#  include <zlib.h>
+#endif
+
+#include "Archive.hpp"
+#include "AtomicFile.hpp"
+#include "MappedFile.hpp"
+#include "libstrclear.hpp"
+
+#define TAR_BLOCK 512
+
+/* Members in flight between two stages */
+#define PIPELINE_DEPTH 4
+
+/* zlib's counts are 32 bit, so big buffers go through it in pieces */
+#define ZLIB_PIECE (1U << 30)
+#define ZBUF_SIZE (256 * 1024)
+
+// One unit of work passing through the pipeline
+struct archive_member {
+    std::string name;             /**< member name, for reporting */
+    std::vector<char> head;       /**< bytes written ahead of the member */
+    std::vector<char> data;       /**< member contents, uncompressed */
+    std::vector<char> tail;       /**< bytes written after the contents */
+    bool clear = false;           /**< data holds a regular file to clear */
+    size_t entry = (size_t)-1;    /**< zip directory entry (if any) */
+    std::vector<strclear_match> cleared; /**< filled in by the clearing stage */
+};
+typedef std::unique_ptr<archive_member> member_ptr;
+
+// Fixed capacity queue between two pipeline stages.  Once closed, pushes
+// fail and pops drain what is left.
+class member_queue {
+    public:
+	member_queue(size_t capacity) : capacity(capacity), closed(false) {}
+
+	bool push(member_ptr &&m) {
+	    std::unique_lock<std::mutex> guard(lock);
+	    not_full.wait(guard, [this] { return q.size() < capacity || closed; });
+	    if (closed)
+		return false;
+	    q.push_back(std::move(m));
+	    not_empty.notify_one();
+	    return true;
+	}
+	bool pop(member_ptr &m) {
+	    std::unique_lock<std::mutex> guard(lock);
+	    not_empty.wait(guard, [this] { return q.size() || closed; });
+	    if (!q.size())
+		return false;
+	    m = std::move(q.front());
+	    q.pop_front();
+	    not_full.notify_one();
+	    return true;
+	}
+	void close() {
+	    std::lock_guard<std::mutex> guard(lock);
+	    closed = true;
+	    not_full.notify_all();
+	    not_empty.notify_all();
+	}
+    private:
+	std::mutex lock;
+	std::condition_variable not_full;
+	std::condition_variable not_empty;
+	std::deque<member_ptr> q;
+	size_t capacity;
+	bool closed;
+};
+
+typedef std::function<bool(member_queue &q, std::string &error)> unpack_stage;
+typedef std::function<bool(archive_member &m, std::string &error)> repack_stage;
+
+// Start unpack() filling q on a thread of its own, closing q when done
+static std::thread
+start_unpacker(const unpack_stage &unpack, member_queue &q, bool &ok, std::string &error, file_stats &fst)
+{
+    return std::thread([&]() {
+	phase_timer rt(&fst.read_time);
+	try {
+	    ok = unpack(q, error);
+	} catch (const std::bad_alloc &) {
+	    ok = false;
+	    error = "out of memory";
+	}
+	q.close();
+    });
+}
+
+// Check whether any regular member holds one of the strings, stopping at
+// the first that does - so an archive with nothing to clear is never
+// rewritten (or recompressed).  Returns 1 if a member does, 0 if none do,
+// or -1 on error.
+static int
+archive_dirty(std::ostream &err, const std::string &fname, const PatternSet &ps, const unpack_stage &unpack, file_stats &fst)
+{
+    member_queue unpacked(PIPELINE_DEPTH);
+    std::string unpack_error;
+    bool unpack_ok = true;
+    std::thread unpacker = start_unpacker(unpack, unpacked, unpack_ok, unpack_error, fst);
+
+    bool dirty = false;
+    std::vector<strclear_match> found;
+    double search_time = 0.0;
+    member_ptr m;
+    while (!dirty && unpacked.pop(m)) {
+	if (!m->clear)
+	    continue;
+	phase_timer st(&search_time);
+	dirty = (strclear_scan(m->data.data(), m->data.size(), ps, found, true) > 0);
+    }
+
+    // Stopping early makes the unpacker fail its next push - that's not
+    // an error
+    unpacked.close();
+    unpacker.join();
+    fst.search_time += search_time;
+    if (dirty)
+	return 1;
+    if (!unpack_ok) {
+	err << "Unable to read archive " << fname << ": " << unpack_error << "\n";
+	return -1;
+    }
+    return 0;
+}
+
+// Run the pipeline: unpack() on one thread fills the first queue, the
+// clearing stage on another moves members from it to the second, and
+// repack() on this thread empties that.  Returns the number of strings
+// cleared, or -1 on error.  Only time spent actually clearing counts as
+// searching, and only time in repack() as writing.
+static int
+run_pipeline(std::ostream &out, std::ostream &err, const std::string &fname, const PatternSet &ps, bool verbose, const unpack_stage &unpack, const repack_stage &repack, file_stats &fst)
+{
+    member_queue unpacked(PIPELINE_DEPTH), cleared(PIPELINE_DEPTH);
+    std::string unpack_error, repack_error;
+    bool unpack_ok = true;
+    double search_time = 0.0;
+
+    std::thread unpacker = start_unpacker(unpack, unpacked, unpack_ok, unpack_error, fst);
+    std::thread clearer([&]() {
+	member_ptr m;
+	while (unpacked.pop(m)) {
+	    if (m->clear) {
+		phase_timer st(&search_time);
+		strclear_clear(m->data.data(), m->data.size(), ps, &m->cleared);
+	    }
+	    if (!cleared.push(std::move(m)))
+		break;
+	}
+	cleared.close();
+    });
+
+    bool ok = true;
+    int grcnt = 0;
+    size_t peak = 0;
+    member_ptr m;
+    while (ok && cleared.pop(m)) {
+	if (verbose && m->cleared.size())
+	    strclear_report_cleared(out, fname + "(" + m->name + ")", m->cleared, ps);
+	grcnt += (int)m->cleared.size();
+	for (size_t i = 0; i < m->cleared.size(); i++)
+	    fst.bytes_patched += ps.targets[m->cleared[i].pattern].length();
+	peak = std::max(peak, m->data.size());
+	phase_timer wt(&fst.write_time);
+	try {
+	    ok = repack(*m, repack_error);
+	} catch (const std::bad_alloc &) {
+	    ok = false;
+	    repack_error = "out of memory";
+	}
+    }
+
+    // Unblock the other stages if we stopped early
+    cleared.close();
+    unpacked.close();
+    clearer.join();
+    unpacker.join();
+    fst.search_time += search_time;
+    fst.peak_buffer = std::max(fst.peak_buffer, peak);
+
+    if (!ok) {
+	err << "Unable to write updated archive " << fname << ": " << repack_error << "\n";
+	return -1;
+    }
+    if (!unpack_ok) {
+	err << "Unable to read archive " << fname << ": " << unpack_error << "\n";
+	return -1;
+    }
+    return grcnt;
+}
+
+/* Tar */
+
+// Parse a numeric header field - octal, or GNU base-256 for big values
+static bool
+tar_number(const char *field, size_t len, unsigned long long &val)
+{
+    val = 0;
+    if ((unsigned char)field[0] & 0x80) {
+	val = (unsigned char)field[0] & 0x7f;
+	for (size_t i = 1; i < len; i++) {
+	    if (val >> 55)
+		return false;
+	    val = val << 8 | (unsigned char)field[i];
+	}
+	return true;
+    }
+    size_t i = 0;
+    while (i < len && field[i] == ' ')
+	i++;
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; i++)
+	val = val * 8 + (field[i] - '0');
+    for (; i < len; i++) {
+	if (field[i] != ' ' && field[i] != '\0')
+	    return false;
+    }
+    return true;
+}
+
+// A header block is only a header if its checksum adds up
+static bool
+tar_header_valid(const char *h)
+{
+    unsigned long long chk;
+    if (!tar_number(h + 148, 8, chk))
+	return false;
+    unsigned long long sum = 0;
+    for (int i = 0; i < TAR_BLOCK; i++)
+	sum += (i >= 148 && i < 156) ? ' ' : (unsigned char)h[i];
+    return sum == chk;
+}
+
+static std::string
+tar_field(const char *field, size_t len)
+{
+    size_t n = 0;
+    while (n < len && field[n])
+	n++;
+    return std::string(field, n);
+}
+
+static std::string
+tar_header_name(const char *h)
+{
+    std::string name = tar_field(h, 100);
+    if (!memcmp(h + 257, "ustar", 5)) {
+	std::string prefix = tar_field(h + 345, 155);
+	if (prefix.length())
+	    name = prefix + "/" + name;
+    }
+    return name;
+}
+
+// The path from a pax extended header, if it has one
+static std::string
+pax_path(const std::vector<char> &data)
+{
+    size_t pos = 0;
+    while (pos < data.size()) {
+	// Records are "<length> <key>=<value>\n"
+	size_t len = 0, i = pos;
+	while (i < data.size() && data[i] >= '0' && data[i] <= '9')
+	    len = len * 10 + (data[i++] - '0');
+	if (!len || len > data.size() - pos || i >= data.size() || data[i] != ' ')
+	    break;
+	std::string rec(data.data() + i + 1, data.data() + pos + len);
+	if (!rec.compare(0, 5, "path="))
+	    return rec.substr(5, rec.length() - 6);
+	pos += len;
+    }
+    return std::string();
+}
+
+// Sequential reader over the tar stream, straight out of the file or
+// through zlib
+class tar_reader {
+    public:
+	tar_reader(const char *buf, size_t buflen, bool gz);
+	~tar_reader();
+
+	/* Read up to n bytes into dst - got comes back short only at the
+	 * end of the stream.  Returns false (setting error) on bad input. */
+	bool read(char *dst, size_t n, size_t &got);
+
+	std::string error;
+#ifdef HAVE_ZLIB
+	gz_header head;         /**< header of the (first) gzip member */
+	char head_name[1024];
+#endif
+    private:
+	const char *buf;
+	size_t buflen;
+	size_t pos;             /**< input consumed */
+	bool gz;
+	bool done;
+#ifdef HAVE_ZLIB
+	z_stream zs;
+#endif
+};
+
+tar_reader::tar_reader(const char *b, size_t blen, bool is_gz)
+    : buf(b), buflen(blen), pos(0), gz(is_gz), done(false)
+{
+#ifdef HAVE_ZLIB
+    memset(&head, 0, sizeof(head));
+    memset(&zs, 0, sizeof(zs));
+    head_name[0] = '\0';
+    head.name = (Bytef *)head_name;
+    head.name_max = sizeof(head_name);
+    if (gz) {
+	// 15 + 32 - gzip (or zlib) wrapper, detected from the header
+	if (inflateInit2(&zs, 15 + 32) != Z_OK) {
+	    error = "Unable to initialize decompression";
+	    done = true;
+	    return;
+	}
+	inflateGetHeader(&zs, &head);
+    }
+#endif
+}
+
+tar_reader::~tar_reader()
+{
+#ifdef HAVE_ZLIB
+    if (gz)
+	inflateEnd(&zs);
+#endif
+}
+
+bool
+tar_reader::read(char *dst, size_t n, size_t &got)
+{
+    got = 0;
+    if (error.length())
+	return false;
+    if (!gz) {
+	got = std::min(n, buflen - pos);
+	memcpy(dst, buf + pos, got);
+	pos += got;
+	return true;
+    }
+#ifdef HAVE_ZLIB
+    while (got < n && !done) {
+	if (!zs.avail_in && pos < buflen) {
+	    size_t piece = std::min(buflen - pos, (size_t)ZLIB_PIECE);
+	    zs.next_in = (Bytef *)buf + pos;
+	    zs.avail_in = (uInt)piece;
+	    pos += piece;
+	}
+	size_t want = std::min(n - got, (size_t)ZLIB_PIECE);
+	zs.next_out = (Bytef *)dst + got;
+	zs.avail_out = (uInt)want;
+	int ret = inflate(&zs, Z_NO_FLUSH);
+	got += want - zs.avail_out;
+	if (ret == Z_STREAM_END) {
+	    // Concatenated gzip members make up a single stream - anything
+	    // else after the end is padding
+	    const unsigned char *next = (zs.avail_in) ? zs.next_in : (const unsigned char *)buf + pos;
+	    size_t left = zs.avail_in + (buflen - pos);
+	    if (left >= 2 && next[0] == 0x1f && next[1] == 0x8b) {
+		inflateReset(&zs);
+		continue;
+	    }
+	    done = true;
+	    break;
+	}
+	if (ret == Z_BUF_ERROR && !zs.avail_in && pos >= buflen) {
+	    error = "compressed data is truncated";
+	    return false;
+	}
+	if (ret != Z_OK && ret != Z_BUF_ERROR) {
+	    error = (zs.msg) ? zs.msg : "compressed data is corrupt";
+	    return false;
+	}
+    }
+    return true;
+#else
+    error = "no zlib support";
+    return false;
+#endif
+}
+
+// Sequential writer of the new tar stream, compressing it if the original
+// was compressed
+class tar_writer {
+    public:
+	tar_writer(AtomicFile &af, bool gz);
+	~tar_writer();
+
+	/* Before the first write - the gzip header for the output, copied
+	 * from the original's (name and timestamp) */
+	void set_header(const tar_reader &rd);
+
+	bool write(const char *src, size_t len);
+	bool finish();
+
+	unsigned long long written; /**< bytes written to the file */
+    private:
+	bool deflate_out(int flush);
+
+	AtomicFile &af;
+	bool gz;
+#ifdef HAVE_ZLIB
+	z_stream zs;
+	gz_header head;
+	std::vector<char> obuf;
+#endif
+};
+
+tar_writer::tar_writer(AtomicFile &a, bool is_gz)
+    : written(0), af(a), gz(is_gz)
+{
+#ifdef HAVE_ZLIB
+    memset(&zs, 0, sizeof(zs));
+    memset(&head, 0, sizeof(head));
+    if (gz) {
+	// 15 + 16 - gzip wrapper
+	if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	    gz = false;
+	obuf.resize(ZBUF_SIZE);
+    }
+#endif
+}
+
+tar_writer::~tar_writer()
+{
+#ifdef HAVE_ZLIB
+    if (gz)
+	deflateEnd(&zs);
+#endif
+}
+
+void
+tar_writer::set_header(const tar_reader &rd)
+{
+#ifdef HAVE_ZLIB
+    if (!gz || rd.head.done != 1)
+	return;
+    head.time = rd.head.time;
+    head.os = rd.head.os;
+    if (rd.head_name[0])
+	head.name = (Bytef *)rd.head_name;
+    deflateSetHeader(&zs, &head);
+#else
+    (void)rd;
+#endif
+}
+
+#ifdef HAVE_ZLIB
+bool
+tar_writer::deflate_out(int flush)
+{
+    int ret;
+    do {
+	zs.next_out = (Bytef *)obuf.data();
+	zs.avail_out = (uInt)obuf.size();
+	ret = deflate(&zs, flush);
+	if (ret == Z_STREAM_ERROR)
+	    return false;
+	size_t have = obuf.size() - zs.avail_out;
+	if (have && !af.write(obuf.data(), have))
+	    return false;
+	written += have;
+    } while (!zs.avail_out || (flush == Z_FINISH && ret != Z_STREAM_END));
+    return true;
+}
+#endif
+
+bool
+tar_writer::write(const char *src, size_t len)
+{
+    if (!len)
+	return true;
+    if (!gz) {
+	written += len;
+	return af.write(src, len);
+    }
+#ifdef HAVE_ZLIB
+    while (len) {
+	size_t piece = std::min(len, (size_t)ZLIB_PIECE);
+	zs.next_in = (Bytef *)src;
+	zs.avail_in = (uInt)piece;
+	if (!deflate_out(Z_NO_FLUSH))
+	    return false;
+	src += piece;
+	len -= piece;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool
+tar_writer::finish()
+{
+#ifdef HAVE_ZLIB
+    if (gz) {
+	zs.next_in = NULL;
+	zs.avail_in = 0;
+	return deflate_out(Z_FINISH);
+    }
+#endif
+    return true;
+}
+
+// Split the tar stream from rd into members, queueing them on q
+static bool
+tar_unpack(tar_reader &rd, size_t member_max, member_queue &q, std::string &error)
+{
+    char hdr[TAR_BLOCK];
+    std::string next_name;  // from a GNU long name or pax header
+    while (true) {
+	size_t got;
+	if (!rd.read(hdr, TAR_BLOCK, got)) {
+	    error = rd.error;
+	    return false;
+	}
+	member_ptr m(new archive_member);
+	bool end = (got < TAR_BLOCK);
+	for (size_t i = 0; !end && i < TAR_BLOCK && !hdr[i]; i++)
+	    end = (i == TAR_BLOCK - 1);
+	if (end) {
+	    // The end of archive blocks and any padding after them are
+	    // copied as they are
+	    m->head.assign(hdr, hdr + got);
+	    std::vector<char> rest(64 * 1024);
+	    do {
+		if (!rd.read(rest.data(), rest.size(), got)) {
+		    error = rd.error;
+		    return false;
+		}
+		m->head.insert(m->head.end(), rest.begin(), rest.begin() + got);
+	    } while (got == rest.size());
+	    return q.push(std::move(m));
+	}
+
+	unsigned long long size;
+	if (!tar_header_valid(hdr) || !tar_number(hdr + 124, 12, size)) {
+	    error = "bad tar header";
+	    return false;
+	}
+	if (size > member_max) {
+	    error = "member " + tar_header_name(hdr) + " is too large to process";
+	    return false;
+	}
+	m->head.assign(hdr, hdr + TAR_BLOCK);
+	m->data.resize((size_t)size);
+	m->tail.resize((TAR_BLOCK - (size_t)(size % TAR_BLOCK)) % TAR_BLOCK);
+	if (!rd.read(m->data.data(), m->data.size(), got) || got != m->data.size() ||
+		!rd.read(m->tail.data(), m->tail.size(), got) || got != m->tail.size()) {
+	    error = (rd.error.length()) ? rd.error : "archive is truncated";
+	    return false;
+	}
+
+	char type = hdr[156];
+	m->name = (next_name.length()) ? next_name : tar_header_name(hdr);
+	if (type == 'L') {
+	    next_name = tar_field(m->data.data(), m->data.size());
+	} else if (type == 'x') {
+	    next_name = pax_path(m->data);
+	} else if (type != 'K' && type != 'g') {
+	    next_name.clear();
+	}
+	m->clear = (type == '0' || type == '\0' || type == '7');
+	if (!q.push(std::move(m)))
+	    return false;
+    }
+}
+
+static int
+clear_tar(std::ostream &out, std::ostream &err, const std::string &fname, const char *buf, size_t buflen, bool gz, const PatternSet &ps, bool verbose, bool sync, size_t member_max, file_stats &fst)
+{
+    {
+	tar_reader rd(buf, buflen, gz);
+	int dirty = archive_dirty(err, fname, ps, [&](member_queue &q, std::string &error) {
+	    return tar_unpack(rd, member_max, q, error);
+	}, fst);
+	if (dirty <= 0)
+	    return dirty;
+    }
+
+    AtomicFile af(fname.c_str(), sync);
+    if (!af.valid) {
+	err << "Unable to write updated archive " << fname << ": " << strerror(errno) << "\n";
+	return -1;
+    }
+    tar_reader rd(buf, buflen, gz);
+    tar_writer tw(af, gz);
+    bool first = true;
+
+    unpack_stage unpack = [&](member_queue &q, std::string &error) {
+	return tar_unpack(rd, member_max, q, error);
+    };
+
+    repack_stage repack = [&](archive_member &m, std::string &error) {
+	if (first)
+	    tw.set_header(rd);
+	first = false;
+	if (!tw.write(m.head.data(), m.head.size()) || !tw.write(m.data.data(), m.data.size()) || !tw.write(m.tail.data(), m.tail.size())) {
+	    error = strerror(errno);
+	    return false;
+	}
+	return true;
+    };
+
+    int grcnt = run_pipeline(out, err, fname, ps, verbose, unpack, repack, fst);
+    if (grcnt <= 0)
+	return grcnt;
+
+    phase_timer wt(&fst.write_time);
+    if (!tw.finish() || !af.commit()) {
+	err << "Unable to write updated archive " << fname << ": " << af.error() << "\n";
+	return -1;
+    }
+    fst.bytes_written += tw.written;
+    return grcnt;
+}
+
+/* Zip */
+
+static uint16_t
+le16(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return (uint16_t)(u[0] | u[1] << 8);
+}
+
+static uint32_t
+le32(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return (uint32_t)u[0] | (uint32_t)u[1] << 8 | (uint32_t)u[2] << 16 | (uint32_t)u[3] << 24;
+}
+
+static void
+put_le16(char *p, uint16_t v)
+{
+    p[0] = (char)(v & 0xff);
+    p[1] = (char)(v >> 8);
+}
+
+static void
+put_le32(char *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+	p[i] = (char)((v >> (8 * i)) & 0xff);
+}
+
+static uint32_t
+zip_crc32(const char *data, size_t len)
+{
+#ifdef HAVE_ZLIB
+    return (uint32_t)crc32(0L, (const Bytef *)data, (uInt)len);
+#else
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < len; i++) {
+	crc ^= (unsigned char)data[i];
+	for (int b = 0; b < 8; b++)
+	    crc = (crc >> 1) ^ (0xedb88320U & (0U - (crc & 1)));
+    }
+    return crc ^ 0xffffffff;
+#endif
+}
+
+#define ZIP_LOCAL_SIG 0x04034b50
+#define ZIP_CENTRAL_SIG 0x02014b50
+#define ZIP_END_SIG 0x06054b50
+#define ZIP64_LOCATOR_SIG 0x07064b50
+#define ZIP_DESCRIPTOR_SIG 0x08074b50
+#define ZIP_FLAG_ENCRYPTED 0x1
+#define ZIP_FLAG_DESCRIPTOR 0x8
+
+struct zip_entry {
+    std::string name;
+    size_t cd_off;          /**< central directory record */
+    size_t cd_len;
+    size_t local_off;       /**< local header */
+    size_t data_off;        /**< compressed contents */
+    size_t end;             /**< end of the local record, data descriptor included */
+    size_t csize;
+    size_t usize;
+    uint16_t flags;
+    uint16_t method;
+
+    bool changed = false;   /**< recompressed, with the values below */
+    size_t new_off = 0;
+    size_t new_csize = 0;
+    uint32_t new_crc = 0;
+};
+
+// Read the central directory, checking every entry lies within the file
+// and no two overlap.  Entries come back in central directory order, with
+// order holding their indexes sorted by file position.
+static bool
+zip_entries(const char *buf, size_t buflen, std::vector<zip_entry> &entries, std::vector<size_t> &order, size_t &cd_off, size_t &eocd_off, std::string &error)
+{
+    error = "not a valid zip archive";
+    if (buflen < 22)
+	return false;
+    size_t lowest = (buflen > 22 + 0xffff) ? buflen - 22 - 0xffff : 0;
+    eocd_off = buflen;
+    for (size_t i = buflen - 22 + 1; i-- > lowest; ) {
+	if (le32(buf + i) == ZIP_END_SIG && i + 22 + le16(buf + i + 20) <= buflen) {
+	    eocd_off = i;
+	    break;
+	}
+    }
+    if (eocd_off == buflen)
+	return false;
+    const char *e = buf + eocd_off;
+    size_t count = le16(e + 10);
+    size_t cd_size = le32(e + 12);
+    cd_off = le32(e + 16);
+    if (count == 0xffff || cd_size == 0xffffffff || cd_off == 0xffffffff || (eocd_off >= 20 && le32(e - 20) == ZIP64_LOCATOR_SIG)) {
+	error = "zip64 archives are not supported";
+	return false;
+    }
+    if (le16(e + 4) || le16(e + 6) || le16(e + 8) != count) {
+	error = "multi-volume zip archives are not supported";
+	return false;
+    }
+    if (cd_off > eocd_off || cd_size > eocd_off - cd_off)
+	return false;
+
+    size_t pos = cd_off;
+    for (size_t i = 0; i < count; i++) {
+	if (pos + 46 > cd_off + cd_size || le32(buf + pos) != ZIP_CENTRAL_SIG)
+	    return false;
+	zip_entry z;
+	const char *c = buf + pos;
+	z.flags = le16(c + 8);
+	z.method = le16(c + 10);
+	z.csize = le32(c + 20);
+	z.usize = le32(c + 24);
+	size_t nlen = le16(c + 28), elen = le16(c + 30), clen = le16(c + 32);
+	z.local_off = le32(c + 42);
+	z.cd_off = pos;
+	z.cd_len = 46 + nlen + elen + clen;
+	if (z.cd_len > cd_off + cd_size - pos)
+	    return false;
+	if (z.csize == 0xffffffff || z.usize == 0xffffffff || z.local_off == 0xffffffff) {
+	    error = "zip64 archives are not supported";
+	    return false;
+	}
+	z.name.assign(c + 46, nlen);
+
+	if (z.local_off + 30 > cd_off || le32(buf + z.local_off) != ZIP_LOCAL_SIG)
+	    return false;
+	z.data_off = z.local_off + 30 + le16(buf + z.local_off + 26) + le16(buf + z.local_off + 28);
+	if (z.data_off > cd_off || z.csize > cd_off - z.data_off)
+	    return false;
+	z.end = z.data_off + z.csize;
+	if (z.flags & ZIP_FLAG_DESCRIPTOR) {
+	    size_t dlen = (z.end + 4 <= cd_off && le32(buf + z.end) == ZIP_DESCRIPTOR_SIG) ? 16 : 12;
+	    if (dlen > cd_off - z.end)
+		return false;
+	    z.end += dlen;
+	}
+	entries.push_back(z);
+	pos += z.cd_len;
+    }
+
+    order.resize(entries.size());
+    for (size_t i = 0; i < order.size(); i++)
+	order[i] = i;
+    std::sort(order.begin(), order.end(), [&entries](size_t i1, size_t i2) {
+	return entries[i1].local_off < entries[i2].local_off;
+    });
+    for (size_t i = 1; i < order.size(); i++) {
+	if (entries[order[i]].local_off < entries[order[i - 1]].end)
+	    return false;
+    }
+    return true;
+}
+
+// Whether a member is a file we can unpack and clear.  Anything else -
+// directories, encrypted members, methods we don't know and, without zlib,
+// deflated members - is copied as it is.
+static bool
+zip_clearable(const zip_entry &z)
+{
+    bool is_dir = (z.name.length() && z.name[z.name.length() - 1] == '/');
+    if ((z.flags & ZIP_FLAG_ENCRYPTED) || is_dir || !z.usize)
+	return false;
+#ifdef HAVE_ZLIB
+    return (z.method == 0 || z.method == 8);
+#else
+    return (z.method == 0);
+#endif
+}
+
+static int
+clear_zip(std::ostream &out, std::ostream &err, const std::string &fname, const char *buf, size_t buflen, const PatternSet &ps, bool verbose, bool sync, size_t member_max, file_stats &fst)
+{
+    std::vector<zip_entry> entries;
+    std::vector<size_t> order;
+    size_t cd_off, eocd_off;
+    std::string error;
+    if (!zip_entries(buf, buflen, entries, order, cd_off, eocd_off, error)) {
+	err << "Unable to read archive " << fname << ": " << error << "\n";
+	return -1;
+    }
+
+#ifndef HAVE_ZLIB
+    size_t deflated = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+	const zip_entry &z = entries[i];
+	bool is_dir = (z.name.length() && z.name[z.name.length() - 1] == '/');
+	if (z.method == 8 && z.usize && !is_dir && !(z.flags & ZIP_FLAG_ENCRYPTED))
+	    deflated++;
+    }
+    if (deflated) {
+	err << "Warning:  " << fname << ": " << deflated << " deflated member(s) not checked - no zlib support\n";
+	fst.unchecked = 1;
+    }
+#endif
+
+    // Members go through in file order.  Anything between them (or ahead
+    // of the first, like a self-extractor stub) is passed on as it is.
+    unpack_stage unpack = [&](member_queue &q, std::string &uerror) {
+	size_t pos = 0;
+	for (size_t i = 0; i <= order.size(); i++) {
+	    member_ptr m(new archive_member);
+	    if (i == order.size()) {
+		m->head.assign(buf + pos, buf + cd_off);
+		return q.push(std::move(m));
+	    }
+	    const zip_entry &z = entries[order[i]];
+	    m->entry = order[i];
+	    m->name = z.name;
+	    m->head.assign(buf + pos, buf + z.local_off);
+	    pos = z.end;
+
+	    if (zip_clearable(z)) {
+		if (z.usize > member_max) {
+		    uerror = "member " + z.name + " is too large to process";
+		    return false;
+		}
+		// Deflate can't do better than about 1032:1, so anything
+		// claiming more is corrupt (and not worth allocating for)
+		if ((z.method == 0 && z.csize != z.usize) || (z.method == 8 && z.usize / 1032 > z.csize + 1)) {
+		    uerror = "member " + z.name + " is corrupt";
+		    return false;
+		}
+		m->data.resize(z.usize);
+		if (z.method == 0) {
+		    memcpy(m->data.data(), buf + z.data_off, z.usize);
+		} else {
+#ifdef HAVE_ZLIB
+		    z_stream zs;
+		    memset(&zs, 0, sizeof(zs));
+		    // -15 - raw deflate data, no wrapper
+		    if (inflateInit2(&zs, -15) != Z_OK) {
+			uerror = "Unable to initialize decompression";
+			return false;
+		    }
+		    zs.next_in = (Bytef *)buf + z.data_off;
+		    zs.avail_in = (uInt)z.csize;
+		    zs.next_out = (Bytef *)m->data.data();
+		    zs.avail_out = (uInt)z.usize;
+		    int ret = inflate(&zs, Z_FINISH);
+		    bool ok = (ret == Z_STREAM_END && zs.total_out == z.usize);
+		    inflateEnd(&zs);
+		    if (!ok) {
+			uerror = "member " + z.name + " is corrupt";
+			return false;
+		    }
+#endif
+		}
+		m->clear = true;
+	    }
+	    if (!q.push(std::move(m)))
+		return false;
+	}
+	return true;
+    };
+
+    int dirty = archive_dirty(err, fname, ps, unpack, fst);
+    if (dirty <= 0)
+	return dirty;
+
+    AtomicFile af(fname.c_str(), sync);
+    if (!af.valid) {
+	err << "Unable to write updated archive " << fname << ": " << strerror(errno) << "\n";
+	return -1;
+    }
+    unsigned long long opos = 0;
+
+    repack_stage repack = [&](archive_member &m, std::string &rerror) {
+	rerror = strerror(errno);
+	if (!af.write(m.head.data(), m.head.size()))
+	    return false;
+	opos += m.head.size();
+	if (m.entry == (size_t)-1)
+	    return true;
+	zip_entry &z = entries[m.entry];
+	z.new_off = (size_t)opos;
+
+	// Untouched members are copied as they are, still compressed
+	if (!m.cleared.size()) {
+	    if (!af.write(buf + z.local_off, z.end - z.local_off))
+		return false;
+	    opos += z.end - z.local_off;
+	    return true;
+	}
+
+	std::vector<char> cdata;
+	const char *dptr = m.data.data();
+	size_t dlen = m.data.size();
+	if (z.method == 8) {
+#ifdef HAVE_ZLIB
+	    z_stream zs;
+	    memset(&zs, 0, sizeof(zs));
+	    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		rerror = "Unable to initialize compression";
+		return false;
+	    }
+	    cdata.resize(deflateBound(&zs, (uLong)dlen));
+	    zs.next_in = (Bytef *)dptr;
+	    zs.avail_in = (uInt)dlen;
+	    zs.next_out = (Bytef *)cdata.data();
+	    zs.avail_out = (uInt)cdata.size();
+	    int ret = deflate(&zs, Z_FINISH);
+	    cdata.resize(zs.total_out);
+	    deflateEnd(&zs);
+	    if (ret != Z_STREAM_END || cdata.size() >= 0xffffffff) {
+		rerror = "Unable to compress member " + z.name;
+		return false;
+	    }
+	    dptr = cdata.data();
+	    dlen = cdata.size();
+#endif
+	}
+
+	z.changed = true;
+	z.new_csize = dlen;
+	z.new_crc = zip_crc32(m.data.data(), m.data.size());
+
+	// The sizes and CRC now go in the local header, not a descriptor
+	std::vector<char> lh(buf + z.local_off, buf + z.data_off);
+	put_le16(lh.data() + 6, (uint16_t)(z.flags & ~ZIP_FLAG_DESCRIPTOR));
+	put_le32(lh.data() + 14, z.new_crc);
+	put_le32(lh.data() + 18, (uint32_t)z.new_csize);
+	put_le32(lh.data() + 22, (uint32_t)z.usize);
+	if (!af.write(lh.data(), lh.size()) || !af.write(dptr, dlen))
+	    return false;
+	opos += lh.size() + dlen;
+	return true;
+    };
+
+    int grcnt = run_pipeline(out, err, fname, ps, verbose, unpack, repack, fst);
+    if (grcnt <= 0)
+	return grcnt;
+
+    // New central directory, pointing at the members' new positions
+    phase_timer wt(&fst.write_time);
+    size_t new_cd_off = (size_t)opos;
+    bool ok = (opos < 0xffffffff);
+    for (size_t i = 0; ok && i < entries.size(); i++) {
+	const zip_entry &z = entries[i];
+	std::vector<char> rec(buf + z.cd_off, buf + z.cd_off + z.cd_len);
+	if (z.changed) {
+	    put_le16(rec.data() + 8, (uint16_t)(z.flags & ~ZIP_FLAG_DESCRIPTOR));
+	    put_le32(rec.data() + 16, z.new_crc);
+	    put_le32(rec.data() + 20, (uint32_t)z.new_csize);
+	}
+	put_le32(rec.data() + 42, (uint32_t)z.new_off);
+	ok = af.write(rec.data(), rec.size());
+	opos += rec.size();
+    }
+    std::vector<char> eocd(buf + eocd_off, buf + buflen);
+    put_le32(eocd.data() + 16, (uint32_t)new_cd_off);
+    if (!ok || !af.write(eocd.data(), eocd.size()) || !af.commit()) {
+	err << "Unable to write updated archive " << fname << ": " << af.error() << "\n";
+	return -1;
+    }
+    fst.bytes_written += opos + eocd.size();
+    return grcnt;
+}
+
+archive_type
+archive_format(const char *buf, size_t buflen)
+{
+    if (buflen >= 4 && le32(buf) == ZIP_LOCAL_SIG)
+	return ARCHIVE_ZIP;
+    if (buflen >= TAR_BLOCK && tar_header_valid(buf))
+	return ARCHIVE_TAR;
+#ifdef HAVE_ZLIB
+    if (buflen >= 18 && (unsigned char)buf[0] == 0x1f && (unsigned char)buf[1] == 0x8b) {
+	char block[TAR_BLOCK];
+	size_t got;
+	tar_reader rd(buf, buflen, true);
+	if (rd.read(block, TAR_BLOCK, got) && got == TAR_BLOCK && tar_header_valid(block))
+	    return ARCHIVE_TAR_GZ;
+    }
+#else
+    // No telling what's inside - it may well be a tar file
+    if (buflen >= 18 && (unsigned char)buf[0] == 0x1f && (unsigned char)buf[1] == 0x8b)
+	return ARCHIVE_TAR_GZ;
+#endif
+    return ARCHIVE_NONE;
+}
+
+int
+process_archive(std::ostream &out, std::ostream &err, const std::string &fname, const PatternSet &ps, bool verbose, bool sync, size_t member_max, file_stats &fst)
+{
+    if (!ps.tcnt)
+	return 0;
+
+    phase_timer rt(&fst.read_time);
+    MappedFile mf(fname.c_str(), false, true);
+    rt.stop();
+    if (!mf.valid) {
+	err << "Unable to open file " << fname << "\n";
+	return -1;
+    }
+    if (mf.mapped) {
+	fst.mapped = 1;
+	mf.advise(MappedFile::SEQUENTIAL);
+    } else {
+	fst.bytes_read += mf.buflen;
+    }
+
+    const char *buf = (const char *)mf.buf;
+    switch (archive_format(buf, mf.buflen)) {
+	case ARCHIVE_TAR:
+	    return clear_tar(out, err, fname, buf, mf.buflen, false, ps, verbose, sync, member_max, fst);
+	case ARCHIVE_TAR_GZ:
+#ifndef HAVE_ZLIB
+	    err << "Warning:  " << fname << " not checked - it is compressed, and there is no zlib support\n";
+	    fst.unchecked = 1;
+	    return 0;
+#endif
+	    return clear_tar(out, err, fname, buf, mf.buflen, true, ps, verbose, sync, member_max, fst);
+	case ARCHIVE_ZIP:
+	    return clear_zip(out, err, fname, buf, mf.buflen, ps, verbose, sync, member_max, fst);
+	default:
+	    break;
+    }
+    err << fname << " is not a recognized archive\n";
+    return -1;
+}
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
@@ -0,0 +1,88 @@
+/*                  A R C H I V E . H P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file Archive.hpp
+ *
+ * Clearing strings inside the members of tar, gzipped tar and zip
+ * archives, without extracting them.
+ *
+ * The archive is streamed through a three stage pipeline - unpacking
+ * (decompressing and splitting into members), clearing, and repacking
+ * (compressing and writing) - with each stage on its own thread, and the
+ * result replaces the original the same way any rewritten file does.
+ * Archives with nothing to clear are found by a scan of the members first
+ * and left alone.  Only regular file members are cleared; names, headers
+ * and metadata are copied as they are.
+ */
+
+#ifndef ARCHIVE_HPP
+#define ARCHIVE_HPP
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+#include "PatternSet.hpp"
+#include "Stats.hpp"
+
+enum archive_type {
+    ARCHIVE_NONE = 0,
+    ARCHIVE_TAR,
+    ARCHIVE_TAR_GZ,
+    ARCHIVE_ZIP
+};
+
+/* Recognize an archive we can clear from the start of the file.  Gzip
+ * files are only archives if what they hold is a tar file - without zlib
+ * there's no looking inside, so every gzip file counts as one. */
+archive_type archive_format(const char *buf, size_t buflen);
+
+/* Clear the strings in every regular member of the archive fname.  Members
+ * are held in memory one at a time (a few in flight between the stages),
+ * and none may be larger than member_max bytes.  Without zlib, deflated zip
+ * members are copied unchecked and gzipped archives are left alone, with a
+ * warning to err and fst.unchecked set.  Returns the number of strings
+ * cleared, or -1 on error - in which case the archive is left as it was. */
+int process_archive(std::ostream &out, std::ostream &err, const std::string &fname, const PatternSet &ps, bool verbose, bool sync, size_t member_max, file_stats &fst);
+
+#endif /* ARCHIVE_HPP */
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
@@ -0,0 +1,390 @@
+/*                  A T O M I C F I L E . C P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file AtomicFile.cpp
+ *
+ * Temp file + rename replacement of file contents
+ */
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE 1 /* copy_file_range */
+#endif
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "AtomicFile.hpp"
+
+#if defined(_WIN32) && !defined(__CYGWIN__)
+#  ifdef WIN32_LEAN_AND_MEAN
+#    undef WIN32_LEAN_AND_MEAN
+#  endif
+#  define WIN32_LEAN_AND_MEAN 434144 /* don't want winsock.h */
+
+#  ifdef NOMINMAX
+#    undef NOMINMAX
+#  endif
+#  define NOMINMAX 434144 /* don't break std::min and std::max */
+
+#  include <windows.h>
+
+#  undef WIN32_LEAN_AND_MEAN /* unset to not interfere with calling apps */
+#  undef NOMINMAX
+#  include <io.h>
+#  include <fcntl.h>
+#  include <sys/stat.h>
+
+#else
+
+#  ifdef HAVE_SYS_STAT_H
+#    include <sys/stat.h>
+#  endif
+
+#  ifdef HAVE_FCNTL_H
+#    include <fcntl.h>
+#  endif
+
+#  ifdef HAVE_UNISTD_H
+#    include <unistd.h>
+#  endif
+
+#endif
+
+/* Spans shorter than this are cheaper to write from the mapping than to
+ * hand to the kernel */
+#define KERNEL_COPY_MIN (64 * 1024)
+
+#if defined(_WIN32) && !defined(__CYGWIN__)
+
+AtomicFile::AtomicFile(const char *fname, bool do_sync)
+{
+    valid = false;
+    fd = -1;
+    src_fd = -1;
+    sync = do_sync;
+    committed = false;
+    kept = false;
+
+    if (!fname)
+	return;
+
+    name = std::string(fname);
+    std::vector<char> tbuf(name.length() + 16);
+    snprintf(tbuf.data(), tbuf.size(), "%s.strclearXXXXXX", fname);
+    if (_mktemp_s(tbuf.data(), tbuf.size()))
+	return;
+    tmpname = std::string(tbuf.data());
+
+    fd = _open(tmpname.c_str(), _O_CREAT | _O_EXCL | _O_WRONLY | _O_BINARY, _S_IREAD | _S_IWRITE);
+    src_fd = _open(fname, _O_RDONLY | _O_BINARY);
+    valid = (fd >= 0);
+}
+
+AtomicFile::~AtomicFile()
+{
+    if (fd >= 0)
+	_close(fd);
+    if (src_fd >= 0)
+	_close(src_fd);
+    if (valid && !committed)
+	_unlink(tmpname.c_str());
+}
+
+bool
+AtomicFile::write(const char *buf, size_t len)
+{
+    while (len) {
+	unsigned int chunk = (len > 0x40000000) ? 0x40000000 : (unsigned int)len;
+	int ret = _write(fd, buf, chunk);
+	if (ret <= 0)
+	    return false;
+	buf += ret;
+	len -= ret;
+    }
+    return true;
+}
+
+bool
+AtomicFile::copy_span(const char *src, size_t offset, size_t len)
+{
+    return write(src + offset, len);
+}
+
+bool
+AtomicFile::commit()
+{
+    if (!valid || committed)
+	return false;
+
+    struct _stat64 sb;
+    bool have_sb = (src_fd >= 0 && !_fstat64(src_fd, &sb));
+    if (sync && _commit(fd))
+	return false;
+    _close(fd);
+    fd = -1;
+    if (src_fd >= 0) {
+	_close(src_fd);
+	src_fd = -1;
+    }
+    if (have_sb)
+	_chmod(tmpname.c_str(), sb.st_mode & (_S_IREAD | _S_IWRITE));
+
+    DWORD flags = MOVEFILE_REPLACE_EXISTING;
+    if (sync)
+	flags |= MOVEFILE_WRITE_THROUGH;
+    if (!MoveFileExA(tmpname.c_str(), name.c_str(), flags))
+	return false;
+
+    committed = true;
+    return true;
+}
+
+#else /* POSIX */
+
+AtomicFile::AtomicFile(const char *fname, bool do_sync)
+{
+    valid = false;
+    fd = -1;
+    src_fd = -1;
+    sync = do_sync;
+    committed = false;
+    kept = false;
+
+    if (!fname)
+	return;
+
+    /* Replace the file a symlink points to, not the symlink */
+    char *rpath = realpath(fname, NULL);
+    name = std::string((rpath) ? rpath : fname);
+    free(rpath);
+
+    std::string tmpl = name + ".strclearXXXXXX";
+    std::vector<char> tbuf(tmpl.begin(), tmpl.end());
+    tbuf.push_back('\0');
+    fd = mkstemp(tbuf.data());
+    if (fd < 0)
+	return;
+    tmpname = std::string(tbuf.data());
+
+    src_fd = open(name.c_str(), O_RDONLY);
+    valid = true;
+}
+
+AtomicFile::~AtomicFile()
+{
+    if (fd >= 0)
+	(void)close(fd);
+    if (src_fd >= 0)
+	(void)close(src_fd);
+    if (valid && !committed && !kept)
+	(void)unlink(tmpname.c_str());
+}
+
+bool
+AtomicFile::write(const char *buf, size_t len)
+{
+    if (!valid)
+	return false;
+    while (len) {
+	ssize_t ret = ::write(fd, buf, len);
+	if (ret < 0 && errno == EINTR)
+	    continue;
+	if (ret <= 0)
+	    return false;
+	buf += ret;
+	len -= ret;
+    }
+    return true;
+}
+
+bool
+AtomicFile::copy_span(const char *src, size_t offset, size_t len)
+{
+    if (!valid)
+	return false;
+#ifdef HAVE_COPY_FILE_RANGE
+    if (len >= KERNEL_COPY_MIN && src_fd >= 0) {
+	/* Both the kernel copy and write() advance fd's file offset, so
+	 * the two can be mixed freely */
+	off_t in_off = (off_t)offset;
+	while (len) {
+	    ssize_t ret = copy_file_range(src_fd, &in_off, fd, NULL, len, 0);
+	    if (ret < 0 && errno == EINTR)
+		continue;
+	    if (ret <= 0)
+		break;
+	    len -= ret;
+	}
+	offset = (size_t)in_off;
+    }
+#endif
+    return write(src + offset, len);
+}
+
+/* Copy the finished temporary back over a multiply linked original.  The
+ * original is only cut to the new length once all of it has been written,
+ * and touched is set once it has been written to at all - after that a
+ * failure leaves the temporary as the only complete copy. */
+static bool
+copy_back(int tmp_fd, const char *fname, const struct stat *sb, bool sync, bool *touched)
+{
+    int ofd = open(fname, O_WRONLY);
+    if (ofd < 0)
+	return false;
+    std::vector<char> block(256 * 1024);
+    off_t total = 0;
+    bool ok = (lseek(tmp_fd, 0, SEEK_SET) == 0);
+    while (ok) {
+	ssize_t rd = read(tmp_fd, block.data(), block.size());
+	if (rd < 0 && errno == EINTR)
+	    continue;
+	if (rd <= 0) {
+	    ok = (rd == 0);
+	    break;
+	}
+	*touched = true;
+	for (ssize_t wr = 0; ok && wr < rd; ) {
+	    ssize_t ret = ::write(ofd, block.data() + wr, rd - wr);
+	    if (ret < 0 && errno == EINTR)
+		continue;
+	    ok = (ret > 0);
+	    wr += (ok) ? ret : 0;
+	}
+	total += rd;
+    }
+    if (ok && ftruncate(ofd, total))
+	ok = false;
+    if (ok && sync && fsync(ofd))
+	ok = false;
+#ifdef __APPLE__
+    struct timespec times[2] = {sb->st_atimespec, sb->st_mtimespec};
+#else
+    struct timespec times[2] = {sb->st_atim, sb->st_mtim};
+#endif
+    if (ok)
+	(void)futimens(ofd, times);
+    int errsv = errno;
+    if (close(ofd) && ok) {
+	errsv = errno;
+	ok = false;
+    }
+    errno = errsv;
+    return ok;
+}
+
+bool
+AtomicFile::commit()
+{
+    if (!valid || committed)
+	return false;
+
+    struct stat sb;
+    bool have_sb = (src_fd >= 0 && !fstat(src_fd, &sb));
+
+    if (have_sb && sb.st_nlink > 1) {
+	/* Renaming would leave the other links with the old contents */
+	if (sync && fsync(fd))
+	    return false;
+	bool touched = false;
+	if (!copy_back(fd, name.c_str(), &sb, sync, &touched)) {
+	    /* Don't throw away the only complete copy */
+	    kept = touched;
+	    return false;
+	}
+	committed = true;
+	(void)unlink(tmpname.c_str());
+	return true;
+    }
+
+    if (have_sb) {
+	/* Ownership first - chown can clear setuid/setgid bits.  Changing
+	 * the owner will fail unless we're privileged, which is fine. */
+	if (fchown(fd, sb.st_uid, sb.st_gid))
+	    (void)fchown(fd, (uid_t)-1, sb.st_gid);
+	if (fchmod(fd, sb.st_mode & 07777))
+	    return false;
+#ifdef __APPLE__
+	struct timespec times[2] = {sb.st_atimespec, sb.st_mtimespec};
+#else
+	struct timespec times[2] = {sb.st_atim, sb.st_mtim};
+#endif
+	(void)futimens(fd, times);
+    }
+
+    if (sync && fsync(fd))
+	return false;
+    int ret = close(fd);
+    fd = -1;
+    if (ret)
+	return false;
+
+    if (rename(tmpname.c_str(), name.c_str()))
+	return false;
+    committed = true;
+
+    /* Make the rename itself durable */
+    if (sync) {
+	size_t slash = name.find_last_of('/');
+	std::string dname = (slash == std::string::npos) ? std::string(".") : name.substr(0, (slash) ? slash : 1);
+	int dfd = open(dname.c_str(), O_RDONLY);
+	if (dfd >= 0) {
+	    (void)fsync(dfd);
+	    (void)close(dfd);
+	}
+    }
+
+    return true;
+}
+
+#endif /* POSIX */
+
+std::string
+AtomicFile::error() const
+{
+    std::string msg(strerror(errno));
+    if (kept)
+	msg += " - " + name + " is incomplete, its new contents were kept in " + tmpname;
+    return msg;
+}
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
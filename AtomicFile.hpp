@@ -0,0 +1,104 @@
+/*                  A T O M I C F I L E . H P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file AtomicFile.hpp
+ *
+ * Crash safe replacement of a file's contents.
+ *
+ * New contents are written to a temporary file in the same directory,
+ * which is given the original's mode, ownership and timestamps and then
+ * renamed over it, so an interrupted run never leaves a partially written
+ * file behind.  Unchanged spans of the original can be copied in the
+ * kernel (copy_file_range) rather than through user space.
+ *
+ * A file with more than one hard link can't be replaced by rename without
+ * breaking the links, so for those the finished contents are copied back
+ * over the original instead.  That isn't atomic - if the copy fails part
+ * way, the temporary is kept rather than discarded, as the only complete
+ * copy of the new contents.
+ */
+
+#ifndef ATOMICFILE_HPP
+#define ATOMICFILE_HPP
+
+#include <cstddef>
+#include <string>
+
+class AtomicFile {
+    public:
+	/* Start replacing fname.  If sync is set, the new contents are
+	 * flushed to disk before the rename and the directory after it. */
+	AtomicFile(const char *fname, bool sync = false);
+
+	/* Discards the temporary file unless commit() succeeded (or kept
+	 * it) */
+	~AtomicFile();
+
+	/* Append len bytes from buf to the new contents */
+	bool write(const char *buf, size_t len);
+
+	/* Append bytes [offset, offset + len) of the original file.  src
+	 * must hold the original contents (typically a MappedFile buffer)
+	 * and is used for any part that can't be copied in the kernel. */
+	bool copy_span(const char *src, size_t offset, size_t len);
+
+	/* Copy the original's metadata to the new file and move it into
+	 * place. */
+	bool commit();
+
+	/* Why write() or commit() just failed, from errno, and where the new
+	 * contents are if the failure left the original incomplete */
+	std::string error() const;
+
+	std::string name;       /**< file being replaced (symlinks resolved) */
+	std::string tmpname;    /**< temporary holding the new contents */
+	bool valid;             /**< temporary was created */
+	bool kept;              /**< a failed copy back left the temporary in place */
+    private:
+	int fd;                 /**< temporary file descriptor */
+	int src_fd;             /**< original file, for metadata and kernel copies */
+	bool sync;
+	bool committed;
+};
+
+#endif /* ATOMICFILE_HPP */
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
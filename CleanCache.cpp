@@ -0,0 +1,220 @@
+/*                  C L E A N C A C H E . C P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file CleanCache.cpp
+ *
+ * Cache of files known to be clean
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include "AtomicFile.hpp"
+#include "CleanCache.hpp"
+
+#ifdef HAVE_SYS_STAT_H
+#  include <sys/stat.h>
+#endif
+
+#define CACHE_MAGIC "strclrc1"
+#define CACHE_BOM 0x01020304
+
+struct cache_header {
+    char magic[8];      /**< CACHE_MAGIC */
+    uint32_t bom;       /**< CACHE_BOM in the writer's byte order */
+    uint32_t esize;     /**< sizeof(CleanCache::entry) */
+    uint64_t count;     /**< number of entries following */
+};
+
+uint64_t
+fnv1a_hash(const void *data, size_t len, uint64_t h)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t i = 0; i < len; i++) {
+	h ^= p[i];
+	h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static bool
+entry_less(const CleanCache::entry &e1, const CleanCache::entry &e2)
+{
+    if (e1.path_hash != e2.path_hash)
+	return e1.path_hash < e2.path_hash;
+    return e1.set_hash < e2.set_hash;
+}
+
+static uint64_t
+path_hash(const std::string &path)
+{
+    std::error_code ec;
+    std::string apath = std::filesystem::absolute(path, ec).lexically_normal().string();
+    if (ec)
+	apath = path;
+    return fnv1a_hash(apath.data(), apath.length());
+}
+
+CleanCache::CleanCache(const char *fname, uint64_t shash)
+    : name((fname) ? fname : ""), set_hash(shash), mf(fname, false, true), entries(NULL), nentries(0)
+{
+    // Anything we don't recognize is ignored, and replaced on save
+    if (!mf.buf || mf.buflen < sizeof(cache_header))
+	return;
+    const cache_header *h = (const cache_header *)mf.buf;
+    if (memcmp(h->magic, CACHE_MAGIC, sizeof(h->magic)) || h->bom != CACHE_BOM || h->esize != sizeof(entry))
+	return;
+    if (h->count > (mf.buflen - sizeof(cache_header)) / sizeof(entry))
+	return;
+    // Every lookup binary searches the whole index
+    mf.advise(MappedFile::WILLNEED);
+    entries = (const entry *)((const char *)mf.buf + sizeof(cache_header));
+    nentries = (size_t)h->count;
+}
+
+bool
+CleanCache::identify(const std::string &path, entry &e) const
+{
+#if defined(HAVE_SYS_STAT_H) && !defined(_WIN32)
+    struct stat sb;
+    if (stat(path.c_str(), &sb) < 0 || !S_ISREG(sb.st_mode))
+	return false;
+#  ifdef __APPLE__
+    const struct timespec &mt = sb.st_mtimespec;
+    const struct timespec &ct = sb.st_ctimespec;
+#  else
+    const struct timespec &mt = sb.st_mtim;
+    const struct timespec &ct = sb.st_ctim;
+#  endif
+    e.path_hash = path_hash(path);
+    e.set_hash = set_hash;
+    e.size = (uint64_t)sb.st_size;
+    e.mtime = (int64_t)mt.tv_sec * 1000000000 + mt.tv_nsec;
+    e.ctime = (int64_t)ct.tv_sec * 1000000000 + ct.tv_nsec;
+    e.ino = (uint64_t)sb.st_ino;
+    e.dev = (uint64_t)sb.st_dev;
+    return true;
+#else
+    /* No reliable file identity - never cache anything */
+    (void)path;
+    (void)e;
+    return false;
+#endif
+}
+
+bool
+CleanCache::is_clean(const std::string &path) const
+{
+    entry e;
+    if (!nentries || !identify(path, e))
+	return false;
+    const entry *it = std::lower_bound(entries, entries + nentries, e, entry_less);
+    if (it == entries + nentries || it->path_hash != e.path_hash || it->set_hash != e.set_hash)
+	return false;
+    return (it->size == e.size && it->mtime == e.mtime && it->ctime == e.ctime && it->ino == e.ino && it->dev == e.dev);
+}
+
+void
+CleanCache::record(const std::string &path, bool clean)
+{
+    entry e;
+    bool have_id = (clean && identify(path, e));
+    std::lock_guard<std::mutex> guard(lock);
+    if (have_id)
+	added.push_back(e);
+    else
+	dropped.push_back(path_hash(path));
+}
+
+int
+CleanCache::save(std::ostream &err)
+{
+    if (!added.size() && !dropped.size())
+	return 0;
+
+    // Everything processed this run replaces what the old cache had to
+    // say about it for this pattern set
+    std::sort(added.begin(), added.end(), entry_less);
+    added.erase(std::unique(added.begin(), added.end(), [](const entry &e1, const entry &e2) {
+	return !entry_less(e1, e2) && !entry_less(e2, e1);
+    }), added.end());
+    std::sort(dropped.begin(), dropped.end());
+    std::vector<entry> nmerged;
+    nmerged.reserve(nentries + added.size());
+    for (size_t i = 0; i < nentries; i++) {
+	const entry &e = entries[i];
+	if (e.set_hash == set_hash) {
+	    if (std::binary_search(dropped.begin(), dropped.end(), e.path_hash))
+		continue;
+	    if (std::binary_search(added.begin(), added.end(), e, entry_less))
+		continue;
+	}
+	nmerged.push_back(e);
+    }
+    size_t old_cnt = nmerged.size();
+    nmerged.insert(nmerged.end(), added.begin(), added.end());
+    std::inplace_merge(nmerged.begin(), nmerged.begin() + old_cnt, nmerged.end(), entry_less);
+
+    // Later lookups (if the cache is kept for another run) see the merged
+    // records rather than the file as loaded
+    merged.swap(nmerged);
+    entries = merged.data();
+    nentries = merged.size();
+    added.clear();
+    dropped.clear();
+    if (!name.length())
+	return 0;
+
+    cache_header h;
+    memcpy(h.magic, CACHE_MAGIC, sizeof(h.magic));
+    h.bom = CACHE_BOM;
+    h.esize = sizeof(entry);
+    h.count = merged.size();
+
+    AtomicFile af(name.c_str());
+    if (!af.write((const char *)&h, sizeof(h)) || !af.write((const char *)merged.data(), merged.size() * sizeof(entry)) || !af.commit()) {
+	err << "Unable to write cache file " << name << "\n";
+	return -1;
+    }
+    return 0;
+}
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
@@ -0,0 +1,128 @@
+/*                  C L E A N C A C H E . H P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file CleanCache.hpp
+ *
+ * On-disk record of files already known to contain none of the targets,
+ * so incremental runs over mostly unchanged trees can skip them without
+ * opening them.
+ *
+ * A file is identified by its (absolute) path, size, modification and
+ * status change times, inode and device.  (The change time catches
+ * rewrites that carry the old modification time over, as AtomicFile,
+ * cp -p and tar all do.)  The entry is only valid for the same pattern set
+ * hash - a hash of the strings and every setting that affects the result.
+ * If any of them differ the file is processed as usual.  Entries for
+ * several different pattern sets can share one cache file.
+ *
+ * The cache file is a sorted array of fixed size records behind a short
+ * header, searched in place through a read-only mapping.  Updates are
+ * merged into a new copy that replaces the old one atomically when the
+ * run is done, so an interrupted run leaves the previous cache intact.
+ *
+ * A cache can also be held in memory only, and a cache object can be kept
+ * for any number of runs (as the --serve daemon does) - saving folds the
+ * run's updates into the entries it looks up from then on.
+ */
+
+#ifndef CLEANCACHE_HPP
+#define CLEANCACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "MappedFile.hpp"
+
+class CleanCache {
+    public:
+	/* Load the cache from fname (a missing or unusable file gives an
+	 * empty cache, and no fname a cache held only in memory).  Lookups
+	 * and updates are for entries with set_hash. */
+	CleanCache(const char *fname, uint64_t set_hash);
+
+	/* True if path was recorded as clean and doesn't appear to have
+	 * changed since.  Only stats the file. */
+	bool is_clean(const std::string &path) const;
+
+	/* Record the outcome of processing path - clean entries are stored,
+	 * anything else drops any existing entry.  Thread safe. */
+	void record(const std::string &path, bool clean);
+
+	/* Merge the updates recorded since the last save into the cache and
+	 * write it out, if anything changed (and the cache has a file).
+	 * Returns -1 (after reporting to err) on failure, else 0. */
+	int save(std::ostream &err);
+
+	struct entry {
+	    uint64_t path_hash;  /**< hash of the absolute path */
+	    uint64_t set_hash;   /**< pattern set the file was clean for */
+	    uint64_t size;
+	    int64_t mtime;       /**< modification time, in nanoseconds */
+	    int64_t ctime;       /**< status change time, in nanoseconds */
+	    uint64_t ino;
+	    uint64_t dev;
+	};
+
+	std::string name;    /**< cache file (empty if held in memory only) */
+	uint64_t set_hash;   /**< pattern set hash for this run (may be changed between runs) */
+    private:
+	bool identify(const std::string &path, entry &e) const;
+
+	MappedFile mf;                /**< existing cache contents */
+	const entry *entries;         /**< sorted records, in mf or merged */
+	size_t nentries;
+	std::mutex lock;
+	std::vector<entry> merged;    /**< records as of the last save */
+	std::vector<entry> added;     /**< clean files recorded this run */
+	std::vector<uint64_t> dropped; /**< path hashes of files found not clean */
+};
+
+/* 64 bit FNV-1a hash, for building pattern set hashes.  Chain calls by
+ * passing the previous result as h. */
+uint64_t fnv1a_hash(const void *data, size_t len, uint64_t h = 0xcbf29ce484222325ULL);
+
+#endif /* CLEANCACHE_HPP */
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
@@ -0,0 +1,313 @@
+/*                  D I R W A L K E R . C P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file DirWalker.cpp
+ *
+ * Parallel directory traversal
+ */
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#include "DirWalker.hpp"
+
+#ifdef HAVE_SYS_STAT_H
+#  include <sys/stat.h>
+#endif
+
+/* pstart is the start of the whole pattern, for telling whether a '**'
+ * begins a path component */
+static bool
+glob_match_from(const char *pstart, const char *p, const char *s)
+{
+    for (; *p; p++, s++) {
+	switch (*p) {
+	    case '*':
+		if (p[1] == '*') {
+		    /* '**' - match anything, separators included.  When it
+		     * is a whole component it can also stand for no
+		     * directories at all, matching a top level file */
+		    bool component = (p == pstart || p[-1] == '/');
+		    while (*p == '*')
+			p++;
+		    if (!*p)
+			return true;
+		    if (component && *p == '/' && glob_match_from(pstart, p + 1, s))
+			return true;
+		    for (; *s; s++) {
+			if (glob_match_from(pstart, p, s))
+			    return true;
+		    }
+		    return false;
+		}
+		/* '*' - match anything within this component */
+		for (;; s++) {
+		    if (glob_match_from(pstart, p + 1, s))
+			return true;
+		    if (!*s || *s == '/')
+			return false;
+		}
+	    case '?':
+		if (!*s || *s == '/')
+		    return false;
+		break;
+	    case '[': {
+		if (!*s || *s == '/')
+		    return false;
+		const char *c = p + 1;
+		bool negate = (*c == '!' || *c == '^');
+		if (negate)
+		    c++;
+		bool found = false;
+		/* A leading ']' is a literal member of the class */
+		for (bool first = true; *c && (first || *c != ']'); first = false, c++) {
+		    if (c[1] == '-' && c[2] && c[2] != ']') {
+			if (*s >= c[0] && *s <= c[2])
+			    found = true;
+			c += 2;
+		    } else if (*c == *s) {
+			found = true;
+		    }
+		}
+		if (!*c) {
+		    /* Unterminated class - treat the '[' literally */
+		    if (*s != '[')
+			return false;
+		    break;
+		}
+		if (found == negate)
+		    return false;
+		p = c;
+		break;
+	    }
+	    default:
+		if (*p != *s)
+		    return false;
+	}
+    }
+    return !*s;
+}
+
+bool
+glob_match(const char *p, const char *s)
+{
+    return glob_match_from(p, p, s);
+}
+
+struct walk_file {
+    std::string path;
+    bool linked;    /**< more than one hard link */
+    std::pair<unsigned long long, unsigned long long> inode; /**< (device, inode) if linked */
+};
+
+static bool
+match_any(const std::vector<std::string> &globs, const std::string &name, const std::string &relpath)
+{
+    for (size_t i = 0; i < globs.size(); i++) {
+	const std::string &str = (globs[i].find('/') != std::string::npos) ? relpath : name;
+	if (glob_match(globs[i].c_str(), str.c_str()))
+	    return true;
+    }
+    return false;
+}
+
+DirWalker::DirWalker(size_t n)
+{
+    nthreads = (n) ? n : std::thread::hardware_concurrency();
+    if (!nthreads)
+	nthreads = 1;
+}
+
+int
+DirWalker::check(const std::vector<std::string> &roots, std::ostream &err)
+{
+    int ret = 0;
+    for (size_t i = 0; i < roots.size(); i++) {
+	std::error_code ec;
+	if (!std::filesystem::is_directory(roots[i], ec)) {
+	    err << "Unable to read directory " << roots[i] << "\n";
+	    ret = -1;
+	}
+    }
+    return ret;
+}
+
+/* List the trees below roots, passing each directory's files to listed.
+ * The calls are made one at a time, from whichever thread listed the
+ * directory. */
+static int
+walk_trees(const DirWalker &walker, const std::vector<std::string> &roots, const std::function<void(std::vector<walk_file> &)> &listed, std::ostream &err)
+{
+    namespace fs = std::filesystem;
+
+    /* Pending directories, with the length of their root's path and
+     * separator so we can get at the root relative path for matching */
+    std::deque<std::pair<std::string, size_t>> dirs;
+    std::mutex lock;
+    std::condition_variable cv;
+    size_t active = 0;
+    int ret = 0;
+
+    for (size_t i = 0; i < roots.size(); i++) {
+	std::error_code ec;
+	if (!fs::is_directory(roots[i], ec)) {
+	    err << "Unable to read directory " << roots[i] << "\n";
+	    ret = -1;
+	    continue;
+	}
+	std::string root = roots[i];
+	while (root.length() > 1 && root.back() == '/')
+	    root.pop_back();
+	size_t skip = root.length() + ((root.back() == '/') ? 0 : 1);
+	dirs.push_back(std::make_pair(root, skip));
+    }
+
+    auto worker = [&]() {
+	std::unique_lock<std::mutex> guard(lock);
+	for (;;) {
+	    cv.wait(guard, [&]() { return !dirs.empty() || !active; });
+	    if (dirs.empty())
+		break;
+	    std::pair<std::string, size_t> dir = dirs.front();
+	    dirs.pop_front();
+	    active++;
+	    guard.unlock();
+
+	    std::vector<walk_file> lfiles;
+	    std::vector<std::string> ldirs;
+	    std::string errmsg;
+	    std::error_code ec;
+	    for (fs::directory_iterator it(dir.first, ec), end; !ec && it != end; it.increment(ec)) {
+		fs::file_status st = it->symlink_status(ec);
+		if (ec || fs::is_symlink(st))
+		    continue;
+		std::string path = it->path().string();
+		std::string name = it->path().filename().string();
+		std::string relpath = path.substr(std::min(path.length(), dir.second));
+		if (match_any(walker.excludes, name, relpath))
+		    continue;
+		if (fs::is_directory(st)) {
+		    ldirs.push_back(path);
+		    continue;
+		}
+		if (!fs::is_regular_file(st))
+		    continue;
+		if (walker.includes.size() && !match_any(walker.includes, name, relpath))
+		    continue;
+		walk_file wf = {path, false, {0, 0}};
+#ifdef HAVE_SYS_STAT_H
+		struct stat sb;
+		if (!lstat(path.c_str(), &sb) && sb.st_nlink > 1) {
+		    wf.linked = true;
+		    wf.inode = std::make_pair((unsigned long long)sb.st_dev, (unsigned long long)sb.st_ino);
+		}
+#endif
+		lfiles.push_back(wf);
+	    }
+	    if (ec)
+		errmsg = "Unable to read directory " + dir.first + ": " + ec.message() + "\n";
+
+	    guard.lock();
+	    listed(lfiles);
+	    for (size_t i = 0; i < ldirs.size(); i++)
+		dirs.push_back(std::make_pair(ldirs[i], dir.second));
+	    if (errmsg.length())
+		err << errmsg;
+	    active--;
+	    cv.notify_all();
+	}
+	cv.notify_all();
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < walker.nthreads; i++)
+	workers.push_back(std::thread(worker));
+    worker();
+    for (size_t i = 0; i < workers.size(); i++)
+	workers[i].join();
+
+    return ret;
+}
+
+int
+DirWalker::walk(const std::vector<std::string> &roots, std::vector<std::string> &files, std::ostream &err)
+{
+    std::vector<walk_file> found;
+    int ret = walk_trees(*this, roots, [&](std::vector<walk_file> &lfiles) {
+	found.insert(found.end(), lfiles.begin(), lfiles.end());
+    }, err);
+
+    /* The listing order depends on thread timing - sort for repeatable
+     * results, and keep only the first path for each multiply linked
+     * inode */
+    std::sort(found.begin(), found.end(), [](const walk_file &f1, const walk_file &f2) {
+	return f1.path < f2.path;
+    });
+    std::set<std::pair<unsigned long long, unsigned long long>> inodes;
+    for (size_t i = 0; i < found.size(); i++) {
+	if (found[i].linked && !inodes.insert(found[i].inode).second)
+	    continue;
+	files.push_back(found[i].path);
+    }
+
+    return ret;
+}
+
+int
+DirWalker::walk(const std::vector<std::string> &roots, const std::function<void(const std::string &)> &found, std::ostream &err)
+{
+    std::set<std::pair<unsigned long long, unsigned long long>> inodes;
+    return walk_trees(*this, roots, [&](std::vector<walk_file> &lfiles) {
+	for (size_t i = 0; i < lfiles.size(); i++) {
+	    if (lfiles[i].linked && !inodes.insert(lfiles[i].inode).second)
+		continue;
+	    found(lfiles[i].path);
+	}
+    }, err);
+}
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
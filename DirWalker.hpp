@@ -0,0 +1,104 @@
+/*                  D I R W A L K E R . H P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file DirWalker.hpp
+ *
+ * Parallel directory tree traversal for batch processing.
+ *
+ * Directories are shared out between worker threads as they are found,
+ * so wide trees are listed concurrently.  Symbolic links are never
+ * followed or returned, and a file reachable through several hard links
+ * is only returned once.
+ *
+ * The files can be collected into a sorted list once the walk is done,
+ * or handed on one at a time as their directories are listed, so a
+ * batch can start work on the first files while the rest of a large
+ * tree is still being listed.
+ *
+ * Include and exclude patterns are shell style globs: '?' and '*' match
+ * within a single path component, '**' matches across components (and
+ * as a whole component also matches none, so a '**' directory prefix
+ * covers files at the top level too) and [...] is a character class.
+ * A pattern containing a '/' is matched against the path relative to
+ * the walk root, otherwise against the file's name alone.  Excluded
+ * directories are not descended into.
+ */
+
+#ifndef DIRWALKER_HPP
+#define DIRWALKER_HPP
+
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+class DirWalker {
+    public:
+	DirWalker(size_t nthreads);
+
+	/* Append every regular file below each of roots to files, in
+	 * sorted order.  Problems reading directories are reported to err.
+	 * Returns -1 if a root could not be read, else 0. */
+	int walk(const std::vector<std::string> &roots, std::vector<std::string> &files, std::ostream &err);
+
+	/* As above, but pass each file to found as soon as its directory
+	 * has been listed, in no particular order.  The calls are made one
+	 * at a time from the listing threads, so found should be quick.  A
+	 * multiply linked file is passed under whichever of its names is
+	 * listed first. */
+	int walk(const std::vector<std::string> &roots, const std::function<void(const std::string &)> &found, std::ostream &err);
+
+	/* Report any of roots that isn't a readable directory to err.
+	 * Returns -1 if there were any, else 0. */
+	int check(const std::vector<std::string> &roots, std::ostream &err);
+
+	std::vector<std::string> includes;  /**< if set, files must match one of these */
+	std::vector<std::string> excludes;  /**< files and directories to skip */
+	size_t nthreads;                    /**< number of threads listing directories */
+};
+
+/* Match str against the shell style glob pattern described above */
+bool glob_match(const char *pattern, const char *str);
+
+#endif /* DIRWALKER_HPP */
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
@@ -38,6 +38,8 @@
  *
  */
 
+#include <fstream>
+#include <utility>
 #include "MappedFile.hpp"
 
 #if defined __GNUC__
@@ -141,13 +143,10 @@
 #  define MAP_ANON      MAP_ANONYMOUS
 #  define MAP_FAILED    ((void *) -1)
 
-#  ifdef HAVE_OFF_T_64BIT
-#    define DWORD_HI(x) (x >> 32)
-#    define DWORD_LO(x) ((x) & 0xffffffff)
-#  else
-#    define DWORD_HI(x) (0)
-#    define DWORD_LO(x) (x)
-#  endif
+/* b_off_t is always 64 bit here, so the high word is always needed for
+ * windows into (or mappings of) files over 4GB */
+#  define DWORD_HI(x) ((DWORD)((unsigned long long)(x) >> 32))
+#  define DWORD_LO(x) ((DWORD)((unsigned long long)(x) & 0xffffffff))
 
 
 static void *
@@ -219,62 +218,275 @@ win_munmap(void *addr, size_t length, void *hv)
 }
 #endif
 
-MappedFile::MappedFile(const char *fname)
+/* Window offsets are rounded down to a multiple of this, which covers
+ * both the page size and the Windows allocation granularity */
+#define MAP_ALIGN (64 * 1024)
+
+MappedFile::MappedFile(const char *fname, bool rw, bool fallback)
+{
+    map(fname, rw, 0, 0, true, fallback);
+}
+
+MappedFile::MappedFile(const char *fname, bool rw, unsigned long long woff, size_t wlen, bool fallback)
+{
+    map(fname, rw, woff, wlen, false, fallback);
+}
+
+void
+MappedFile::map(const char *fname, bool rw, unsigned long long woff, size_t wlen, bool whole, bool fallback)
 {
     buf = NULL;
     buflen = 0;
     handle = NULL;
+    writable = false;
+    mapped = false;
+    valid = false;
+    offset = 0;
+    filelen = 0;
+    mapbase = NULL;
+    maplen = 0;
 
     if (!fname)
 	return;
 
-    name = std::string(name);
+    name = std::string(fname);
 
-    int fd = open(fname, O_RDONLY | O_BINARY);
+    int fd = open(fname, ((rw) ? O_RDWR : O_RDONLY) | O_BINARY);
 
-    if (UNLIKELY(fd < 0))
+    if (UNLIKELY(fd < 0)) {
+	if (fallback)
+	    (void)read_in(rw, woff, wlen, whole);
 	return;
+    }
 
     struct stat sb;
     int ret = fstat(fd, &sb);
 
     if (UNLIKELY(ret < 0) || UNLIKELY(sb.st_size == 0)) {
+	(void)close(fd);
+	if (fallback)
+	    (void)read_in(rw, woff, wlen, whole);
+	return;
+    }
+    filelen = (unsigned long long)sb.st_size;
+
+    /* Work out what we're mapping.  A whole file that doesn't fit in the
+     * address space (32 bit hosts) can only be handled in windows. */
+    if (whole) {
+	woff = 0;
+	if (filelen > (unsigned long long)(size_t)-1) {
+	    (void)close(fd);
+	    return;
+	}
+	wlen = (size_t)filelen;
+    }
+    if (woff >= filelen || !wlen) {
 	(void)close(fd);
 	return;
     }
+    if (wlen > filelen - woff)
+	wlen = (size_t)(filelen - woff);
+    unsigned long long moff = woff - (woff % MAP_ALIGN);
+    size_t mlen = wlen + (size_t)(woff - moff);
 
-    buflen = sb.st_size;
+    int prot = (rw) ? (PROT_READ | PROT_WRITE) : PROT_READ;
+    int flags = (rw) ? MAP_SHARED : MAP_PRIVATE;
 
     /* Attempt to memory-map the file */
 #if defined(HAVE_SYS_MMAN_H)
-    buf = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-#elif defined(HAVE_WINDOWS_H)
-    /* FIXME: shouldn't need to preserve handle */
-    buf = win_mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0, &(mp->handle));
+    mapbase = mmap(NULL, mlen, prot, flags, fd, (b_off_t)moff);
+#elif defined(_WIN32)
+    mapbase = win_mmap(NULL, mlen, prot, flags, fd, (b_off_t)moff, &handle);
 #endif /* HAVE_SYS_MMAN_H */
 
-    /* If cannot memory-map, read it in manually */
-    if (!buf || buf == MAP_FAILED) {
-    	(void)close(fd);
-	buf = NULL;
-	buflen = 0;
+    /* The mapping (if any) holds its own reference to the file */
+    (void)close(fd);
+
+    /* If cannot memory-map, read it in instead if the caller wants that */
+    if (!mapbase || mapbase == MAP_FAILED) {
+	mapbase = NULL;
+	if (fallback)
+	    (void)read_in(rw, woff, wlen, false);
+	return;
     }
+
+    maplen = mlen;
+    buf = (char *)mapbase + (woff - moff);
+    buflen = wlen;
+    offset = woff;
+    writable = rw;
+    mapped = true;
+    valid = true;
 }
 
-MappedFile::~MappedFile()
+/* Fallback for files that can't be mapped - read the requested range into
+ * memory we own */
+bool
+MappedFile::read_in(bool rw, unsigned long long woff, size_t wlen, bool whole)
+{
+    std::ifstream fs(name, std::ios::binary | std::ios::ate);
+    if (!fs.is_open())
+	return false;
+    filelen = (unsigned long long)fs.tellg();
+    if (whole) {
+	if (filelen > (unsigned long long)(size_t)-1)
+	    return false;
+	woff = 0;
+	wlen = (size_t)filelen;
+    } else if (woff >= filelen) {
+	return false;
+    }
+    if (wlen > filelen - woff)
+	wlen = (size_t)(filelen - woff);
+
+    contents.resize(wlen);
+    fs.seekg((std::streamoff)woff);
+    fs.read(contents.data(), wlen);
+    if ((size_t)fs.gcount() != wlen) {
+	std::vector<char>().swap(contents);
+	return false;
+    }
+
+    buf = contents.data();
+    buflen = wlen;
+    offset = woff;
+    writable = rw;
+    valid = true;
+    return true;
+}
+
+bool
+MappedFile::write_back()
 {
-    if (buf) {
+    if (!valid || !writable)
+	return false;
+    if (mapped || !buflen)
+	return true;
+    std::fstream fs(name, std::ios::binary | std::ios::in | std::ios::out);
+    if (!fs.is_open())
+	return false;
+    fs.seekp((std::streamoff)offset);
+    fs.write(contents.data(), buflen);
+    fs.flush();
+    return !fs.fail();
+}
+
+bool
+MappedFile::sync()
+{
+    if (!valid || !writable)
+	return false;
+#if defined(HAVE_SYS_MMAN_H)
+    if (mapbase && msync(mapbase, maplen, MS_SYNC) < 0)
+	return false;
+#elif defined(_WIN32)
+    if (mapbase && !FlushViewOfFile(mapbase, maplen))
+	return false;
+#endif
+
+    /* The mapping didn't keep the descriptor, so open the file again to
+     * flush it (and its metadata) */
+    int fd = open(name.c_str(), O_RDWR | O_BINARY);
+    if (fd < 0)
+	return false;
+#if defined(_WIN32)
+    int ret = _commit(fd);
+#else
+    int ret = fsync(fd);
+#endif
+    (void)close(fd);
+    return (ret == 0);
+}
+
+void
+MappedFile::advise(access pattern)
+{
+#if defined(HAVE_SYS_MMAN_H) && defined(MADV_SEQUENTIAL)
+    if (!mapbase)
+	return;
+    int advice = MADV_NORMAL;
+    switch (pattern) {
+	case SEQUENTIAL:
+	    advice = MADV_SEQUENTIAL;
+	    break;
+	case RANDOM:
+	    advice = MADV_RANDOM;
+	    break;
+	case WILLNEED:
+	    advice = MADV_WILLNEED;
+	    break;
+	default:
+	    break;
+    }
+    (void)madvise(mapbase, maplen, advice);
+#else
+    (void)pattern;
+#endif
+}
+
+void
+MappedFile::release()
+{
+    if (mapbase) {
 
 	int ret = 0;
 #ifdef HAVE_SYS_MMAN_H
-	ret = munmap(buf, buflen);
+	ret = munmap(mapbase, maplen);
 #elif defined(_WIN32)
-	ret = win_munmap(buf, buflen, handle);
+	ret = win_munmap(mapbase, maplen, handle);
 #endif
+	(void)ret;
     }
+    std::vector<char>().swap(contents);
 
     buf = NULL;		/* sanity */
     buflen = 0;		/* sanity */
+    mapbase = NULL;
+    maplen = 0;
+    handle = NULL;
+    mapped = false;
+    valid = false;
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept
+    : buf(NULL), buflen(0), handle(NULL), mapbase(NULL), maplen(0)
+{
+    *this = std::move(other);
+}
+
+MappedFile &
+MappedFile::operator=(MappedFile &&other) noexcept
+{
+    if (this == &other)
+	return *this;
+    release();
+
+    name = std::move(other.name);
+    contents = std::move(other.contents);
+    buf = (other.mapped) ? other.buf : (void *)contents.data();
+    buflen = other.buflen;
+    writable = other.writable;
+    mapped = other.mapped;
+    valid = other.valid;
+    offset = other.offset;
+    filelen = other.filelen;
+    handle = other.handle;
+    mapbase = other.mapbase;
+    maplen = other.maplen;
+
+    other.buf = NULL;
+    other.buflen = 0;
+    other.handle = NULL;
+    other.mapbase = NULL;
+    other.maplen = 0;
+    other.mapped = false;
+    other.valid = false;
+    return *this;
+}
+
+MappedFile::~MappedFile()
+{
+    release();
 }
 
 
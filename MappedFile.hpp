@@ -37,21 +37,77 @@
  * Class for managing a memory mapped file
  */
 
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
 #include <cstddef>
 #include <string>
+#include <vector>
 
+/* Owns a mapping of a file (or a window of one).  Move-only - the mapping is
+ * released when the owning object goes away. */
 class MappedFile {
     public:
-	MappedFile(const char *fname);
+	/* If writable is set the file is mapped shared and read-write, so
+	 * changes made through buf go straight back to the file (only the
+	 * touched pages are written).  The length can't change.
+	 *
+	 * If the file can't be mapped (some network and FUSE filesystems, or
+	 * a read-only file asked for writable) buf is left NULL, unless
+	 * fallback is set - then the contents are read into memory owned by
+	 * this object instead and mapped is false.  Changes to a read in
+	 * buffer only reach the file through write_back(). */
+	MappedFile(const char *fname = NULL, bool writable = false, bool fallback = false);
+
+	/* Map just the window [offset, offset + length) of the file (clipped
+	 * to the file size), for files too large to map in one piece.  No
+	 * alignment is required of offset - buf points at the requested
+	 * byte. */
+	MappedFile(const char *fname, bool writable, unsigned long long offset, size_t length, bool fallback = false);
 	~MappedFile();
 
+	MappedFile(MappedFile &&other) noexcept;
+	MappedFile &operator=(MappedFile &&other) noexcept;
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	/* Access pattern hints for the kernel's read-ahead.  No-ops where
+	 * madvise isn't available, or for read in buffers. */
+	enum access { NORMAL, SEQUENTIAL, RANDOM, WILLNEED };
+	void advise(access pattern);
+
+	/* Write a read in buffer back to the file in place, for callers that
+	 * changed it.  Does nothing (successfully) for mappings, whose
+	 * changes are already in the file.  Returns false on error. */
+	bool write_back();
+
+	/* Flush changes made to the file through this object out to the
+	 * disk: msync a mapping (MS_SYNC), then fsync the file.  A read in
+	 * buffer's changes must be written back first.  Returns false on
+	 * error. */
+	bool sync();
+
 	std::string name;   /**< copy of file name */
-	void *buf;          /**< mmapped file contents */
+	void *buf;          /**< mmapped (or read in) file contents */
 	size_t buflen;      /**< # bytes in 'buf'  */
+	bool writable;      /**< changes to buf are meant for the file */
+	bool mapped;        /**< buf is a real mapping, rather than read in */
+	bool valid;         /**< the file was mapped or read in (it may be empty, with buf NULL) */
+	unsigned long long offset;  /**< file offset of buf[0] */
+	unsigned long long filelen; /**< size of the whole file */
     private:
+	void map(const char *fname, bool writable, unsigned long long offset, size_t length, bool whole, bool fallback);
+	bool read_in(bool writable, unsigned long long offset, size_t length, bool whole);
+	void release();
+
 	void *handle;       /**< for internal file-specific implementation data */
+	void *mapbase;      /**< start of the (aligned) mapping */
+	size_t maplen;      /**< # bytes mapped at mapbase */
+	std::vector<char> contents; /**< fallback copy of the file contents */
 };
 
+#endif /* MAPPEDFILE_HPP */
+
 // Local Variables:
 // tab-width: 8
 // mode: C++
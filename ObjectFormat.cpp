@@ -0,0 +1,382 @@
+/*                  O B J E C T F O R M A T . C P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file ObjectFormat.cpp
+ *
+ * Section table parsing for ELF, Mach-O and PE files.  Every offset read
+ * from the file is bounds checked - a malformed table just means the
+ * caller falls back to searching the whole file.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "ObjectFormat.hpp"
+
+// Bounds checked reads in either byte order
+struct reader {
+    const unsigned char *buf;
+    size_t len;
+    bool big;   /**< big endian */
+    bool ok;    /**< no read has run off the end */
+
+    uint64_t rd(size_t off, size_t n) {
+	if (off > len || n > len - off) {
+	    ok = false;
+	    return 0;
+	}
+	uint64_t v = 0;
+	for (size_t i = 0; i < n; i++)
+	    v |= (uint64_t)buf[off + ((big) ? n - 1 - i : i)] << (8 * i);
+	return v;
+    }
+    uint16_t u16(size_t off) { return (uint16_t)rd(off, 2); }
+    uint32_t u32(size_t off) { return (uint32_t)rd(off, 4); }
+    uint64_t u64(size_t off) { return rd(off, 8); }
+
+    // NUL terminated (or max long) string at off
+    std::string str(size_t off, size_t max) {
+	if (off >= len)
+	    return std::string();
+	size_t n = 0;
+	while (n < max && off + n < len && buf[off + n])
+	    n++;
+	return std::string((const char *)buf + off, n);
+    }
+};
+
+static void
+add_section(std::vector<obj_section> &sections, const std::string &name, uint64_t off, uint64_t size, size_t buflen)
+{
+    if (off >= buflen || !size)
+	return;
+    if (size > buflen - off)
+	size = buflen - off;
+    sections.push_back({name, (size_t)off, (size_t)size});
+}
+
+static bool
+has_prefix(const std::string &str, const char *prefix)
+{
+    return !str.compare(0, strlen(prefix), prefix);
+}
+
+/* ELF */
+
+#define SHT_STRTAB 3
+#define SHT_NOBITS 8
+#define SHF_STRINGS 0x20
+#define SHF_COMPRESSED 0x800
+#define SHN_XINDEX 0xffff
+
+static bool
+elf_string_section(const std::string &name, uint32_t type, uint64_t flags)
+{
+    if (type == SHT_NOBITS || (flags & SHF_COMPRESSED))
+	return false;
+    if (type == SHT_STRTAB || (flags & SHF_STRINGS))
+	return true;
+    static const char *names[] = {
+	".comment", ".interp", ".gnu_debuglink", ".data", ".debug_line",
+	".debug_str", ".debug_line_str", NULL
+    };
+    for (int i = 0; names[i]; i++) {
+	if (name == names[i])
+	    return true;
+    }
+    return has_prefix(name, ".rodata");
+}
+
+static bool
+elf_sections(const char *buf, size_t buflen, std::vector<obj_section> &sections)
+{
+    reader r = {(const unsigned char *)buf, buflen, (buflen > 5 && buf[5] == 2), true};
+    bool is64 = (buflen > 4 && buf[4] == 2);
+
+    uint64_t shoff = (is64) ? r.u64(0x28) : r.u32(0x20);
+    size_t shentsize = r.u16((is64) ? 0x3a : 0x2e);
+    uint64_t shnum = r.u16((is64) ? 0x3c : 0x30);
+    uint32_t shstrndx = r.u16((is64) ? 0x3e : 0x32);
+    if (!r.ok || !shoff || shentsize < ((is64) ? 64U : 40U) || shoff >= buflen)
+	return false;
+
+    // Section 0 holds the real counts when they don't fit the header
+    if (!shnum)
+	shnum = (is64) ? r.u64(shoff + 32) : r.u32(shoff + 20);
+    if (shstrndx == SHN_XINDEX)
+	shstrndx = r.u32(shoff + ((is64) ? 40 : 24));
+    if (!r.ok || !shnum || shnum > (buflen - shoff) / shentsize || shstrndx >= shnum)
+	return false;
+
+    size_t strsec = shoff + shstrndx * shentsize;
+    uint64_t names_off = (is64) ? r.u64(strsec + 24) : r.u32(strsec + 16);
+    uint64_t names_size = (is64) ? r.u64(strsec + 32) : r.u32(strsec + 20);
+    if (!r.ok || names_off >= buflen)
+	return false;
+    names_size = std::min(names_size, (uint64_t)(buflen - names_off));
+
+    for (uint64_t i = 1; i < shnum; i++) {
+	size_t sh = shoff + i * shentsize;
+	uint32_t name = r.u32(sh);
+	uint32_t type = r.u32(sh + 4);
+	uint64_t flags = (is64) ? r.u64(sh + 8) : r.u32(sh + 8);
+	uint64_t off = (is64) ? r.u64(sh + 24) : r.u32(sh + 16);
+	uint64_t size = (is64) ? r.u64(sh + 32) : r.u32(sh + 20);
+	if (!r.ok)
+	    return false;
+	std::string sname = (name < names_size) ? r.str(names_off + name, names_size - name) : std::string();
+	if (elf_string_section(sname, type, flags))
+	    add_section(sections, sname, off, size, buflen);
+    }
+    return true;
+}
+
+/* Mach-O */
+
+#define LC_SEGMENT 0x1
+#define LC_SYMTAB 0x2
+#define LC_SEGMENT_64 0x19
+#define S_CSTRING_LITERALS 0x2
+
+static bool
+macho_string_section(const std::string &sect, uint32_t flags)
+{
+    uint32_t type = flags & 0xff;
+    // Zero fill sections have no file contents
+    if (type == 0x1 || type == 0xc || type == 0x12)
+	return false;
+    if (type == S_CSTRING_LITERALS)
+	return true;
+    static const char *names[] = {
+	"__cstring", "__const", "__data", "__oslogstring", "__ustring",
+	"__debug_str", "__debug_line", "__debug_line_str", NULL
+    };
+    for (int i = 0; names[i]; i++) {
+	if (sect == names[i])
+	    return true;
+    }
+    return false;
+}
+
+// One thin image, starting at base
+static bool
+macho_sections(const char *buf, size_t buflen, size_t base, std::vector<obj_section> &sections)
+{
+    if (base >= buflen || buflen - base < 28)
+	return false;
+    const unsigned char *m = (const unsigned char *)buf + base;
+    uint32_t magic = (uint32_t)m[0] << 24 | m[1] << 16 | m[2] << 8 | m[3];
+    bool big = (magic == 0xfeedface || magic == 0xfeedfacf);
+    bool is64 = (magic == 0xfeedfacf || magic == 0xcffaedfe);
+    if (!big && magic != 0xcefaedfe && magic != 0xcffaedfe)
+	return false;
+
+    reader r = {(const unsigned char *)buf + base, buflen - base, big, true};
+    uint32_t ncmds = r.u32(16);
+    uint32_t sizeofcmds = r.u32(20);
+    size_t hdrsize = (is64) ? 32 : 28;
+    if (!r.ok || sizeofcmds > r.len - hdrsize)
+	return false;
+
+    // The load commands themselves carry paths - LC_RPATH, LC_LOAD_DYLIB,
+    // LC_ID_DYLIB and the like
+    add_section(sections, "load commands", base, hdrsize + sizeofcmds, buflen);
+
+    size_t lc = hdrsize;
+    for (uint32_t i = 0; i < ncmds; i++) {
+	uint32_t cmd = r.u32(lc);
+	uint32_t cmdsize = r.u32(lc + 4);
+	if (!r.ok || cmdsize < 8 || cmdsize > hdrsize + sizeofcmds - lc)
+	    return false;
+	if (cmd == LC_SEGMENT || cmd == LC_SEGMENT_64) {
+	    bool seg64 = (cmd == LC_SEGMENT_64);
+	    uint32_t nsects = r.u32(lc + ((seg64) ? 64 : 48));
+	    size_t sect = lc + ((seg64) ? 72 : 56);
+	    size_t sectsize = (seg64) ? 80 : 68;
+	    if (!r.ok || nsects > (cmdsize - (sect - lc)) / sectsize)
+		return false;
+	    for (uint32_t j = 0; j < nsects; j++, sect += sectsize) {
+		std::string sectname = r.str(sect, 16);
+		std::string segname = r.str(sect + 16, 16);
+		uint64_t size = (seg64) ? r.u64(sect + 40) : r.u32(sect + 36);
+		uint32_t offset = r.u32(sect + ((seg64) ? 48 : 40));
+		uint32_t flags = r.u32(sect + ((seg64) ? 64 : 56));
+		if (!r.ok)
+		    return false;
+		if (macho_string_section(sectname, flags))
+		    add_section(sections, segname + "," + sectname, base + (uint64_t)offset, size, buflen);
+	    }
+	} else if (cmd == LC_SYMTAB) {
+	    uint32_t stroff = r.u32(lc + 16);
+	    uint32_t strsize = r.u32(lc + 20);
+	    if (!r.ok)
+		return false;
+	    add_section(sections, "string table", base + (uint64_t)stroff, strsize, buflen);
+	}
+	lc += cmdsize;
+    }
+    return true;
+}
+
+// Universal binaries hold several thin images
+static bool
+macho_fat_sections(const char *buf, size_t buflen, std::vector<obj_section> &sections)
+{
+    reader r = {(const unsigned char *)buf, buflen, true, true};
+    bool fat64 = (r.u32(0) == 0xcafebabf);
+    uint32_t nfat = r.u32(4);
+    // Java class files share the 0xcafebabe magic - they'd have a version
+    // number far larger than any plausible architecture count here
+    if (!r.ok || !nfat || nfat > 32)
+	return false;
+    size_t entsize = (fat64) ? 32 : 20;
+    for (uint32_t i = 0; i < nfat; i++) {
+	size_t ent = 8 + i * entsize;
+	uint64_t offset = (fat64) ? r.u64(ent + 8) : r.u32(ent + 8);
+	if (!r.ok || offset >= buflen)
+	    return false;
+	if (!macho_sections(buf, buflen, (size_t)offset, sections))
+	    return false;
+    }
+    return true;
+}
+
+/* PE */
+
+#define IMAGE_SCN_CNT_UNINITIALIZED_DATA 0x80
+
+static bool
+pe_string_section(const std::string &name, uint32_t characteristics)
+{
+    if (characteristics & IMAGE_SCN_CNT_UNINITIALIZED_DATA)
+	return false;
+    static const char *names[] = {
+	".rdata", ".data", ".rodata", ".debug_str", ".debug_line",
+	".debug_line_str", NULL
+    };
+    for (int i = 0; names[i]; i++) {
+	if (name == names[i])
+	    return true;
+    }
+    return false;
+}
+
+static bool
+pe_sections(const char *buf, size_t buflen, std::vector<obj_section> &sections)
+{
+    reader r = {(const unsigned char *)buf, buflen, false, true};
+    uint32_t pe = r.u32(0x3c);
+    if (!r.ok || r.u32(pe) != 0x00004550)
+	return false;
+    size_t coff = pe + 4;
+    uint16_t nsections = r.u16(coff + 2);
+    uint32_t symtab = r.u32(coff + 8);
+    uint32_t nsyms = r.u32(coff + 12);
+    uint16_t optsize = r.u16(coff + 16);
+    if (!r.ok)
+	return false;
+
+    // Long section names (MinGW's debug sections) are "/n", an offset into
+    // the COFF string table following the symbol table
+    uint64_t strtab = (uint64_t)symtab + (uint64_t)nsyms * 18;
+
+    size_t sh = coff + 20 + optsize;
+    for (uint16_t i = 0; i < nsections; i++, sh += 40) {
+	std::string name = r.str(sh, 8);
+	uint32_t rawsize = r.u32(sh + 16);
+	uint32_t rawptr = r.u32(sh + 20);
+	uint32_t characteristics = r.u32(sh + 36);
+	if (!r.ok)
+	    return false;
+	if (name.length() > 1 && name[0] == '/' && symtab) {
+	    uint64_t soff = strtab + strtoul(name.c_str() + 1, NULL, 10);
+	    if (soff < buflen)
+		name = r.str((size_t)soff, 256);
+	}
+	if (pe_string_section(name, characteristics))
+	    add_section(sections, name, rawptr, rawsize, buflen);
+    }
+    return true;
+}
+
+bool
+string_sections(const char *buf, size_t buflen, std::vector<obj_section> &sections)
+{
+    std::vector<obj_section> found;
+    bool ok = false;
+    if (buflen < 4)
+	return false;
+    const unsigned char *m = (const unsigned char *)buf;
+    uint32_t magic = (uint32_t)m[0] << 24 | m[1] << 16 | m[2] << 8 | m[3];
+    if (!memcmp(buf, "\x7f" "ELF", 4))
+	ok = elf_sections(buf, buflen, found);
+    else if (magic == 0xfeedface || magic == 0xfeedfacf || magic == 0xcefaedfe || magic == 0xcffaedfe)
+	ok = macho_sections(buf, buflen, 0, found);
+    else if (magic == 0xcafebabe || magic == 0xcafebabf)
+	ok = macho_fat_sections(buf, buflen, found);
+    else if (buf[0] == 'M' && buf[1] == 'Z')
+	ok = pe_sections(buf, buflen, found);
+    if (!ok)
+	return false;
+
+    // File order, with any overlap (sections sharing bytes) trimmed off so
+    // nothing is searched twice
+    std::sort(found.begin(), found.end(), [](const obj_section &s1, const obj_section &s2) {
+	return (s1.offset != s2.offset) ? s1.offset < s2.offset : s1.size > s2.size;
+    });
+    sections.clear();
+    size_t end = 0;
+    for (size_t i = 0; i < found.size(); i++) {
+	obj_section s = found[i];
+	if (s.offset + s.size <= end)
+	    continue;
+	if (s.offset < end) {
+	    s.size -= end - s.offset;
+	    s.offset = end;
+	}
+	end = s.offset + s.size;
+	sections.push_back(s);
+    }
+    return true;
+}
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
@@ -0,0 +1,77 @@
+/*                  O B J E C T F O R M A T . H P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file ObjectFormat.hpp
+ *
+ * Just enough ELF, Mach-O and PE parsing to find the parts of a binary
+ * that hold strings.
+ *
+ * Build paths end up in string tables and read-only data (.dynstr and
+ * RPATH/RUNPATH, .rodata, .comment, .debug_str and friends, Mach-O
+ * __cstring sections and load commands, PE .rdata), never in code or
+ * most of the debug information, so searching only those parts of a
+ * large library skips the bulk of its bytes.
+ */
+
+#ifndef OBJECTFORMAT_HPP
+#define OBJECTFORMAT_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/* A byte range of a file, with the name of the section it holds */
+struct obj_section {
+    std::string name;
+    size_t offset;
+    size_t size;
+};
+
+/* If buf holds an ELF, Mach-O (thin or fat) or PE image with a usable
+ * section table, replace sections with its string bearing sections - in
+ * file order, clipped to the buffer and not overlapping - and return true.
+ * Anything else (including a truncated or malformed table) returns false,
+ * and the caller should search the whole file. */
+bool string_sections(const char *buf, size_t buflen, std::vector<obj_section> &sections);
+
+#endif /* OBJECTFORMAT_HPP */
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
@@ -0,0 +1,81 @@
+/*                  P A T T E R N S E T . C P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file PatternSet.cpp
+ *
+ * Compiled target string set
+ */
+
+#include "PatternSet.hpp"
+
+PatternSet::PatternSet(const std::vector<std::string> &t, char cchar)
+{
+    targets = t;
+    clear_char = cchar;
+    tcnt = 0;
+    tind = 0;
+    max_len = 0;
+    multi = true;
+    for (size_t i = 0; i < targets.size(); i++) {
+	if (targets[i].find(clear_char) != std::string::npos)
+	    multi = false;
+	if (!targets[i].length())
+	    continue;
+	tcnt++;
+	tind = i;
+	if (targets[i].length() > max_len)
+	    max_len = targets[i].length();
+    }
+    // With a single target the vectorized memsearch beats the automaton
+    if (tcnt < 2)
+	multi = false;
+
+    // The kernel is fixed for the run (memsearch_select() happens before
+    // anything is compiled), so resolve it once rather than per call
+    search = memsearch_kernel(memsearch_selected());
+    for (size_t i = 0; i < targets.size(); i++)
+	tsearch.push_back(memsearch_kernel_for(memsearch_selected(), targets[i].length()));
+
+    if (tcnt > 1)
+	ac.reset(new AhoCorasick(targets));
+}
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
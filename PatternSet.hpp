@@ -0,0 +1,98 @@
+/*                  P A T T E R N S E T . H P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file PatternSet.hpp
+ *
+ * The target (and replacement) strings for a run, compiled once.
+ *
+ * Everything derived from the strings alone - the Aho-Corasick automaton,
+ * the search kernel, which clearing strategy is safe - is worked out when
+ * the set is built in main() and then shared read-only by every file and
+ * every worker thread, so batch runs over many small files don't pay the
+ * setup cost per file.
+ */
+
+#ifndef PATTERNSET_HPP
+#define PATTERNSET_HPP
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "AhoCorasick.hpp"
+#include "memsearch.hpp"
+
+class PatternSet {
+    public:
+	/* Compile the targets.  clear_char is the byte cleared matches are
+	 * overwritten with, which decides whether the automaton can be
+	 * used to clear (see multi). */
+	PatternSet(const std::vector<std::string> &targets, char clear_char = '\0');
+
+	std::vector<std::string> targets;      /**< target strings, in priority order */
+	std::vector<std::string> replacements; /**< replacement for each target (replace mode only) */
+	char clear_char;                       /**< byte cleared matches are overwritten with */
+
+	size_t tcnt;          /**< number of non-empty targets */
+	size_t tind;          /**< index of the last non-empty target */
+	size_t max_len;       /**< length of the longest target */
+
+	/* Set if clearing can find every target with one automaton pass and
+	 * resolve the matches afterwards: at least two targets, and none of
+	 * them containing clear_char (clearing could then create new
+	 * matches, which only a target-at-a-time search reproduces). */
+	bool multi;
+
+	/* Find the first instance of target t in h */
+	const char *find(size_t t, const char *h, size_t hlen) const
+	{
+	    return tsearch[t](h, hlen, targets[t].data(), targets[t].length());
+	}
+
+	memsearch_func search;               /**< single target search kernel */
+	std::vector<memsearch_func> tsearch; /**< search kernel specialized for each target's length */
+	std::unique_ptr<AhoCorasick> ac;     /**< automaton over all targets (if tcnt > 1) */
+};
+
+#endif /* PATTERNSET_HPP */
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
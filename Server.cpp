@@ -0,0 +1,466 @@
+/*                  S E R V E R . C P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file Server.cpp
+ *
+ * Unix domain socket server and client for the --serve mode
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include "Server.hpp"
+
+#ifdef HAVE_SYS_UN_H
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Frame channels
+#define SERVE_OUT '1'
+#define SERVE_ERR '2'
+#define SERVE_EXIT 'x'
+
+// Bounds on a request, so a confused client can't make the server
+// allocate without limit
+#define SERVE_MAX_ARGS (1024 * 1024)
+#define SERVE_MAX_REQUEST (256 * 1024 * 1024)
+
+// How long the server waits on a client that has stopped sending
+#define SERVE_READ_TIMEOUT 30
+
+static volatile sig_atomic_t serve_stop = 0;
+
+static void
+serve_signal(int)
+{
+    serve_stop = 1;
+}
+
+static bool
+read_full(int fd, void *data, size_t len)
+{
+    char *p = (char *)data;
+    while (len) {
+	ssize_t n = read(fd, p, len);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    return false;
+	p += n;
+	len -= (size_t)n;
+    }
+    return true;
+}
+
+static bool
+write_full(int fd, const void *data, size_t len)
+{
+    const char *p = (const char *)data;
+    while (len) {
+	ssize_t n = write(fd, p, len);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    return false;
+	p += n;
+	len -= (size_t)n;
+    }
+    return true;
+}
+
+// Requests can carry thousands of strings, so they are built up and sent
+// in one piece, and read back through a buffer
+static void
+append_str(std::string &req, const std::string &str)
+{
+    uint32_t len = (uint32_t)str.length();
+    req.append((const char *)&len, sizeof(len));
+    req.append(str);
+}
+
+struct request_reader {
+    int fd;
+    char buf[64 * 1024];
+    size_t pos = 0;
+    size_t len = 0;
+
+    bool read(void *data, size_t dlen)
+    {
+	char *p = (char *)data;
+	while (dlen) {
+	    if (pos == len) {
+		ssize_t n = ::read(fd, buf, sizeof(buf));
+		if (n < 0 && errno == EINTR)
+		    continue;
+		if (n <= 0)
+		    return false;
+		pos = 0;
+		len = (size_t)n;
+	    }
+	    size_t cnt = std::min(dlen, len - pos);
+	    memcpy(p, buf + pos, cnt);
+	    pos += cnt;
+	    p += cnt;
+	    dlen -= cnt;
+	}
+	return true;
+    }
+};
+
+static bool
+socket_addr(const std::string &path, struct sockaddr_un &addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.length() >= sizeof(addr.sun_path))
+	return false;
+    memcpy(addr.sun_path, path.c_str(), path.length() + 1);
+    return true;
+}
+
+// The client connection's frames.  A request's out and err are written
+// from whichever thread holds the report lock, so the two streams each
+// have a frame_buf but share one sink.
+struct frame_sink {
+    int fd;
+    std::mutex lock;
+    bool broken = false;  /**< client has gone - output is dropped */
+
+    void send(char channel, const char *data, size_t len)
+    {
+	std::lock_guard<std::mutex> guard(lock);
+	if (broken)
+	    return;
+	uint32_t flen = (uint32_t)len;
+	if (!write_full(fd, &channel, 1) || !write_full(fd, &flen, sizeof(flen)) || !write_full(fd, data, len))
+	    broken = true;
+    }
+};
+
+// Output buffered into frames, sent when the buffer fills or the stream
+// is flushed
+class frame_buf : public std::streambuf {
+    public:
+	frame_buf(frame_sink &s, char chan) : sink(s), channel(chan)
+	{
+	    setp(buf, buf + sizeof(buf));
+	}
+	~frame_buf()
+	{
+	    sync();
+	}
+    protected:
+	int overflow(int c) override
+	{
+	    sync();
+	    if (c != traits_type::eof()) {
+		*pptr() = (char)c;
+		pbump(1);
+	    }
+	    return traits_type::not_eof(c);
+	}
+	int sync() override
+	{
+	    size_t len = pptr() - pbase();
+	    if (len)
+		sink.send(channel, pbase(), len);
+	    setp(buf, buf + sizeof(buf));
+	    return 0;
+	}
+    private:
+	frame_sink &sink;
+	char channel;
+	char buf[64 * 1024];
+};
+
+// Read a request - working directory, then the arguments
+static bool
+read_request(int fd, std::string &cwd, std::vector<std::string> &args)
+{
+    std::unique_ptr<request_reader> rd(new request_reader);
+    rd->fd = fd;
+    uint32_t cnt;
+    if (!rd->read(&cnt, sizeof(cnt)) || !cnt || cnt > SERVE_MAX_ARGS)
+	return false;
+    size_t total = 0;
+    for (uint32_t i = 0; i < cnt; i++) {
+	uint32_t len;
+	if (!rd->read(&len, sizeof(len)))
+	    return false;
+	total += len;
+	if (total > SERVE_MAX_REQUEST)
+	    return false;
+	std::string str(len, '\0');
+	if (len && !rd->read(&str[0], len))
+	    return false;
+	if (!i)
+	    cwd = str;
+	else
+	    args.push_back(str);
+    }
+    return true;
+}
+
+// Whether the process at the other end of fd belongs to the server's user.
+// Without a way to ask (SO_PEERCRED or getpeereid), the owner-only socket
+// is all that keeps other users out.
+static bool
+peer_allowed(int fd)
+{
+#if defined(SO_PEERCRED)
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+	return false;
+    return cred.uid == geteuid();
+#elif defined(HAVE_GETPEEREID)
+    uid_t uid;
+    gid_t gid;
+    if (getpeereid(fd, &uid, &gid) < 0)
+	return false;
+    return uid == geteuid();
+#else
+    (void)fd;
+    return true;
+#endif
+}
+
+static void
+serve_client(int fd, const serve_handler &handler, std::ostream &serr)
+{
+    struct timeval tv = {SERVE_READ_TIMEOUT, 0};
+    (void)setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    // The request is read even if it's going to be refused, so the client
+    // gets to hear why rather than finding the connection closed
+    std::string cwd;
+    std::vector<std::string> args;
+    if (!read_request(fd, cwd, args))
+	return;
+    bool allowed = peer_allowed(fd);
+
+    frame_sink sink;
+    sink.fd = fd;
+    int32_t status = -1;
+    {
+	frame_buf obuf(sink, SERVE_OUT);
+	frame_buf ebuf(sink, SERVE_ERR);
+	std::ostream out(&obuf);
+	std::ostream err(&ebuf);
+	if (!allowed) {
+	    err << "Error:  the server only runs requests from its own user\n";
+	    serr << "Refused a request from another user\n";
+	} else if (chdir(cwd.c_str()) < 0) {
+	    err << "Error:  server unable to change to directory " << cwd << ": " << strerror(errno) << "\n";
+	} else {
+	    try {
+		status = handler(args, out, err);
+	    } catch (const std::exception &e) {
+		err << "Error:  " << e.what() << "\n";
+	    }
+	}
+	out.flush();
+	err.flush();
+    }
+    sink.send(SERVE_EXIT, (const char *)&status, sizeof(status));
+}
+
+int
+serve(const std::string &path, const serve_handler &handler, std::ostream &err)
+{
+    // Requests change directory, so hold on to where the socket really is
+    std::error_code ec;
+    std::string apath = std::filesystem::absolute(path, ec).string();
+    if (ec)
+	apath = path;
+    struct sockaddr_un addr;
+    if (!socket_addr(apath, addr)) {
+	err << "Error:  socket path " << apath << " is too long\n";
+	return -1;
+    }
+
+    int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (lfd < 0) {
+	err << "Error:  unable to create socket: " << strerror(errno) << "\n";
+	return -1;
+    }
+    if (connect(lfd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+	err << "Error:  a server is already listening on " << apath << "\n";
+	close(lfd);
+	return -1;
+    }
+    close(lfd);
+
+    // A directory that isn't there yet is made owner-only
+    std::filesystem::path dir = std::filesystem::path(apath).parent_path();
+    if (!dir.empty() && !std::filesystem::exists(dir, ec)) {
+	if (!std::filesystem::create_directories(dir, ec) || chmod(dir.c_str(), 0700) < 0) {
+	    err << "Error:  unable to create socket directory " << dir.string() << "\n";
+	    return -1;
+	}
+    }
+
+    // Anything left is a stale socket from a server that didn't get to
+    // clean up after itself.  The new one is owner-only from the moment it
+    // exists (the umask covers the gap before the chmod).
+    (void)unlink(apath.c_str());
+    lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    mode_t omask = umask(0077);
+    bool bound = (lfd >= 0 && bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    umask(omask);
+    if (!bound || chmod(apath.c_str(), 0600) < 0 || listen(lfd, 64) < 0) {
+	err << "Error:  unable to listen on " << apath << ": " << strerror(errno) << "\n";
+	if (lfd >= 0)
+	    close(lfd);
+	if (bound)
+	    (void)unlink(apath.c_str());
+	return -1;
+    }
+
+    // Stop between requests on SIGINT or SIGTERM (no SA_RESTART, so a
+    // pending accept returns), and don't die writing to a client that has
+    // gone away
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = serve_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int ret = 0;
+    while (!serve_stop) {
+	int cfd = accept(lfd, NULL, NULL);
+	if (cfd < 0) {
+	    if (errno == EINTR || errno == ECONNABORTED)
+		continue;
+	    err << "Error:  unable to accept connection on " << apath << ": " << strerror(errno) << "\n";
+	    ret = -1;
+	    break;
+	}
+	serve_client(cfd, handler, err);
+	close(cfd);
+    }
+
+    close(lfd);
+    (void)unlink(apath.c_str());
+    return ret;
+}
+
+int
+serve_request(const std::string &path, const std::vector<std::string> &args, std::ostream &out, std::ostream &err, bool &connected)
+{
+    connected = false;
+    struct sockaddr_un addr;
+    if (!socket_addr(path, addr))
+	return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+	return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+	close(fd);
+	return -1;
+    }
+    connected = true;
+    signal(SIGPIPE, SIG_IGN);
+
+    std::error_code ec;
+    std::string cwd = std::filesystem::current_path(ec).string();
+    uint32_t cnt = (uint32_t)args.size() + 1;
+    std::string req((const char *)&cnt, sizeof(cnt));
+    append_str(req, cwd);
+    for (size_t i = 0; i < args.size(); i++)
+	append_str(req, args[i]);
+    bool ok = write_full(fd, req.data(), req.length());
+
+    // Copy the output across until the exit status arrives
+    std::vector<char> data;
+    while (ok) {
+	char channel;
+	uint32_t len;
+	if (!read_full(fd, &channel, 1) || !read_full(fd, &len, sizeof(len)))
+	    break;
+	data.resize(len);
+	if (len && !read_full(fd, data.data(), len))
+	    break;
+	if (channel == SERVE_EXIT && len == sizeof(int32_t)) {
+	    int32_t status;
+	    memcpy(&status, data.data(), sizeof(status));
+	    close(fd);
+	    return status;
+	}
+	std::ostream &dest = (channel == SERVE_ERR) ? err : out;
+	dest.write(data.data(), len);
+	dest.flush();
+    }
+    close(fd);
+    err << "Error:  lost connection to the server at " << path << "\n";
+    return -1;
+}
+
+#else /* HAVE_SYS_UN_H */
+
+int
+serve(const std::string &, const serve_handler &, std::ostream &err)
+{
+    err << "Error:  --serve needs Unix domain sockets, which aren't available on this platform\n";
+    return -1;
+}
+
+int
+serve_request(const std::string &, const std::vector<std::string> &, std::ostream &, std::ostream &, bool &connected)
+{
+    connected = false;
+    return -1;
+}
+
+#endif /* HAVE_SYS_UN_H */
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
@@ -0,0 +1,96 @@
+/*                  S E R V E R . H P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file Server.hpp
+ *
+ * The --serve daemon, and the --client side of it.
+ *
+ * Build systems tend to run strclear from many separate steps, each paying
+ * for process start up, option parsing and compiling the strings before
+ * any file is looked at.  A server listens on a Unix domain socket and
+ * runs the strclear command lines clients send it itself, so whatever it
+ * keeps between requests (compiled pattern sets, clean caches) is already
+ * warm.  A request's output is streamed back to the client as it is
+ * written, followed by its exit status.
+ *
+ * Requests are run one at a time, in the client's working directory, each
+ * spreading its files over its own worker pool as a direct run would.
+ *
+ * A request rewrites files as the server's user, so only that user may
+ * make one: the socket is created owner-only (in an owner-only directory,
+ * if the server has to create the directory), and connections from
+ * processes of any other user are refused.
+ *
+ * The protocol is private to one strclear build talking to itself on one
+ * host: the client sends a count and then length prefixed strings (its
+ * working directory, then the arguments), and the server answers with
+ * framed output - a channel byte (output, errors or the exit status),
+ * a length, and the data.
+ */
+
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/* Runs a request - the arguments of a strclear command line, without the
+ * program name - writing its output to out and err, and returns its exit
+ * status */
+typedef std::function<int(const std::vector<std::string> &args, std::ostream &out, std::ostream &err)> serve_handler;
+
+/* Serve requests on the socket at path until interrupted (SIGINT or
+ * SIGTERM), then remove the socket.  A socket file no server is listening
+ * on is replaced; a live one isn't.  Returns -1 (after reporting to err)
+ * if the socket can't be set up, else 0. */
+int serve(const std::string &path, const serve_handler &handler, std::ostream &err);
+
+/* Send a request to the server at path and copy its output to out and err
+ * as it arrives.  Returns the request's exit status.  If no server
+ * answers, connected is left false (and nothing reported) so the caller
+ * can run the request itself. */
+int serve_request(const std::string &path, const std::vector<std::string> &args, std::ostream &out, std::ostream &err, bool &connected);
+
+#endif /* SERVER_HPP */
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
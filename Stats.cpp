@@ -0,0 +1,192 @@
+/*                  S T A T S . C P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file Stats.cpp
+ *
+ * Processing statistics for --stats
+ */
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE 1 /* RUSAGE_THREAD */
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include "Stats.hpp"
+
+#ifdef HAVE_SYS_RESOURCE_H
+#  include <sys/resource.h>
+#endif
+
+void
+file_stats::add(const file_stats &o)
+{
+    elapsed += o.elapsed;
+    classify_time += o.classify_time;
+    read_time += o.read_time;
+    search_time += o.search_time;
+    write_time += o.write_time;
+    bytes_read += o.bytes_read;
+    bytes_written += o.bytes_written;
+    bytes_patched += o.bytes_patched;
+    matches += o.matches;
+    mapped += o.mapped;
+    unchecked += o.unchecked;
+    peak_buffer = std::max(peak_buffer, o.peak_buffer);
+    minor_faults += o.minor_faults;
+    major_faults += o.major_faults;
+    vol_switches += o.vol_switches;
+    invol_switches += o.invol_switches;
+}
+
+#if defined(HAVE_SYS_RESOURCE_H) && defined(RUSAGE_THREAD)
+#  define HAVE_THREAD_RUSAGE 1
+#endif
+
+rusage_delta::rusage_delta(file_stats &s) : st(s)
+{
+    minflt = majflt = nvcsw = nivcsw = 0;
+#ifdef HAVE_THREAD_RUSAGE
+    struct rusage ru;
+    if (!getrusage(RUSAGE_THREAD, &ru)) {
+	minflt = ru.ru_minflt;
+	majflt = ru.ru_majflt;
+	nvcsw = ru.ru_nvcsw;
+	nivcsw = ru.ru_nivcsw;
+    }
+#endif
+}
+
+rusage_delta::~rusage_delta()
+{
+#ifdef HAVE_THREAD_RUSAGE
+    struct rusage ru;
+    if (!getrusage(RUSAGE_THREAD, &ru)) {
+	st.minor_faults += ru.ru_minflt - minflt;
+	st.major_faults += ru.ru_majflt - majflt;
+	st.vol_switches += ru.ru_nvcsw - nvcsw;
+	st.invol_switches += ru.ru_nivcsw - nivcsw;
+    }
+#endif
+}
+
+void
+process_rusage(file_stats &st)
+{
+#ifdef HAVE_SYS_RESOURCE_H
+    struct rusage ru;
+    if (!getrusage(RUSAGE_SELF, &ru)) {
+	st.minor_faults = ru.ru_minflt;
+	st.major_faults = ru.ru_majflt;
+	st.vol_switches = ru.ru_nvcsw;
+	st.invol_switches = ru.ru_nivcsw;
+    }
+#else
+    (void)st;
+#endif
+}
+
+std::string
+json_str(const std::string &str)
+{
+    std::string ret;
+    json_append(ret, str);
+    return ret;
+}
+
+void
+json_append(std::string &ret, const std::string &str)
+{
+    ret.push_back('"');
+    for (size_t i = 0; i < str.length(); i++) {
+	unsigned char c = (unsigned char)str[i];
+	if (c == '"' || c == '\\') {
+	    ret.push_back('\\');
+	    ret.push_back(c);
+	} else if (c < 0x20) {
+	    char esc[8];
+	    snprintf(esc, sizeof(esc), "\\u%04x", c);
+	    ret.append(esc);
+	} else {
+	    ret.push_back(c);
+	}
+    }
+    ret.push_back('"');
+}
+
+void
+print_stats(std::ostream &out, const std::string &fname, const file_stats &st, bool json)
+{
+    bool total = fname.empty();
+    char times[256];
+    if (json) {
+	snprintf(times, sizeof(times), "\"elapsed_s\":%.6f,\"classify_s\":%.6f,\"read_s\":%.6f,\"search_s\":%.6f,\"write_s\":%.6f",
+		st.elapsed, st.classify_time, st.read_time, st.search_time, st.write_time);
+	out << "{" << ((total) ? std::string("\"total\":true") : "\"file\":" + json_str(fname)) << "," << times;
+	out << ",\"bytes_read\":" << st.bytes_read << ",\"bytes_written\":" << st.bytes_written;
+	out << ",\"bytes_patched\":" << st.bytes_patched;
+	out << ",\"matches\":" << st.matches;
+	if (total)
+	    out << ",\"mapped_files\":" << st.mapped;
+	else
+	    out << ",\"mapped\":" << ((st.mapped) ? "true" : "false");
+	out << ",\"peak_buffer\":" << st.peak_buffer;
+	out << ",\"minor_faults\":" << st.minor_faults << ",\"major_faults\":" << st.major_faults;
+	out << ",\"voluntary_switches\":" << st.vol_switches << ",\"involuntary_switches\":" << st.invol_switches;
+	out << "}\n";
+	return;
+    }
+
+    snprintf(times, sizeof(times), "%.6fs (classify %.6fs, read %.6fs, search %.6fs, write %.6fs)",
+	    st.elapsed, st.classify_time, st.read_time, st.search_time, st.write_time);
+    out << "stats: " << ((total) ? std::string("total") : fname) << ": " << times;
+    out << "; read " << st.bytes_read << " bytes, wrote " << st.bytes_written << " bytes, patched " << st.bytes_patched << " bytes";
+    out << ", " << st.matches << " matches";
+    if (total)
+	out << ", " << st.mapped << " mapped";
+    else
+	out << ((st.mapped) ? ", mapped" : ", read in");
+    out << ", peak buffer " << st.peak_buffer << " bytes";
+    out << "; faults " << st.minor_faults << " minor/" << st.major_faults << " major";
+    out << ", context switches " << st.vol_switches << " voluntary/" << st.invol_switches << " involuntary\n";
+}
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
@@ -0,0 +1,131 @@
+/*                  S T A T S . H P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file Stats.hpp
+ *
+ * Per-file instrumentation for --stats: time spent in each processing
+ * phase, I/O volumes, and (where getrusage supports it) page faults and
+ * context switches.
+ *
+ * Collection is cheap - a couple of clock reads per phase - so the
+ * processing code always fills in a file_stats and main decides whether
+ * to report it.
+ */
+
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+struct file_stats {
+    double elapsed = 0.0;        /**< seconds from start to finish (for the total, the whole run) */
+    double classify_time = 0.0;  /**< seconds spent deciding if the file is binary */
+    double read_time = 0.0;      /**< seconds spent mapping or reading the contents */
+    double search_time = 0.0;    /**< seconds spent finding (and patching in place) matches */
+    double write_time = 0.0;     /**< seconds spent writing rewritten contents out */
+
+    unsigned long long bytes_read = 0;     /**< bytes read into buffers (mapped bytes aren't counted) */
+    unsigned long long bytes_written = 0;  /**< bytes written out with write() (mapped changes aren't counted) */
+    unsigned long long bytes_patched = 0;  /**< bytes of matched strings overwritten */
+    unsigned long long matches = 0;        /**< instances found (and cleared or replaced) */
+    size_t mapped = 0;                     /**< files accessed through a mapping */
+    size_t unchecked = 0;                  /**< files not fully checked (compressed data without zlib) */
+    size_t peak_buffer = 0;                /**< largest buffer allocated for file contents */
+
+    long minor_faults = 0;       /**< page faults serviced without I/O */
+    long major_faults = 0;       /**< page faults that needed I/O */
+    long vol_switches = 0;       /**< voluntary context switches (mostly waiting on I/O) */
+    long invol_switches = 0;     /**< involuntary context switches (preemption) */
+
+    /* Accumulate another file's stats into this one (times, counts and
+     * volumes add up, peak_buffer is the maximum) */
+    void add(const file_stats &o);
+};
+
+/* Adds the time between construction and destruction (or stop(), if
+ * that comes first) to *acc */
+class phase_timer {
+    public:
+	phase_timer(double *acc) : acc(acc), start(std::chrono::steady_clock::now()) {}
+	~phase_timer() {
+	    stop();
+	}
+	void stop() {
+	    if (acc)
+		*acc += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	    acc = NULL;
+	}
+    private:
+	double *acc;
+	std::chrono::steady_clock::time_point start;
+};
+
+/* Adds the calling thread's page faults and context switches between
+ * construction and destruction to st.  If per-thread usage isn't available
+ * the counts stay zero - main() reports process-wide totals separately. */
+class rusage_delta {
+    public:
+	rusage_delta(file_stats &st);
+	~rusage_delta();
+    private:
+	file_stats &st;
+	long minflt, majflt, nvcsw, nivcsw;
+};
+
+/* Get the process-wide usage counts (zero if unavailable) */
+void process_rusage(file_stats &st);
+
+/* Quote a string for JSON output */
+std::string json_str(const std::string &str);
+
+/* Append str, quoted for JSON output, to out */
+void json_append(std::string &out, const std::string &str);
+
+/* Print stats as one line of text or a JSON object.  A file name labels
+ * per-file stats, an empty one marks the aggregate ("total") line. */
+void print_stats(std::ostream &out, const std::string &fname, const file_stats &st, bool json);
+
+#endif /* STATS_HPP */
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
@@ -0,0 +1,615 @@
+/*                  U R I N G I O . C P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file UringIO.cpp
+ *
+ * io_uring file loader, driving the ring through the raw system calls so
+ * no liburing is needed.  Each file is a chain of requests (open, statx,
+ * read until done, close) with at most one in flight per file at a time;
+ * the I/O thread keeps depth chains going and wakes on completions or on
+ * an eventfd the workers write to when they want something.
+ */
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include "UringIO.hpp"
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// What a request in flight is doing
+enum uring_stage {
+    STAGE_OPEN,
+    STAGE_STATX,
+    STAGE_READ,
+    STAGE_WRITE,
+    STAGE_FSYNC,
+    STAGE_CLOSE,
+    STAGE_WAKE
+};
+
+// Every request's user_data points at one of these (or something that
+// starts with one)
+struct uring_pending {
+    bool is_write;
+    uring_stage stage;
+};
+
+struct UringIO::load {
+    uring_pending p = {false, STAGE_OPEN};
+    int fd = -1;
+    size_t done = 0;
+    struct statx stx;
+    file f;
+};
+
+struct UringIO::write_req {
+    uring_pending p = {true, STAGE_OPEN};
+    const char *name = NULL;
+    const char *buf = NULL;
+    size_t len = 0;
+    bool sync = false;
+    int fd = -1;
+    size_t done = 0;
+    int err = 0;
+    bool finished = false;
+};
+
+struct uring_ring {
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes = NULL;
+    struct io_uring_cqe *cqes = NULL;
+    void *sq_ptr = MAP_FAILED;
+    size_t sq_len = 0;
+    void *cq_ptr = MAP_FAILED;
+    size_t cq_len = 0;
+    size_t sqes_len = 0;
+    unsigned entries = 0;
+    unsigned tail = 0;          /**< local submission tail, published on enter */
+    unsigned to_submit = 0;
+    unsigned inflight = 0;      /**< requests submitted but not yet completed */
+    std::condition_variable write_cv;
+    uint64_t wake_buf = 0;
+    uring_pending wake_p = {false, STAGE_WAKE};
+};
+
+static int
+uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+// The next free submission entry, cleared, or NULL if the ring is full
+// (which the I/O thread's accounting should make impossible)
+static struct io_uring_sqe *
+get_sqe(int fd, uring_ring *r, uring_pending *p)
+{
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->tail - head >= r->entries) {
+	__atomic_store_n(r->sq_tail, r->tail, __ATOMIC_RELEASE);
+	int ret = uring_enter(fd, r->to_submit, 0, 0);
+	if (ret < 0)
+	    return NULL;
+	r->to_submit -= ret;
+	head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+	if (r->tail - head >= r->entries)
+	    return NULL;
+    }
+    unsigned ind = r->tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[ind];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = (uint64_t)(uintptr_t)p;
+    r->sq_array[ind] = ind;
+    r->tail++;
+    r->to_submit++;
+    r->inflight++;
+    return sqe;
+}
+
+static bool
+prep_open(int fd, uring_ring *r, uring_pending *p, const char *path, int flags)
+{
+    struct io_uring_sqe *sqe = get_sqe(fd, r, p);
+    if (!sqe)
+	return false;
+    p->stage = STAGE_OPEN;
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)path;
+    sqe->open_flags = flags | O_CLOEXEC;
+    return true;
+}
+
+static bool
+prep_rw(int fd, uring_ring *r, uring_pending *p, uring_stage stage, int file_fd, const char *buf, size_t len, size_t off)
+{
+    struct io_uring_sqe *sqe = get_sqe(fd, r, p);
+    if (!sqe)
+	return false;
+    p->stage = stage;
+    sqe->opcode = (stage == STAGE_READ) ? IORING_OP_READ : IORING_OP_WRITE;
+    sqe->fd = file_fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    // A single request moves at most 2GB
+    sqe->len = (unsigned)((len > 0x40000000) ? 0x40000000 : len);
+    sqe->off = off;
+    return true;
+}
+
+static bool
+prep_fd_op(int fd, uring_ring *r, uring_pending *p, uring_stage stage, int file_fd)
+{
+    struct io_uring_sqe *sqe = get_sqe(fd, r, p);
+    if (!sqe)
+	return false;
+    p->stage = stage;
+    sqe->opcode = (stage == STAGE_FSYNC) ? IORING_OP_FSYNC : IORING_OP_CLOSE;
+    sqe->fd = file_fd;
+    return true;
+}
+
+static bool
+prep_statx(int fd, uring_ring *r, uring_pending *p, int file_fd, struct statx *stx)
+{
+    static const char empty_path[] = "";
+    struct io_uring_sqe *sqe = get_sqe(fd, r, p);
+    if (!sqe)
+	return false;
+    p->stage = STAGE_STATX;
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = file_fd;
+    sqe->addr = (uint64_t)(uintptr_t)empty_path;
+    sqe->len = STATX_TYPE | STATX_SIZE;
+    sqe->off = (uint64_t)(uintptr_t)stx;
+    sqe->statx_flags = AT_EMPTY_PATH;
+    return true;
+}
+
+// Whether the kernel supports every request we use
+static bool
+uring_probe(int fd)
+{
+    const unsigned nops = 256;
+    std::vector<char> pbuf(sizeof(struct io_uring_probe) + nops * sizeof(struct io_uring_probe_op), 0);
+    struct io_uring_probe *probe = (struct io_uring_probe *)pbuf.data();
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, nops) < 0)
+	return false;
+    const int needed[] = {IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_FSYNC, IORING_OP_CLOSE};
+    for (size_t i = 0; i < sizeof(needed) / sizeof(needed[0]); i++) {
+	if (needed[i] > probe->last_op || !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED))
+	    return false;
+    }
+    return true;
+}
+
+UringIO::UringIO(const std::vector<std::string> &files, const std::vector<size_t> &file_order, size_t max, size_t d)
+    : names(files), order(file_order), max_size(max), depth((d) ? d : 1)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring_fd = (int)syscall(__NR_io_uring_setup, (unsigned)(2 * depth + 8), &params);
+    if (ring_fd < 0)
+	return;
+    if (!uring_probe(ring_fd))
+	return;
+
+    r = new uring_ring;
+    r->entries = params.sq_entries;
+    r->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    r->cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    void *sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (r->sq_ptr == MAP_FAILED || r->cq_ptr == MAP_FAILED || sqes == MAP_FAILED) {
+	if (sqes != MAP_FAILED)
+	    munmap(sqes, r->sqes_len);
+	return;
+    }
+    char *sq = (char *)r->sq_ptr;
+    r->sq_head = (unsigned *)(sq + params.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + params.sq_off.array);
+    char *cq = (char *)r->cq_ptr;
+    r->cq_head = (unsigned *)(cq + params.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    r->sqes = (struct io_uring_sqe *)sqes;
+    r->tail = *r->sq_tail;
+
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (wake_fd < 0)
+	return;
+
+    valid = true;
+    io_thread = std::thread(&UringIO::run, this);
+}
+
+UringIO::~UringIO()
+{
+    if (io_thread.joinable()) {
+	{
+	    std::lock_guard<std::mutex> guard(lock);
+	    stop = true;
+	}
+	wake();
+	io_thread.join();
+    }
+    if (r) {
+	// Anything still in flight here means the ring broke - the kernel
+	// may still own those buffers until the ring is closed
+	if (ring_fd >= 0)
+	    close(ring_fd);
+	ring_fd = -1;
+	for (size_t i = 0; i < loads.size(); i++)
+	    delete loads[i];
+	if (r->sq_ptr != MAP_FAILED)
+	    munmap(r->sq_ptr, r->sq_len);
+	if (r->cq_ptr != MAP_FAILED)
+	    munmap(r->cq_ptr, r->cq_len);
+	if (r->sqes)
+	    munmap(r->sqes, r->sqes_len);
+	delete r;
+    }
+    if (ring_fd >= 0)
+	close(ring_fd);
+    if (wake_fd >= 0)
+	close(wake_fd);
+}
+
+void
+UringIO::wake()
+{
+    uint64_t one = 1;
+    while (write(wake_fd, &one, sizeof(one)) < 0 && errno == EINTR)
+	;
+}
+
+bool
+UringIO::next(file &f)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    ready_cv.wait(guard, [this]() { return !ready.empty() || handed_out == order.size(); });
+    if (ready.empty())
+	return false;
+    f = std::move(ready.front());
+    ready.pop_front();
+    handed_out++;
+    return true;
+}
+
+void
+UringIO::release(file &f)
+{
+    f.data = std::vector<char>();
+    {
+	std::lock_guard<std::mutex> guard(lock);
+	released++;
+    }
+    wake();
+}
+
+int
+UringIO::write_back(const file &f, bool sync)
+{
+    write_req w;
+    w.name = names[f.index].c_str();
+    w.buf = f.data.data();
+    w.len = f.data.size();
+    w.sync = sync;
+    std::unique_lock<std::mutex> guard(lock);
+    if (failed)
+	return EIO;
+    writes.push_back(&w);
+    guard.unlock();
+    wake();
+    guard.lock();
+    r->write_cv.wait(guard, [&w]() { return w.finished; });
+    return w.err;
+}
+
+void
+UringIO::run()
+{
+    size_t next_file = 0;
+    size_t outstanding = 0;     // loads started and not yet released
+    std::deque<write_req *> pending_writes;
+    std::vector<write_req *> active_writes;
+    bool broken = false;
+
+    auto finish_write = [&](write_req *w) {
+	for (size_t i = 0; i < active_writes.size(); i++) {
+	    if (active_writes[i] == w) {
+		active_writes.erase(active_writes.begin() + i);
+		break;
+	    }
+	}
+	std::lock_guard<std::mutex> guard(lock);
+	w->finished = true;
+	r->write_cv.notify_all();
+    };
+    auto finish_load = [&](load *l) {
+	for (size_t i = 0; i < loads.size(); i++) {
+	    if (loads[i] == l) {
+		loads.erase(loads.begin() + i);
+		break;
+	    }
+	}
+	{
+	    std::lock_guard<std::mutex> guard(lock);
+	    ready.push_back(std::move(l->f));
+	}
+	ready_cv.notify_one();
+	delete l;
+    };
+
+    // Keep a read of the eventfd in flight, so worker requests wake us
+    if (!prep_rw(ring_fd, r, &r->wake_p, STAGE_READ, wake_fd, (const char *)&r->wake_buf, sizeof(r->wake_buf), 0))
+	broken = true;
+    r->wake_p.stage = STAGE_WAKE;
+
+    while (!broken) {
+	bool stopping;
+	{
+	    std::lock_guard<std::mutex> guard(lock);
+	    pending_writes.insert(pending_writes.end(), writes.begin(), writes.end());
+	    writes.clear();
+	    outstanding -= released;
+	    released = 0;
+	    stopping = stop;
+	}
+
+	// Each file has at most one request in flight, so keeping no more
+	// files going than there are ring entries means it can't fill up
+	while (!broken && pending_writes.size() && r->inflight < r->entries) {
+	    write_req *w = pending_writes.front();
+	    pending_writes.pop_front();
+	    active_writes.push_back(w);
+	    broken = !prep_open(ring_fd, r, &w->p, w->name, O_WRONLY);
+	}
+	while (!broken && !stopping && next_file < order.size() && outstanding < depth && r->inflight < r->entries) {
+	    load *l = new load;
+	    l->f.index = order[next_file++];
+	    loads.push_back(l);
+	    outstanding++;
+	    broken = !prep_open(ring_fd, r, &l->p, names[l->f.index].c_str(), O_RDONLY);
+	}
+	if (broken)
+	    break;
+
+	// Only the wake read left means we're done
+	if (stopping && r->inflight == 1)
+	    break;
+
+	__atomic_store_n(r->sq_tail, r->tail, __ATOMIC_RELEASE);
+	int ret = uring_enter(ring_fd, r->to_submit, 1, IORING_ENTER_GETEVENTS);
+	if (ret < 0) {
+	    if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+		continue;
+	    broken = true;
+	    break;
+	}
+	r->to_submit -= (unsigned)ret;
+
+	unsigned head = *r->cq_head;
+	while (!broken && head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+	    struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+	    uring_pending *p = (uring_pending *)(uintptr_t)cqe->user_data;
+	    int res = cqe->res;
+	    head++;
+	    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+	    r->inflight--;
+
+	    if (p->stage == STAGE_WAKE) {
+		broken = !prep_rw(ring_fd, r, p, STAGE_READ, wake_fd, (const char *)&r->wake_buf, sizeof(r->wake_buf), 0);
+		p->stage = STAGE_WAKE;
+		continue;
+	    }
+
+	    // A request interrupted before it did anything is just retried
+	    bool retry = (res == -EINTR || res == -EAGAIN);
+
+	    if (p->is_write) {
+		write_req *w = (write_req *)p;
+		switch (p->stage) {
+		    case STAGE_OPEN:
+			if (res < 0) {
+			    w->err = -res;
+			    finish_write(w);
+			    break;
+			}
+			w->fd = res;
+			broken = !prep_rw(ring_fd, r, p, STAGE_WRITE, w->fd, w->buf, w->len, 0);
+			break;
+		    case STAGE_WRITE:
+			if (res > 0 || retry) {
+			    w->done += (res > 0) ? (size_t)res : 0;
+			    if (w->done < w->len) {
+				broken = !prep_rw(ring_fd, r, p, STAGE_WRITE, w->fd, w->buf + w->done, w->len - w->done, w->done);
+				break;
+			    }
+			} else {
+			    w->err = (res < 0) ? -res : EIO;
+			}
+			broken = !prep_fd_op(ring_fd, r, p, (!w->err && w->sync) ? STAGE_FSYNC : STAGE_CLOSE, w->fd);
+			break;
+		    case STAGE_FSYNC:
+			if (res < 0)
+			    w->err = -res;
+			broken = !prep_fd_op(ring_fd, r, p, STAGE_CLOSE, w->fd);
+			break;
+		    default:
+			if (res < 0 && !w->err)
+			    w->err = -res;
+			finish_write(w);
+			break;
+		}
+		continue;
+	    }
+
+	    // Anything that goes wrong loading a file just leaves it to be
+	    // processed the usual way
+	    load *l = (load *)p;
+	    bool done = false;
+	    switch (p->stage) {
+		case STAGE_OPEN:
+		    if (res < 0) {
+			finish_load(l);
+			break;
+		    }
+		    l->fd = res;
+		    broken = !prep_statx(ring_fd, r, p, l->fd, &l->stx);
+		    break;
+		case STAGE_STATX:
+		    if (res < 0 || !S_ISREG(l->stx.stx_mode) || l->stx.stx_size > max_size) {
+			done = true;
+			break;
+		    }
+		    l->f.data.resize((size_t)l->stx.stx_size);
+		    if (!l->f.data.size()) {
+			l->f.loaded = true;
+			done = true;
+			break;
+		    }
+		    broken = !prep_rw(ring_fd, r, p, STAGE_READ, l->fd, l->f.data.data(), l->f.data.size(), 0);
+		    break;
+		case STAGE_READ:
+		    // The file shrinking under us (a zero length read) counts
+		    // as a failure, as does any error
+		    if (res > 0 || retry) {
+			l->done += (res > 0) ? (size_t)res : 0;
+			if (l->done < l->f.data.size()) {
+			    broken = !prep_rw(ring_fd, r, p, STAGE_READ, l->fd, l->f.data.data() + l->done, l->f.data.size() - l->done, l->done);
+			    break;
+			}
+			l->f.loaded = true;
+		    } else {
+			l->f.data = std::vector<char>();
+		    }
+		    done = true;
+		    break;
+		default:
+		    finish_load(l);
+		    break;
+	    }
+	    if (done)
+		broken = !prep_fd_op(ring_fd, r, p, STAGE_CLOSE, l->fd);
+	}
+    }
+
+    if (!broken)
+	return;
+
+    // The ring has failed (which shouldn't happen once it's set up).  Hand
+    // every file not yet handed out to the workers unloaded, and fail the
+    // writes, now and from here on, so the workers fall back to rewriting
+    // the files themselves.  Loads still in flight keep their buffers
+    // until the ring is closed.
+    {
+	std::lock_guard<std::mutex> guard(lock);
+	for (size_t i = 0; i < loads.size(); i++) {
+	    file f;
+	    f.index = loads[i]->f.index;
+	    ready.push_back(std::move(f));
+	}
+	for (; next_file < order.size(); next_file++) {
+	    file f;
+	    f.index = order[next_file];
+	    ready.push_back(std::move(f));
+	}
+    }
+    ready_cv.notify_all();
+    std::lock_guard<std::mutex> guard(lock);
+    failed = true;
+    pending_writes.insert(pending_writes.end(), writes.begin(), writes.end());
+    pending_writes.insert(pending_writes.end(), active_writes.begin(), active_writes.end());
+    writes.clear();
+    for (size_t i = 0; i < pending_writes.size(); i++) {
+	pending_writes[i]->err = EIO;
+	pending_writes[i]->finished = true;
+    }
+    r->write_cv.notify_all();
+}
+
+#else /* HAVE_LINUX_IO_URING_H */
+
+// No io_uring here - valid stays false and the caller uses its worker pool
+
+UringIO::UringIO(const std::vector<std::string> &files, const std::vector<size_t> &file_order, size_t max, size_t d)
+    : names(files), order(file_order), max_size(max), depth(d)
+{
+}
+
+UringIO::~UringIO()
+{
+}
+
+bool
+UringIO::next(file &)
+{
+    return false;
+}
+
+void
+UringIO::release(file &f)
+{
+    f.data = std::vector<char>();
+}
+
+int
+UringIO::write_back(const file &, bool)
+{
+    return ENOSYS;
+}
+
+#endif /* HAVE_LINUX_IO_URING_H */
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
@@ -0,0 +1,135 @@
+/*                  U R I N G I O . H P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file UringIO.hpp
+ *
+ * Batched file I/O through io_uring, for large batches of small files.
+ *
+ * With tens of thousands of small files the time goes on the open, stat,
+ * read and write system calls rather than on searching.  A UringIO runs
+ * one I/O thread that keeps many files' opens and reads in flight at once
+ * through a single io_uring, handing each file's contents to the workers
+ * as they complete, and batches the write backs the workers request the
+ * same way.
+ *
+ * Only regular files no larger than max_size are read in - anything else
+ * (or any file the ring couldn't open or read) is handed out unloaded, to
+ * be processed the usual way.  Where io_uring isn't available (other
+ * platforms, older kernels, or sandboxes that block it) valid is false and
+ * the caller should stick to the worker pool alone.
+ */
+
+#ifndef URINGIO_HPP
+#define URINGIO_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct uring_ring;
+
+class UringIO {
+    public:
+	struct file {
+	    size_t index = 0;       /**< index of the file in the list */
+	    bool loaded = false;    /**< data holds the file's contents */
+	    std::vector<char> data;
+	};
+
+	/* Read the files listed in order (indices into files, which must
+	 * outlive the UringIO), keeping up to depth of them in memory at a
+	 * time. */
+	UringIO(const std::vector<std::string> &files, const std::vector<size_t> &order, size_t max_size, size_t depth = 64);
+	~UringIO();
+
+	UringIO(const UringIO &) = delete;
+	UringIO &operator=(const UringIO &) = delete;
+
+	/* Wait for the next file, in completion order.  Returns false once
+	 * every file has been handed out. */
+	bool next(file &f);
+
+	/* Write f.data back over the file (which must still be the same
+	 * length), waiting for the write to complete.  Returns 0 or an errno
+	 * value. */
+	int write_back(const file &f, bool sync);
+
+	/* Done with f - frees its slot for another file to be read */
+	void release(file &f);
+
+	bool valid = false;         /**< the ring is up and running */
+
+    private:
+	struct load;
+	struct write_req;
+
+	void run();
+	void wake();
+
+	const std::vector<std::string> &names;
+	std::vector<size_t> order;
+	size_t max_size;
+	size_t depth;
+	size_t handed_out = 0;
+
+	// Shared with the workers, under lock
+	std::mutex lock;
+	std::condition_variable ready_cv;
+	std::deque<file> ready;
+	std::deque<write_req *> writes;
+	size_t released = 0;
+	bool stop = false;
+	bool failed = false;        /**< the ring broke - no more writes */
+
+	int ring_fd = -1;
+	int wake_fd = -1;
+	uring_ring *r = NULL;
+	std::vector<load *> loads;  /**< loads started and not yet handed out */
+	std::thread io_thread;
+};
+
+#endif /* URINGIO_HPP */
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
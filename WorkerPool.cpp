@@ -0,0 +1,171 @@
+/*                  W O R K E R P O O L . C P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file WorkerPool.cpp
+ *
+ * Work stealing thread pool implementation
+ */
+
+#include <condition_variable>
+#include <thread>
+#include "WorkerPool.hpp"
+
+WorkerPool::WorkerPool(size_t n)
+{
+    nthreads = (n) ? n : std::thread::hardware_concurrency();
+    if (!nthreads)
+	nthreads = 1;
+}
+
+bool
+WorkerPool::next_job(size_t worker, size_t *job)
+{
+    // Our own queue first, working from the front
+    {
+	JobQueue &q = queues[worker];
+	std::lock_guard<std::mutex> guard(q.lock);
+	if (!q.jobs.empty()) {
+	    *job = q.jobs.front();
+	    q.jobs.pop_front();
+	    return true;
+	}
+    }
+
+    // Nothing left locally - steal from the back of someone else's queue
+    for (size_t i = 1; i < queues.size(); i++) {
+	JobQueue &q = queues[(worker + i) % queues.size()];
+	std::lock_guard<std::mutex> guard(q.lock);
+	if (!q.jobs.empty()) {
+	    *job = q.jobs.back();
+	    q.jobs.pop_back();
+	    return true;
+	}
+    }
+
+    return false;
+}
+
+void
+WorkerPool::run(size_t njobs, const std::function<void(size_t, size_t)> &job)
+{
+    size_t nworkers = (nthreads < njobs) ? nthreads : njobs;
+
+    // Single worker - no point in spinning up threads
+    if (nworkers < 2) {
+	for (size_t i = 0; i < njobs; i++)
+	    job(i, 0);
+	return;
+    }
+
+    queues = std::vector<JobQueue>(nworkers);
+    for (size_t i = 0; i < njobs; i++)
+	queues[i % nworkers].jobs.push_back(i);
+
+    std::vector<std::thread> workers;
+    for (size_t w = 0; w < nworkers; w++) {
+	workers.push_back(std::thread([this, w, &job]() {
+	    size_t j;
+	    while (next_job(w, &j))
+		job(j, w);
+	}));
+    }
+    for (size_t w = 0; w < workers.size(); w++)
+	workers[w].join();
+
+    queues.clear();
+}
+
+void
+WorkerPool::run_streamed(const std::function<void(const std::function<void(size_t)> &add)> &feed, const std::function<void(size_t, size_t)> &job)
+{
+    // Jobs come in while the pool is running, so there's no telling in
+    // advance how many workers are worth starting - start them all.
+    // Each worker reserves a job from the count of those queued but not
+    // yet taken before popping one, so it always finds one.
+    std::mutex feed_lock;
+    std::condition_variable feed_cv;
+    size_t queued = 0;
+    size_t added = 0;
+    bool fed = false;
+
+    queues = std::vector<JobQueue>(nthreads);
+    auto add = [&](size_t j) {
+	std::lock_guard<std::mutex> guard(feed_lock);
+	{
+	    JobQueue &q = queues[added++ % queues.size()];
+	    std::lock_guard<std::mutex> qguard(q.lock);
+	    q.jobs.push_back(j);
+	}
+	queued++;
+	feed_cv.notify_one();
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t w = 0; w < nthreads; w++) {
+	workers.push_back(std::thread([&, w]() {
+	    for (;;) {
+		{
+		    std::unique_lock<std::mutex> guard(feed_lock);
+		    feed_cv.wait(guard, [&]() { return queued || fed; });
+		    if (!queued)
+			return;
+		    queued--;
+		}
+		size_t j;
+		if (next_job(w, &j))
+		    job(j, w);
+	    }
+	}));
+    }
+
+    feed(add);
+    {
+	std::lock_guard<std::mutex> guard(feed_lock);
+	fed = true;
+    }
+    feed_cv.notify_all();
+    for (size_t w = 0; w < workers.size(); w++)
+	workers[w].join();
+
+    queues.clear();
+}
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
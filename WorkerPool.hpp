@@ -0,0 +1,92 @@
+/*                  W O R K E R P O O L . H P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file WorkerPool.hpp
+ *
+ * Simple work stealing thread pool for processing batches of files.
+ *
+ * Jobs are identified by index and dealt out round-robin to per-worker
+ * queues up front.  Each worker drains its own queue from the front and,
+ * once it runs dry, steals from the back of the other queues, so a single
+ * large file can't hold up the rest of the batch.  A batch whose size
+ * isn't known up front (a directory walk still in progress) can instead
+ * be fed to the workers a job at a time as the jobs turn up.
+ */
+
+#ifndef WORKERPOOL_HPP
+#define WORKERPOOL_HPP
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+class WorkerPool {
+    public:
+	WorkerPool(size_t nthreads);
+
+	/* Run job(i) for each i in [0, njobs), blocking until all jobs have
+	 * completed.  The second job argument is the index of the worker
+	 * running it, for callers holding per-worker state. */
+	void run(size_t njobs, const std::function<void(size_t, size_t)> &job);
+
+	/* As run(), but the jobs are supplied by feed, which is called on
+	 * the calling thread and passes each job's index to add() (safe to
+	 * call from any thread) as it becomes ready.  The workers start on
+	 * jobs as soon as they are added.  Blocks until feed has returned
+	 * and every job added has completed. */
+	void run_streamed(const std::function<void(const std::function<void(size_t)> &add)> &feed, const std::function<void(size_t, size_t)> &job);
+
+	size_t nthreads;    /**< number of worker threads */
+    private:
+	struct JobQueue {
+	    std::mutex lock;
+	    std::deque<size_t> jobs;
+	};
+	bool next_job(size_t worker, size_t *job);
+
+	std::vector<JobQueue> queues;
+};
+
+#endif /* WORKERPOOL_HPP */
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
@@ -0,0 +1,1532 @@
+/*                  L I B S T R C L E A R . C P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file libstrclear.cpp
+ *
+ * The clearing, replacing and scanning engine behind the strclear tool.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "libstrclear.hpp"
+#include "Archive.hpp"
+#include "AtomicFile.hpp"
+#include "MappedFile.hpp"
+#include "ObjectFormat.hpp"
+#include "WorkerPool.hpp"
+#include "memsearch.hpp"
+
+// Per thread scratch space for match lists and report text.  Batch workers
+// keep theirs from file to file, so a run over thousands of files (each
+// with thousands of hits) doesn't go back to the allocator for every
+// file's matches, and reports are formatted into one reused buffer and
+// written out in one go rather than a stream insertion at a time.
+struct match_scratch {
+    std::vector<strclear_match> matches;
+    std::vector<strclear_match> wmatches;
+    std::vector<size_t> secs;   /**< index of each match's section, when scanning by section */
+    std::string report;
+};
+static thread_local match_scratch scratch;
+
+// Borrow the scratch match lists for the length of one file's processing.
+// Whatever a huge file grew them to is given back afterwards, so a worker
+// doesn't sit on it for the rest of the batch.
+class scratch_lease {
+    public:
+	scratch_lease()
+	{
+	    scratch.matches.clear();
+	    scratch.wmatches.clear();
+	    scratch.secs.clear();
+	}
+	~scratch_lease()
+	{
+	    const size_t keep = 64 * 1024;
+	    if (scratch.matches.capacity() > keep)
+		std::vector<strclear_match>().swap(scratch.matches);
+	    if (scratch.wmatches.capacity() > keep)
+		std::vector<strclear_match>().swap(scratch.wmatches);
+	    if (scratch.secs.capacity() > keep)
+		std::vector<size_t>().swap(scratch.secs);
+	    if (scratch.report.capacity() > 16 * keep)
+		std::string().swap(scratch.report);
+	}
+};
+
+// Append the decimal form of val to str
+static void
+append_num(std::string &str, unsigned long long val)
+{
+    char nbuf[24];
+    char *end = std::to_chars(nbuf, nbuf + sizeof(nbuf), val).ptr;
+    str.append(nbuf, end - nbuf);
+}
+
+// Write out and empty the report text
+static void
+flush_report(std::ostream &out, std::string &rep)
+{
+    if (rep.length())
+	out.write(rep.data(), rep.length());
+    rep.clear();
+}
+
+// The threads searching split segments, shared by every search in the
+// process - batch workers each splitting their own large file mustn't
+// each start a pool of their own, or -j N runs N times N threads (and
+// starts and joins them for every target).  A search queues its segments
+// and works through the queue alongside the pool's threads until its own
+// segments are all done, so it never sits idle waiting on other files'.
+class split_pool {
+    public:
+	split_pool(size_t nthreads);
+	~split_pool();
+
+	/* Run job(k) for each k in [0, n), returning once all are done */
+	void run(size_t n, const std::function<void(size_t)> &job);
+    private:
+	struct batch {
+	    const std::function<void(size_t)> *job;
+	    size_t left;        /**< segments not yet finished */
+	};
+	struct task {
+	    batch *b;
+	    size_t k;
+	};
+	void run_one(std::unique_lock<std::mutex> &guard);
+
+	std::mutex lock;
+	std::condition_variable work_cv;    /**< tasks queued, or stopping */
+	std::condition_variable done_cv;    /**< a batch finished */
+	std::deque<task> tasks;
+	std::vector<std::thread> threads;
+	bool stopping;
+};
+
+split_pool::split_pool(size_t nthreads)
+    : stopping(false)
+{
+    for (size_t i = 0; i < nthreads; i++) {
+	threads.push_back(std::thread([this]() {
+	    std::unique_lock<std::mutex> guard(lock);
+	    for (;;) {
+		work_cv.wait(guard, [this]() { return stopping || !tasks.empty(); });
+		if (tasks.empty())
+		    return;
+		run_one(guard);
+	    }
+	}));
+    }
+}
+
+split_pool::~split_pool()
+{
+    {
+	std::lock_guard<std::mutex> guard(lock);
+	stopping = true;
+    }
+    work_cv.notify_all();
+    for (size_t i = 0; i < threads.size(); i++)
+	threads[i].join();
+}
+
+// Take the first queued task and run it - guard is held on entry and exit,
+// but not while the task runs
+void
+split_pool::run_one(std::unique_lock<std::mutex> &guard)
+{
+    task t = tasks.front();
+    tasks.pop_front();
+    guard.unlock();
+    (*t.b->job)(t.k);
+    guard.lock();
+    if (!--t.b->left)
+	done_cv.notify_all();
+}
+
+void
+split_pool::run(size_t n, const std::function<void(size_t)> &job)
+{
+    batch b = {&job, n};
+    std::unique_lock<std::mutex> guard(lock);
+    for (size_t k = 0; k < n; k++)
+	tasks.push_back({&b, k});
+    work_cv.notify_all();
+    while (b.left) {
+	if (!tasks.empty())
+	    run_one(guard);
+	else
+	    done_cv.wait(guard);
+    }
+}
+
+// Buffers of at least split_size bytes are searched as split_threads
+// segments in parallel (see strclear_set_split), the caller searching
+// alongside split_threads - 1 pool threads
+static size_t split_size = 64 * 1024 * 1024;
+static size_t split_threads = 1;
+static std::unique_ptr<split_pool> segment_pool;
+
+void
+strclear_set_split(size_t min_size, size_t threads)
+{
+    split_size = min_size;
+    split_threads = (min_size) ? WorkerPool(threads).nthreads : 1;
+    segment_pool.reset();
+    if (split_threads > 1)
+	segment_pool.reset(new split_pool(split_threads - 1));
+}
+
+
+// Append the verbose report line for clearing an instance to rep
+static void
+report_clear(std::string &rep, const std::string &fname, const std::string &target_str, char clear_char, int rcnt, const std::string &section = std::string())
+{
+    if (rcnt == 1) {
+	rep.append(fname);
+	rep.append(":\n");
+    }
+    rep.append("\tclearing instance #");
+    append_num(rep, rcnt);
+    rep.append(" of ");
+    rep.append(target_str);
+    rep.append(" with the '");
+    if (clear_char == '\0')
+	rep.append("\\0");
+    else
+	rep.push_back(clear_char);
+    rep.append("' char");
+    if (section.length()) {
+	rep.append(" in ");
+	rep.append(section);
+    }
+    rep.push_back('\n');
+}
+
+// Replace mode counterpart of report_clear
+static void
+report_replace(std::string &rep, const std::string &fname, const std::string &target_str, const std::string &replace_str, int rcnt)
+{
+    if (rcnt == 1) {
+	rep.append(fname);
+	rep.append(":\n");
+    }
+    rep.append("\treplacing instance #");
+    append_num(rep, rcnt);
+    rep.append(" of ");
+    rep.append(target_str);
+    rep.append(" with ");
+    rep.append(replace_str);
+    rep.push_back('\n');
+}
+
+// Find every instance (overlapping ones included) of target t in buf, or
+// of every target if t is -1 (which needs the automaton).  Any one
+// target's instances are listed in offset order.
+static void
+find_instances(const char *buf, size_t len, const PatternSet &ps, size_t t, std::vector<AhoCorasick::Match> &found)
+{
+    if (t == (size_t)-1) {
+	ps.ac->find_all(buf, len, found);
+	return;
+    }
+    const char *position = ps.find(t, buf, len);
+    while (position) {
+	found.push_back({(size_t)(position - buf), t});
+	position++;
+	position = ps.find(t, position, buf + len - position);
+    }
+}
+
+// find_instances, searching buffers of split_size or more as one segment
+// per thread.  Each segment is searched with the following max_len - 1
+// bytes of the next one, so instances straddling the seam are found, and
+// keeps only the instances starting within it - the next segment finds
+// the rest - so nothing is reported twice.  The segments' lists are then
+// joined in order, so each target's instances stay in offset order.
+static void
+find_instances_split(const char *buf, size_t len, const PatternSet &ps, size_t t, std::vector<AhoCorasick::Match> &found)
+{
+    found.clear();
+    if (split_threads < 2 || !split_size || len < split_size || !segment_pool) {
+	find_instances(buf, len, ps, t, found);
+	return;
+    }
+    size_t overlap = ((t == (size_t)-1) ? ps.max_len : ps.targets[t].length()) - 1;
+    size_t nseg = split_threads;
+    size_t seglen = (len + nseg - 1) / nseg;
+    std::vector<std::vector<AhoCorasick::Match>> segs(nseg);
+    segment_pool->run(nseg, [&](size_t k) {
+	size_t start = k * seglen;
+	if (start >= len)
+	    return;
+	size_t own = std::min(seglen, len - start);
+	std::vector<AhoCorasick::Match> &seg = segs[k];
+	find_instances(buf + start, std::min(own + overlap, len - start), ps, t, seg);
+	size_t n = 0;
+	for (size_t i = 0; i < seg.size(); i++) {
+	    if (seg[i].pos < own)
+		seg[n++] = {start + seg[i].pos, seg[i].pattern};
+	}
+	seg.resize(n);
+    });
+    size_t total = 0;
+    for (size_t k = 0; k < nseg; k++)
+	total += segs[k].size();
+    found.reserve(total);
+    for (size_t k = 0; k < nseg; k++)
+	found.insert(found.end(), segs[k].begin(), segs[k].end());
+}
+
+// Clear one target's instances in [sbuf, bend) exactly as clear_sequential's
+// search loop would, but finding the candidates up front (in parallel, for
+// a large span).  Clearing an instance only changes its own bytes, so the
+// candidates past it still stand; just the few positions overlapping it
+// need checking again against the cleared bytes.
+static void
+clear_target_split(char *buf, char *sbuf, char *bend, const PatternSet &ps, size_t t, std::vector<strclear_match> &cleared)
+{
+    const std::string &target = ps.targets[t];
+    size_t tlen = target.length();
+    std::vector<AhoCorasick::Match> cand;
+    find_instances_split(sbuf, bend - sbuf, ps, t, cand);
+
+    size_t c = 0;
+    while (c < cand.size()) {
+	char *position = sbuf + cand[c].pos;
+	while (position) {
+	    std::fill(position, position + tlen, ps.clear_char);
+	    cleared.push_back({(size_t)(position - buf), t});
+	    char *next = NULL;
+	    for (char *q = position + 1; q < position + tlen && q + tlen <= bend; q++) {
+		if (!memcmp(q, target.data(), tlen)) {
+		    next = q;
+		    break;
+		}
+	    }
+	    if (!next) {
+		size_t resume = (size_t)(position - sbuf) + tlen;
+		while (c < cand.size() && cand[c].pos < resume)
+		    c++;
+	    }
+	    position = next;
+	}
+    }
+}
+
+// Clear the targets one at a time, each with its own search over the
+// buffer - earlier targets win when they overlap later ones.  Only the
+// spans of buf listed in spans (sorted, disjoint) are searched.  Cleared
+// instances are appended to cleared, a target at a time.
+static void
+clear_sequential(char *buf, const std::vector<obj_section> &spans, const PatternSet &ps, std::vector<strclear_match> &cleared)
+{
+    for (size_t i = 0; i < ps.targets.size(); i++) {
+	if (!ps.targets[i].length())
+	    continue;
+	size_t tlen = ps.targets[i].length();
+
+	// Find instances of target string in binary, and replace any we find
+	for (size_t k = 0; k < spans.size(); k++) {
+	    char *sbuf = buf + spans[k].offset;
+	    char *bend = sbuf + spans[k].size;
+	    if (split_threads > 1 && split_size && spans[k].size >= split_size) {
+		clear_target_split(buf, sbuf, bend, ps, i, cleared);
+		continue;
+	    }
+	    char *position = (char *)ps.find(i, sbuf, spans[k].size);
+	    while (position) {
+		std::fill(position, position + tlen, ps.clear_char);
+		cleared.push_back({(size_t)(position - buf), i});
+		// Resume one byte in - a target made up entirely of the clear
+		// char would otherwise match its own cleared bytes forever.
+		position = (char *)ps.find(i, position + 1, bend - position - 1);
+	    }
+	}
+    }
+}
+
+// One window on a file being processed in chunks (see visit_windows)
+struct file_window {
+    char *buf;                  /**< window contents */
+    unsigned long long offset;  /**< file offset of buf[0] */
+    size_t len;                 /**< bytes in buf */
+    size_t limit;               /**< leading bytes of buf this window is responsible for */
+    bool dirty = false;         /**< set by the visitor if it changed buf */
+    bool stop = false;          /**< set by the visitor to skip the rest of the file */
+};
+typedef std::function<size_t(file_window &w)> window_visitor;
+
+// Visit a file a window at a time, for files too large to handle in one
+// piece.  Each window is the next chunk_size bytes plus up to overlap bytes
+// beyond them, so any match of up to overlap + 1 bytes starting in the
+// chunk lies entirely within the window; the last window is responsible
+// for everything it holds.  visit() returns how many leading bytes of the
+// window it has finished with, and the next window starts there.  If it
+// can't finish anything it returns 0 and gets the same offset again with
+// a window twice the size.  Windows are mapped if possible, otherwise read
+// and, if dirty, written back in place - and with sync set, flushed to disk
+// before the next one.  Time spent in visit() counts as searching.
+static int
+visit_windows(std::ostream &err, const std::string &fname, bool writable, bool sync, size_t chunk_size, size_t overlap, const window_visitor &visit, file_stats &fst)
+{
+    std::error_code ec;
+    unsigned long long flen = std::filesystem::file_size(fname, ec);
+    if (ec) {
+	err << "Unable to open file " << fname << "\n";
+	return -1;
+    }
+    if (!chunk_size || chunk_size > flen)
+	chunk_size = (size_t)flen;
+
+    unsigned long long off = 0;
+    size_t chunk = chunk_size;
+    while (off < flen) {
+	size_t wlen = (chunk > flen - off) ? (size_t)(flen - off) : chunk;
+	wlen = (overlap > flen - off - wlen) ? (size_t)(flen - off) : wlen + overlap;
+	bool last = (off + wlen >= flen);
+
+	file_window w;
+	w.offset = off;
+	w.len = wlen;
+	w.limit = (last) ? wlen : chunk;
+
+	phase_timer rt(&fst.read_time);
+	MappedFile mf(fname.c_str(), writable, off, wlen, true);
+	if (!mf.valid || mf.buflen != wlen) {
+	    err << "Unable to read " << fname << "\n";
+	    return -1;
+	}
+	mf.advise(MappedFile::SEQUENTIAL);
+	w.buf = (char *)mf.buf;
+	if (mf.mapped) {
+	    fst.mapped = 1;
+	} else {
+	    fst.bytes_read += wlen;
+	    fst.peak_buffer = std::max(fst.peak_buffer, wlen);
+	}
+	rt.stop();
+
+	phase_timer vt(&fst.search_time);
+	size_t used = visit(w);
+	vt.stop();
+
+	if (!mf.mapped && w.dirty) {
+	    phase_timer wt(&fst.write_time);
+	    if (!mf.write_back()) {
+		err << "Unable to write updated file contents for " << fname << "\n";
+		return -1;
+	    }
+	    fst.bytes_written += wlen;
+	}
+	if (sync && w.dirty) {
+	    phase_timer wt(&fst.write_time);
+	    if (!mf.sync()) {
+		err << "Unable to flush updated file contents for " << fname << ": " << strerror(errno) << "\n";
+		return -1;
+	    }
+	}
+	if (last || w.stop)
+	    break;
+	if (!used) {
+	    chunk = (chunk > (size_t)-1 / 2) ? (size_t)-1 : chunk * 2;
+	    continue;
+	}
+	off += used;
+	chunk = chunk_size;
+    }
+
+    return 0;
+}
+
+// Match resolution state for clear_multi, carried from one window to the
+// next when a file is processed in chunks.  Offsets are file offsets.
+struct multi_clear_state {
+    std::vector<unsigned long long> last_end;   /**< per target, end of its last cleared instance */
+    std::vector<std::pair<unsigned long long, unsigned long long>> cleared; /**< sorted, disjoint [start, end) ranges cleared so far */
+    std::vector<int> rcnt;                      /**< per target, instances cleared */
+};
+
+// Resolve the matches in hits (per target, sorted, as file offsets) that
+// start before cut, clearing the accepted ones in buf (which holds the file
+// from offset base).  This is exactly what clear_sequential would do:
+// targets are applied in order, each taking its leftmost non-overlapping
+// instances that don't touch bytes already cleared for an earlier target.
+static void
+resolve_multi(char *buf, unsigned long long base, const std::vector<std::vector<unsigned long long>> &hits, unsigned long long cut, multi_clear_state &st, const PatternSet &ps, std::vector<std::vector<size_t>> *starts = NULL)
+{
+    typedef std::pair<unsigned long long, unsigned long long> range;
+    for (size_t i = 0; i < ps.targets.size(); i++) {
+	size_t tlen = ps.targets[i].length();
+	std::vector<range> accepted;
+	for (size_t j = 0; j < hits[i].size() && hits[i][j] < cut; j++) {
+	    unsigned long long start = hits[i][j];
+	    unsigned long long end = start + tlen;
+	    if (start < st.last_end[i])
+		continue;
+	    auto c_it = std::lower_bound(st.cleared.begin(), st.cleared.end(), start,
+		    [](const range &r, unsigned long long v) { return r.second <= v; });
+	    if (c_it != st.cleared.end() && c_it->first < end)
+		continue;
+	    accepted.push_back(std::make_pair(start, end));
+	    std::fill(buf + (start - base), buf + (end - base), ps.clear_char);
+	    st.last_end[i] = end;
+	    st.rcnt[i]++;
+	    if (starts)
+		(*starts)[i].push_back((size_t)start);
+	}
+	if (accepted.size()) {
+	    std::vector<range> merged;
+	    std::merge(st.cleared.begin(), st.cleared.end(), accepted.begin(), accepted.end(), std::back_inserter(merged));
+	    st.cleared.swap(merged);
+	}
+    }
+}
+
+// Find every target with a single Aho-Corasick pass over the buffer, then
+// resolve the matches exactly as clear_sequential would have.  That is only
+// equivalent if no target contains ps.clear_char (clearing can't then create
+// new matches), which the caller checks.  As with clear_sequential only
+// the listed spans of buf are searched - no match can cross from one span
+// into another, so resolving each span separately gives the same result.
+static void
+clear_multi(char *buf, const std::vector<obj_section> &spans, const PatternSet &ps, std::vector<strclear_match> &cleared)
+{
+    multi_clear_state st;
+    st.last_end.assign(ps.targets.size(), 0);
+    st.rcnt.assign(ps.targets.size(), 0);
+
+    std::vector<std::vector<size_t>> starts(ps.targets.size());
+    std::vector<AhoCorasick::Match> matches;
+    for (size_t k = 0; k < spans.size(); k++) {
+	find_instances_split(buf + spans[k].offset, spans[k].size, ps, (size_t)-1, matches);
+	if (!matches.size())
+	    continue;
+	// Matches come back in end offset order, which for any one target
+	// is also start offset order.
+	std::vector<std::vector<unsigned long long>> hits(ps.targets.size());
+	for (size_t i = 0; i < matches.size(); i++)
+	    hits[matches[i].pattern].push_back(spans[k].offset + matches[i].pos);
+	resolve_multi(buf, 0, hits, spans[k].offset + spans[k].size, st, ps, &starts);
+    }
+
+    for (size_t i = 0; i < ps.targets.size(); i++) {
+	for (size_t j = 0; j < starts[i].size(); j++)
+	    cleared.push_back({starts[i][j], i});
+    }
+}
+
+// Clear the spans of buf, whichever way is safe for ps
+static void
+clear_buffer(char *buf, const std::vector<obj_section> &spans, const PatternSet &ps, std::vector<strclear_match> &cleared)
+{
+    if (ps.multi)
+	clear_multi(buf, spans, ps, cleared);
+    else
+	clear_sequential(buf, spans, ps, cleared);
+}
+
+// Report the instances cleared from a buffer (in the order clear_buffer
+// lists them), naming the section each was in if the spans are sections
+static void
+report_cleared(std::ostream &out, const std::string &fname, const std::vector<strclear_match> &cleared, const std::vector<obj_section> &spans, const PatternSet &ps)
+{
+    int rcnt = 0;
+    for (size_t i = 0; i < cleared.size(); i++) {
+	rcnt = (i && cleared[i].pattern == cleared[i - 1].pattern) ? rcnt + 1 : 1;
+	auto s_it = std::upper_bound(spans.begin(), spans.end(), cleared[i].pos, [](size_t pos, const obj_section &sec) {
+	    return pos < sec.offset;
+	});
+	const std::string &section = (s_it != spans.begin()) ? (s_it - 1)->name : spans[0].name;
+	report_clear(scratch.report, fname, ps.targets[cleared[i].pattern], ps.clear_char, rcnt, section);
+    }
+    flush_report(out, scratch.report);
+}
+
+void
+strclear_report_cleared(std::ostream &out, const std::string &name, const std::vector<strclear_match> &cleared, const PatternSet &ps)
+{
+    report_cleared(out, name, cleared, std::vector<obj_section>(1, {std::string(), 0, 0}), ps);
+}
+
+size_t
+strclear_clear(char *buf, size_t buflen, const PatternSet &ps, std::vector<strclear_match> *cleared)
+{
+    if (!ps.tcnt || !buflen)
+	return 0;
+    std::vector<strclear_match> local;
+    std::vector<strclear_match> &c = (cleared) ? *cleared : local;
+    size_t before = c.size();
+    clear_buffer(buf, std::vector<obj_section>(1, {std::string(), 0, buflen}), ps, c);
+    return c.size() - before;
+}
+
+// Chunked version of clear_multi, for files too large to map at once.
+//
+// Resolution only couples matches that overlap, so the file can be cut
+// anywhere no match spans.  Each window resolves the clusters of mutually
+// overlapping matches that can't be affected by anything past the window,
+// and the next window starts at the first cluster that might be.  (Only a
+// single cluster longer than a whole chunk - a pathological, endlessly
+// self-overlapping run - has to be cut arbitrarily.)
+static int
+clear_multi_chunked(std::ostream &out, std::ostream &err, const std::string &fname, const PatternSet &ps, bool verbose, bool sync, size_t chunk_size, file_stats &fst)
+{
+    const AhoCorasick &ac = *ps.ac;
+    multi_clear_state st;
+    st.last_end.assign(ps.targets.size(), 0);
+    st.rcnt.assign(ps.targets.size(), 0);
+    std::vector<AhoCorasick::Match> matches;
+
+    int ret = visit_windows(err, fname, true, sync, chunk_size, ac.max_len - 1, [&](file_window &w) {
+	// Ranges cleared in earlier windows only matter while they can still
+	// overlap a match in this one
+	while (st.cleared.size() && st.cleared.front().second <= w.offset)
+	    st.cleared.erase(st.cleared.begin());
+
+	find_instances_split(w.buf, w.len, ps, (size_t)-1, matches);
+	if (!matches.size())
+	    return w.limit;
+	std::sort(matches.begin(), matches.end(), [](const AhoCorasick::Match &m1, const AhoCorasick::Match &m2) {
+	    return m1.pos < m2.pos;
+	});
+
+	// Find where to cut: the start of the first cluster of overlapping
+	// matches that reaches past the bytes this window is responsible for.
+	// If that's the very first cluster we need a bigger window.
+	size_t cut = w.limit;
+	if (w.limit < w.len) {
+	    size_t cstart = 0, cend = 0;
+	    for (size_t i = 0; i <= matches.size(); i++) {
+		size_t mstart = (i < matches.size()) ? matches[i].pos : w.len;
+		if (i && mstart < cend) {
+		    cend = std::max(cend, mstart + ps.targets[matches[i].pattern].length());
+		    continue;
+		}
+		// Previous cluster is complete
+		if (i && cend > w.limit) {
+		    cut = cstart;
+		    break;
+		}
+		if (mstart >= w.limit || i == matches.size())
+		    break;
+		cstart = mstart;
+		cend = mstart + ps.targets[matches[i].pattern].length();
+	    }
+	}
+
+	if (!cut)
+	    return cut;
+
+	std::vector<std::vector<unsigned long long>> hits(ps.targets.size());
+	for (size_t i = 0; i < matches.size(); i++)
+	    hits[matches[i].pattern].push_back(w.offset + matches[i].pos);
+	size_t before = st.cleared.size();
+	resolve_multi(w.buf, w.offset, hits, w.offset + cut, st, ps);
+	if (st.cleared.size() != before)
+	    w.dirty = true;
+	return cut;
+    }, fst);
+    if (ret < 0)
+	return -1;
+
+    int grcnt = 0;
+    for (size_t i = 0; i < ps.targets.size(); i++) {
+	for (int j = 1; verbose && j <= st.rcnt[i]; j++)
+	    report_clear(scratch.report, fname, ps.targets[i], ps.clear_char, j);
+	grcnt += st.rcnt[i];
+	fst.bytes_patched += (unsigned long long)st.rcnt[i] * ps.targets[i].length();
+    }
+    flush_report(out, scratch.report);
+    return grcnt;
+}
+
+// Chunked version of clear_sequential
+static int
+clear_sequential_chunked(std::ostream &out, std::ostream &err, const std::string &fname, const PatternSet &ps, bool verbose, bool sync, size_t chunk_size, file_stats &fst)
+{
+    int grcnt = 0;
+    for (size_t i = 0; i < ps.targets.size(); i++) {
+	if (!ps.targets[i].length())
+	    continue;
+	size_t tlen = ps.targets[i].length();
+	int rcnt = 0;
+	int ret = visit_windows(err, fname, true, sync, chunk_size, tlen - 1, [&](file_window &w) {
+	    const char *position = ps.find(i, w.buf, w.len);
+	    while (position && (size_t)(position - w.buf) < w.limit) {
+		std::fill(w.buf + (position - w.buf), w.buf + (position - w.buf) + tlen, ps.clear_char);
+		w.dirty = true;
+		rcnt++;
+		if (verbose)
+		    report_clear(scratch.report, fname, ps.targets[i], ps.clear_char, rcnt);
+		position++;
+		position = ps.find(i, position, w.buf + w.len - position);
+	    }
+	    return w.limit;
+	}, fst);
+	flush_report(out, scratch.report);
+	if (ret < 0)
+	    return -1;
+	grcnt += rcnt;
+	fst.bytes_patched += (unsigned long long)rcnt * tlen;
+    }
+    return grcnt;
+}
+
+// The spans of a file to clear - with sections set and a recognized object
+// format, just its string holding sections, otherwise the whole buffer.
+static std::vector<obj_section>
+clear_spans(const char *buf, size_t buflen, bool sections)
+{
+    std::vector<obj_section> spans;
+    if (!sections || !string_sections(buf, buflen, spans))
+	spans.assign(1, {std::string(), 0, buflen});
+    return spans;
+}
+
+int
+clear_loaded(std::ostream &out, const std::string &fname, char *buf, size_t buflen, const PatternSet &ps, bool verbose, bool sections, file_stats &fst)
+{
+    if (!ps.tcnt)
+	return 0;
+    scratch_lease lease;
+    phase_timer st(&fst.search_time);
+    std::vector<obj_section> spans = clear_spans(buf, buflen, sections);
+    std::vector<strclear_match> &cleared = scratch.matches;
+    clear_buffer(buf, spans, ps, cleared);
+    st.stop();
+    if (verbose)
+	report_cleared(out, fname, cleared, spans, ps);
+    for (size_t i = 0; i < cleared.size(); i++)
+	fst.bytes_patched += ps.targets[cleared[i].pattern].length();
+    return (int)cleared.size();
+}
+
+int
+process_binary(std::ostream &out, std::ostream &err, const std::string &fname, const PatternSet &ps, bool verbose, bool sync, size_t chunk_size, bool sections, file_stats &fst)
+{
+    if (!ps.tcnt)
+	return 0;
+
+    // Files larger than the chunk size are streamed through windows, to
+    // keep memory (and address space) use bounded.
+    if (chunk_size) {
+	std::error_code ec;
+	unsigned long long flen = std::filesystem::file_size(fname, ec);
+	if (!ec && flen > chunk_size) {
+	    if (ps.multi)
+		return clear_multi_chunked(out, err, fname, ps, verbose, sync, chunk_size, fst);
+	    return clear_sequential_chunked(out, err, fname, ps, verbose, sync, chunk_size, fst);
+	}
+    }
+
+    // Clearing never changes the file length, so if we can get a writable
+    // mapping we overwrite the matches in place and only the pages we
+    // actually touched get written back.
+    // No mapping (read-only or unmappable file) means the contents are
+    // read in, and written back out below if we change them.
+    phase_timer rt(&fst.read_time);
+    MappedFile mf(fname.c_str(), true, true);
+    rt.stop();
+    if (!mf.valid) {
+	err << "Unable to open file " << fname << "\n";
+	return -1;
+    }
+    if (mf.mapped) {
+	fst.mapped = 1;
+	mf.advise(MappedFile::SEQUENTIAL);
+    } else {
+	fst.bytes_read += mf.buflen;
+	fst.peak_buffer = mf.buflen;
+    }
+
+    int grcnt = clear_loaded(out, fname, (char *)mf.buf, mf.buflen, ps, verbose, sections, fst);
+    if (!grcnt)
+	return grcnt;
+    if (mf.mapped) {
+	// The changes are already in the file, but maybe not yet on disk
+	if (sync) {
+	    phase_timer wt(&fst.write_time);
+	    if (!mf.sync()) {
+		err << "Unable to flush updated file contents for " << fname << ": " << strerror(errno) << "\n";
+		return -1;
+	    }
+	}
+	return grcnt;
+    }
+
+    // If we changed the read in contents, write them back out
+    phase_timer wt(&fst.write_time);
+    AtomicFile af(fname.c_str(), sync);
+    if (!af.write((const char *)mf.buf, mf.buflen) || !af.commit()) {
+	err << "Unable to write updated file contents for " << fname << ": " << af.error() << "\n";
+	return -1;
+    }
+    fst.bytes_written += mf.buflen;
+
+    return grcnt;
+}
+
+// Find the instances to replace in a single forward pass: at each point the
+// leftmost instance of any target wins, the longest one if several start
+// there (the earliest pair if they're the same length), and the search
+// resumes after it.  Replacements are never rescanned, so a replacement is
+// free to contain its own or any other target.
+size_t
+strclear_find_replacements(const char *buf, size_t buflen, const PatternSet &ps, std::vector<strclear_match> &hits)
+{
+    hits.clear();
+    if (!ps.tcnt)
+	return 0;
+    if (!ps.ac) {
+	const std::string &t = ps.targets[ps.tind];
+	if (split_threads > 1 && split_size && buflen >= split_size) {
+	    std::vector<AhoCorasick::Match> cand;
+	    find_instances_split(buf, buflen, ps, ps.tind, cand);
+	    size_t end = 0;
+	    for (size_t i = 0; i < cand.size(); i++) {
+		if (cand[i].pos < end)
+		    continue;
+		hits.push_back(cand[i]);
+		end = cand[i].pos + t.length();
+	    }
+	    return hits.size();
+	}
+	const char *position = ps.find(ps.tind, buf, buflen);
+	while (position) {
+	    hits.push_back({(size_t)(position - buf), ps.tind});
+	    position += t.length();
+	    position = ps.find(ps.tind, position, buf + buflen - position);
+	}
+	return hits.size();
+    }
+
+    std::vector<AhoCorasick::Match> matches;
+    find_instances_split(buf, buflen, ps, (size_t)-1, matches);
+    if (!matches.size())
+	return 0;
+    std::sort(matches.begin(), matches.end(), [&ps](const AhoCorasick::Match &m1, const AhoCorasick::Match &m2) {
+	if (m1.pos != m2.pos)
+	    return m1.pos < m2.pos;
+	size_t l1 = ps.targets[m1.pattern].length();
+	size_t l2 = ps.targets[m2.pattern].length();
+	return (l1 != l2) ? l1 > l2 : m1.pattern < m2.pattern;
+    });
+    size_t end = 0;
+    for (size_t i = 0; i < matches.size(); i++) {
+	if (matches[i].pos < end)
+	    continue;
+	hits.push_back(matches[i]);
+	end = matches[i].pos + ps.targets[matches[i].pattern].length();
+    }
+    return hits.size();
+}
+
+size_t
+strclear_replace(const char *buf, size_t buflen, const PatternSet &ps, std::vector<char> &out)
+{
+    std::vector<strclear_match> hits;
+    strclear_find_replacements(buf, buflen, ps, hits);
+    out.clear();
+    size_t prev = 0;
+    for (size_t i = 0; i < hits.size(); i++) {
+	const std::string &r = ps.replacements[hits[i].pattern];
+	out.insert(out.end(), buf + prev, buf + hits[i].pos);
+	out.insert(out.end(), r.begin(), r.end());
+	prev = hits[i].pos + ps.targets[hits[i].pattern].length();
+    }
+    out.insert(out.end(), buf + prev, buf + buflen);
+    return hits.size();
+}
+
+// Report the replacements a target at a time (as clearing does), each
+// target's instances numbered in file order
+static void
+report_replacements(std::ostream &out, const std::string &fname, const std::vector<strclear_match> &hits, const PatternSet &ps)
+{
+    for (size_t t = 0; t < ps.targets.size(); t++) {
+	int rcnt = 0;
+	for (size_t i = 0; i < hits.size(); i++) {
+	    if (hits[i].pattern == t)
+		report_replace(scratch.report, fname, ps.targets[t], ps.replacements[t], ++rcnt);
+	}
+    }
+    flush_report(out, scratch.report);
+}
+
+// Replace every target in a text file with its replacement, all pairs in
+// one pass (see strclear_find_replacements).  The file is read once and, if
+// anything changed, written once.
+int
+process_text(std::ostream &out, std::ostream &err, const std::string &fname, const PatternSet &ps, bool verbose, bool sync, file_stats &fst)
+{
+    if (!ps.tcnt)
+	return 0;
+
+    // If every replacement is the same length as its target (possibly
+    // padded out to it) the file can be patched straight into a writable
+    // mapping, the same way clearing works - only the pages holding
+    // instances get written back.  That isn't atomic: a crash part way
+    // through can leave some instances replaced and others not.  --fsync
+    // at least gets the finished patch to disk before moving on.
+    bool same_length = true;
+    for (size_t i = 0; i < ps.targets.size(); i++) {
+	if (ps.replacements[i].length() != ps.targets[i].length())
+	    same_length = false;
+    }
+
+    scratch_lease lease;
+    std::vector<strclear_match> &hits = scratch.matches;
+    if (same_length) {
+	phase_timer wrt(&fst.read_time);
+	MappedFile wmf(fname.c_str(), true);
+	wrt.stop();
+	if (wmf.buf) {
+	    phase_timer st(&fst.search_time);
+	    fst.mapped = 1;
+	    char *buf = (char *)wmf.buf;
+	    strclear_find_replacements(buf, wmf.buflen, ps, hits);
+	    for (size_t i = 0; i < hits.size(); i++) {
+		const std::string &r = ps.replacements[hits[i].pattern];
+		memcpy(buf + hits[i].pos, r.data(), r.length());
+		fst.bytes_patched += r.length();
+	    }
+	    st.stop();
+	    if (sync && hits.size()) {
+		phase_timer wt(&fst.write_time);
+		if (!wmf.sync()) {
+		    err << "Unable to flush updated file contents for " << fname << ": " << strerror(errno) << "\n";
+		    return -1;
+		}
+	    }
+	    if (verbose)
+		report_replacements(out, fname, hits, ps);
+	    return (int)hits.size();
+	}
+    }
+
+    // Otherwise the mapped file is our only input.  If it can't be mapped
+    // for some reason, it is read in instead.
+    phase_timer rt(&fst.read_time);
+    MappedFile mf(fname.c_str(), false, true);
+    if (!mf.valid) {
+	err << "Unable to open file " << fname << "\n";
+	return -1;
+    }
+    const char *cbuf = (const char *)mf.buf;
+    size_t clen = mf.buflen;
+    if (mf.mapped) {
+	fst.mapped = 1;
+	mf.advise(MappedFile::SEQUENTIAL);
+    } else {
+	fst.bytes_read += clen;
+	fst.peak_buffer = clen;
+    }
+    rt.stop();
+    if (!clen)
+	return 0;
+
+    phase_timer st(&fst.search_time);
+    strclear_find_replacements(cbuf, clen, ps, hits);
+    st.stop();
+    if (!hits.size())
+	return 0;
+
+    if (verbose)
+	report_replacements(out, fname, hits, ps);
+
+    // Stream the new contents to a temporary file that replaces the
+    // original only once it is complete.  Unchanged spans are copied from
+    // the original, with the replacements written in between them.  The
+    // mapping stays valid after the rename.
+    phase_timer wt(&fst.write_time);
+    AtomicFile af(fname.c_str(), sync);
+    bool ok = af.valid;
+    size_t prev = 0;
+    unsigned long long written = 0;
+    for (size_t i = 0; ok && i < hits.size(); i++) {
+	const std::string &r = ps.replacements[hits[i].pattern];
+	ok = af.copy_span(cbuf, prev, hits[i].pos - prev) && af.write(r.data(), r.length());
+	written += hits[i].pos - prev + r.length();
+	prev = hits[i].pos + ps.targets[hits[i].pattern].length();
+	fst.bytes_patched += ps.targets[hits[i].pattern].length();
+    }
+    if (ok)
+	ok = af.copy_span(cbuf, prev, clen - prev);
+    if (!ok || !af.commit()) {
+	err << "Unable to write updated file contents for " << fname << ": " << af.error() << "\n";
+	return -1;
+    }
+    fst.bytes_written += written + clen - prev;
+
+    return (int)hits.size();
+}
+
+// Binary strings can only be rewritten in place by replacements that fit
+static bool
+rewrite_fits(const PatternSet &ps)
+{
+    for (size_t i = 0; i < ps.targets.size(); i++) {
+	if (ps.replacements[i].length() > ps.targets[i].length())
+	    return false;
+    }
+    return true;
+}
+
+// Rewrite the instances found in one span (see strclear_rewrite), hits
+// being offsets into the span.  Returns the number of bytes changed.
+static size_t
+rewrite_span(char *sbuf, size_t slen, const PatternSet &ps, strclear_rewrite_t mode, char pad, const std::vector<strclear_match> &hits)
+{
+    size_t patched = 0;
+    if (mode == STRCLEAR_REWRITE_PAD) {
+	for (size_t i = 0; i < hits.size(); i++) {
+	    const std::string &r = ps.replacements[hits[i].pattern];
+	    size_t tlen = ps.targets[hits[i].pattern].length();
+	    memcpy(sbuf + hits[i].pos, r.data(), r.length());
+	    memset(sbuf + hits[i].pos + r.length(), pad, tlen - r.length());
+	    patched += tlen;
+	}
+	return patched;
+    }
+
+    // Shifting works a NUL terminated string at a time.  What follows each
+    // instance moves up behind its replacement (the string may hold more
+    // instances further on), and the bytes freed up at the end of the
+    // string become NULs.  Nothing moves past the string's terminator.
+    char *send = sbuf + slen;
+    size_t i = 0;
+    while (i < hits.size()) {
+	char *start = sbuf + hits[i].pos;
+	char *dst = start;
+	const char *src = start;
+	char *end = start;
+	do {
+	    char *p = sbuf + hits[i].pos;
+	    const std::string &r = ps.replacements[hits[i].pattern];
+	    memmove(dst, src, p - src);
+	    dst += p - src;
+	    memcpy(dst, r.data(), r.length());
+	    dst += r.length();
+	    src = p + ps.targets[hits[i].pattern].length();
+	    if (src > end) {
+		end = (char *)memchr(src, 0, send - src);
+		if (!end)
+		    end = send;
+	    }
+	    i++;
+	} while (i < hits.size() && sbuf + hits[i].pos < end);
+	memmove(dst, src, end - src);
+	dst += end - src;
+	memset(dst, 0, end - dst);
+	patched += end - start;
+    }
+    return patched;
+}
+
+size_t
+strclear_rewrite(char *buf, size_t buflen, const PatternSet &ps, strclear_rewrite_t mode, char pad, std::vector<strclear_match> *hits)
+{
+    std::vector<strclear_match> found;
+    std::vector<strclear_match> &h = (hits) ? *hits : found;
+    h.clear();
+    if (!ps.tcnt || mode == STRCLEAR_REWRITE_NONE || !rewrite_fits(ps))
+	return 0;
+    strclear_find_replacements(buf, buflen, ps, h);
+    rewrite_span(buf, buflen, ps, mode, pad, h);
+    return h.size();
+}
+
+// Rewrite a binary already in memory, a span at a time (only the string
+// sections, with sections set and a recognized object format)
+static int
+rewrite_loaded(std::ostream &out, const std::string &fname, char *buf, size_t buflen, const PatternSet &ps, strclear_rewrite_t mode, char pad, bool verbose, bool sections, file_stats &fst)
+{
+    scratch_lease lease;
+    phase_timer st(&fst.search_time);
+    std::vector<obj_section> spans = clear_spans(buf, buflen, sections);
+    std::vector<strclear_match> &hits = scratch.matches;
+    std::vector<strclear_match> &shits = scratch.wmatches;
+    for (size_t k = 0; k < spans.size(); k++) {
+	char *sbuf = buf + spans[k].offset;
+	strclear_find_replacements(sbuf, spans[k].size, ps, shits);
+	fst.bytes_patched += rewrite_span(sbuf, spans[k].size, ps, mode, pad, shits);
+	for (size_t i = 0; i < shits.size(); i++)
+	    hits.push_back({shits[i].pos + spans[k].offset, shits[i].pattern});
+    }
+    st.stop();
+    if (verbose)
+	report_replacements(out, fname, hits, ps);
+    return (int)hits.size();
+}
+
+// Shifting moves whole string tails about, which can't safely be done in
+// place - a crash part way through a move would leave neither the old file
+// nor the new one.  So the file is read (mapped read-only where possible)
+// and, if it holds anything to replace, rewritten in a copy that then
+// atomically replaces it.
+static int
+rewrite_shifted(std::ostream &out, std::ostream &err, const std::string &fname, const PatternSet &ps, bool verbose, bool sync, bool sections, file_stats &fst)
+{
+    phase_timer rt(&fst.read_time);
+    MappedFile mf(fname.c_str(), false, true);
+    rt.stop();
+    if (!mf.valid) {
+	err << "Unable to open file " << fname << "\n";
+	return -1;
+    }
+    if (mf.mapped) {
+	fst.mapped = 1;
+	mf.advise(MappedFile::SEQUENTIAL);
+    } else {
+	fst.bytes_read += mf.buflen;
+	fst.peak_buffer = mf.buflen;
+    }
+
+    // Most files hold nothing to replace, and needn't be copied at all
+    const char *cbuf = (const char *)mf.buf;
+    std::vector<strclear_match> first;
+    phase_timer st(&fst.search_time);
+    bool found = (mf.buflen && strclear_scan(cbuf, mf.buflen, ps, first, true));
+    st.stop();
+    if (!found)
+	return 0;
+
+    std::vector<char> buf(cbuf, cbuf + mf.buflen);
+    fst.peak_buffer = std::max(fst.peak_buffer, buf.size());
+    int grcnt = rewrite_loaded(out, fname, buf.data(), buf.size(), ps, STRCLEAR_REWRITE_SHIFT, '\0', verbose, sections, fst);
+    if (!grcnt)
+	return 0;
+
+    phase_timer wt(&fst.write_time);
+    AtomicFile af(fname.c_str(), sync);
+    if (!af.write(buf.data(), buf.size()) || !af.commit()) {
+	err << "Unable to write updated file contents for " << fname << ": " << af.error() << "\n";
+	return -1;
+    }
+    fst.bytes_written += buf.size();
+
+    return grcnt;
+}
+
+// Replace the targets in a binary file.  Like clearing this never changes
+// the file length, so padding works the same way - patching a writable
+// mapping where possible, otherwise reading the file in and writing it
+// back out if anything changed.  Shifting always rewrites the file (see
+// rewrite_shifted).  A string being shifted can run on to any length, so
+// the file is always taken whole rather than in windows.
+int
+process_binary_rewrite(std::ostream &out, std::ostream &err, const std::string &fname, const PatternSet &ps, strclear_rewrite_t mode, char pad, bool verbose, bool sync, bool sections, file_stats &fst)
+{
+    if (!ps.tcnt)
+	return 0;
+    if (!rewrite_fits(ps)) {
+	err << "Error:  can't replace strings in " << fname << " - binary strings can only be replaced by strings no longer than themselves\n";
+	return -1;
+    }
+    if (mode == STRCLEAR_REWRITE_SHIFT)
+	return rewrite_shifted(out, err, fname, ps, verbose, sync, sections, fst);
+
+    phase_timer rt(&fst.read_time);
+    MappedFile mf(fname.c_str(), true, true);
+    rt.stop();
+    if (!mf.valid) {
+	err << "Unable to open file " << fname << "\n";
+	return -1;
+    }
+    if (mf.mapped) {
+	fst.mapped = 1;
+	mf.advise(MappedFile::SEQUENTIAL);
+    } else {
+	fst.bytes_read += mf.buflen;
+	fst.peak_buffer = mf.buflen;
+    }
+
+    int grcnt = rewrite_loaded(out, fname, (char *)mf.buf, mf.buflen, ps, mode, pad, verbose, sections, fst);
+    if (!grcnt)
+	return grcnt;
+    if (mf.mapped) {
+	if (sync) {
+	    phase_timer wt(&fst.write_time);
+	    if (!mf.sync()) {
+		err << "Unable to flush updated file contents for " << fname << ": " << strerror(errno) << "\n";
+		return -1;
+	    }
+	}
+	return grcnt;
+    }
+
+    phase_timer wt(&fst.write_time);
+    AtomicFile af(fname.c_str(), sync);
+    if (!af.write((const char *)mf.buf, mf.buflen) || !af.commit()) {
+	err << "Unable to write updated file contents for " << fname << ": " << af.error() << "\n";
+	return -1;
+    }
+    fst.bytes_written += mf.buflen;
+
+    return grcnt;
+}
+
+// Find the instances of every target in buf that start before limit, in
+// offset order (or just the first one, if first_match is set).
+static void
+scan_buffer(const char *buf, size_t len, size_t limit, const PatternSet &ps, bool first_match, std::vector<AhoCorasick::Match> &found)
+{
+    found.clear();
+    if (first_match && !ps.ac) {
+	const char *position = ps.find(ps.tind, buf, len);
+	if (position)
+	    found.push_back({(size_t)(position - buf), ps.tind});
+    } else if (first_match) {
+	// The automaton reports matches in end offset order, so the first
+	// one found needn't be the first to start - but any match starting
+	// no later than it ends within max_len bytes of it, so only that
+	// much more of the buffer needs searching
+	ps.ac->find_all(buf, len, found, 1);
+	if (found.size()) {
+	    size_t end = std::min(len, found[0].pos + ps.max_len);
+	    found.clear();
+	    ps.ac->find_all(buf, end, found);
+	    std::sort(found.begin(), found.end(), [](const AhoCorasick::Match &m1, const AhoCorasick::Match &m2) {
+		return (m1.pos != m2.pos) ? m1.pos < m2.pos : m1.pattern < m2.pattern;
+	    });
+	}
+    } else {
+	find_instances_split(buf, len, ps, (ps.ac) ? (size_t)-1 : ps.tind, found);
+	if (ps.ac) {
+	    std::sort(found.begin(), found.end(), [](const AhoCorasick::Match &m1, const AhoCorasick::Match &m2) {
+		return (m1.pos != m2.pos) ? m1.pos < m2.pos : m1.pattern < m2.pattern;
+	    });
+	}
+    }
+    size_t n = 0;
+    while (n < found.size() && found[n].pos < limit && (!first_match || !n))
+	n++;
+    found.resize(n);
+}
+
+size_t
+strclear_scan(const char *buf, size_t buflen, const PatternSet &ps, std::vector<strclear_match> &matches, bool first_match)
+{
+    matches.clear();
+    if (!ps.tcnt)
+	return 0;
+    scan_buffer(buf, buflen, buflen, ps, first_match, matches);
+    return matches.size();
+}
+
+// Scan the listed spans of buf, noting which span each match was found in
+static void
+scan_spans(const char *buf, const std::vector<obj_section> &spans, const PatternSet &ps, bool first_match, std::vector<AhoCorasick::Match> &matches, std::vector<size_t> &secs)
+{
+    std::vector<AhoCorasick::Match> &smatches = scratch.wmatches;
+    for (size_t k = 0; k < spans.size(); k++) {
+	scan_buffer(buf + spans[k].offset, spans[k].size, spans[k].size, ps, first_match, smatches);
+	for (size_t i = 0; i < smatches.size(); i++) {
+	    matches.push_back({spans[k].offset + smatches[i].pos, smatches[i].pattern});
+	    secs.push_back(k);
+	}
+	if (first_match && matches.size())
+	    break;
+    }
+}
+
+// Scan just the string sections of an object file.  Returns false if the
+// file couldn't be mapped or isn't a recognized object format, leaving the
+// caller to scan it whole.
+static bool
+scan_sections(const std::string &fname, const PatternSet &ps, bool first_match, std::vector<AhoCorasick::Match> &matches, std::vector<obj_section> &spans, std::vector<size_t> &secs, file_stats &fst)
+{
+    phase_timer rt(&fst.read_time);
+    MappedFile mf(fname.c_str(), false, true);
+    rt.stop();
+    if (!mf.buf || !string_sections((const char *)mf.buf, mf.buflen, spans))
+	return false;
+    if (mf.mapped)
+	fst.mapped = 1;
+    else
+	fst.bytes_read += mf.buflen;
+
+    phase_timer st(&fst.search_time);
+    scan_spans((const char *)mf.buf, spans, ps, first_match, matches, secs);
+    return true;
+}
+
+// Write one "file:offset:target" line (or JSON object) per match, with the
+// section names (spans[secs[i]]) if the scan was by section
+static void
+report_matches(std::ostream &out, const std::string &fname, const std::vector<AhoCorasick::Match> &matches, const std::vector<obj_section> &spans, const std::vector<size_t> &secs, const PatternSet &ps, bool json, bool sections)
+{
+    if (!matches.size())
+	return;
+    std::string &rep = scratch.report;
+    rep.clear();
+    if (json) {
+	// Everything but the offsets is quoted once up front
+	std::string jfile;
+	json_append(jfile, fname);
+	std::vector<std::string> jtargets(ps.targets.size());
+	for (size_t i = 0; i < ps.targets.size(); i++)
+	    json_append(jtargets[i], ps.targets[i]);
+	std::vector<std::string> jsections(sections ? spans.size() : 0);
+	for (size_t i = 0; i < jsections.size(); i++)
+	    json_append(jsections[i], spans[i].name);
+	for (size_t i = 0; i < matches.size(); i++) {
+	    rep.append("{\"file\":");
+	    rep.append(jfile);
+	    rep.append(",\"offset\":");
+	    append_num(rep, matches[i].pos);
+	    if (sections) {
+		rep.append(",\"section\":");
+		rep.append(jsections[secs[i]]);
+	    }
+	    rep.append(",\"pattern\":");
+	    rep.append(jtargets[matches[i].pattern]);
+	    rep.append("}\n");
+	}
+    } else {
+	for (size_t i = 0; i < matches.size(); i++) {
+	    rep.append(fname);
+	    rep.push_back(':');
+	    append_num(rep, matches[i].pos);
+	    rep.push_back(':');
+	    if (sections) {
+		rep.append(spans[secs[i]].name);
+		rep.push_back(':');
+	    }
+	    rep.append(ps.targets[matches[i].pattern]);
+	    rep.push_back('\n');
+	}
+    }
+    flush_report(out, rep);
+}
+
+int
+scan_loaded(std::ostream &out, const std::string &fname, const char *buf, size_t buflen, const PatternSet &ps, bool json, bool first_match, bool sections, file_stats &fst)
+{
+    if (!ps.tcnt)
+	return 0;
+    scratch_lease lease;
+    phase_timer st(&fst.search_time);
+    std::vector<obj_section> spans;
+    if (!sections || !string_sections(buf, buflen, spans)) {
+	sections = false;
+	spans.assign(1, {std::string(), 0, buflen});
+    }
+    std::vector<AhoCorasick::Match> &matches = scratch.matches;
+    scan_spans(buf, spans, ps, first_match, matches, scratch.secs);
+    st.stop();
+    report_matches(out, fname, matches, spans, scratch.secs, ps, json, sections);
+    return (int)matches.size();
+}
+
+// Report every instance of every target in a file without modifying it.
+// Output is one "file:offset:target" line (or JSON object) per instance,
+// in offset order.  If first_match is set, stop at the first instance
+// found.  Files larger than chunk_size (if set) are scanned in windows.
+// With sections set, object files that fit in a single window have only
+// their string sections scanned, and each line names the section as
+// "file:offset:section:target".  Returns the number of instances reported,
+// or -1 on error.
+int
+scan_file(std::ostream &out, std::ostream &err, const std::string &fname, const PatternSet &ps, bool json, bool first_match, size_t chunk_size, bool sections, file_stats &fst)
+{
+    if (!ps.tcnt)
+	return 0;
+
+    scratch_lease lease;
+    std::vector<AhoCorasick::Match> &matches = scratch.matches;
+    std::vector<AhoCorasick::Match> &wmatches = scratch.wmatches;
+    std::vector<obj_section> spans;
+    if (sections) {
+	std::error_code ec;
+	unsigned long long flen = std::filesystem::file_size(fname, ec);
+	if (ec || (chunk_size && flen > chunk_size) || !scan_sections(fname, ps, first_match, matches, spans, scratch.secs, fst))
+	    sections = false;
+    }
+
+    // Without a chunk size the whole file is a single window
+    if (!sections) {
+	int ret = visit_windows(err, fname, false, false, chunk_size, ps.max_len - 1, [&](file_window &w) {
+	    scan_buffer(w.buf, w.len, w.limit, ps, first_match, wmatches);
+	    for (size_t i = 0; i < wmatches.size(); i++)
+		matches.push_back({(size_t)(w.offset + wmatches[i].pos), wmatches[i].pattern});
+	    if (first_match && matches.size())
+		w.stop = true;
+	    return w.limit;
+	}, fst);
+	if (ret < 0)
+	    return -1;
+    }
+
+    report_matches(out, fname, matches, spans, scratch.secs, ps, json, sections);
+    return (int)matches.size();
+}
+
+// Recognize the executable and object formats we routinely clear, so they
+// can be classified from the first few bytes: ELF, Mach-O (thin and fat),
+// PE (MZ stub pointing at a PE signature) and ar archives (static libs).
+static bool
+is_binary_format(const unsigned char *buf, size_t buflen)
+{
+    if (buflen >= 4 && !memcmp(buf, "\x7f" "ELF", 4))
+	return true;
+    if (buflen >= 4) {
+	uint32_t m = (uint32_t)buf[0] << 24 | buf[1] << 16 | buf[2] << 8 | buf[3];
+	if (m == 0xfeedface || m == 0xfeedfacf || m == 0xcefaedfe || m == 0xcffaedfe || m == 0xcafebabe)
+	    return true;
+    }
+    if (buflen >= 8 && !memcmp(buf, "!<arch>\n", 8))
+	return true;
+    if (buflen >= 0x40 && buf[0] == 'M' && buf[1] == 'Z') {
+	uint32_t pe_off = buf[0x3c] | buf[0x3d] << 8 | buf[0x3e] << 16 | (uint32_t)buf[0x3f] << 24;
+	if ((size_t)pe_off + 4 <= buflen && !memcmp(buf + pe_off, "PE\0\0", 4))
+	    return true;
+    }
+    return false;
+}
+
+// Determine if the file is a binary or text file.  A text file is one with
+// no NUL bytes and nothing outside 7-bit ASCII - if sample_bytes is set,
+// only that many leading bytes are checked.
+bool
+is_binary(const std::string &fname, size_t sample_bytes)
+{
+    MappedFile mf(fname.c_str());
+    if (mf.buf) {
+	const char *cbuf = (const char *)mf.buf;
+	if (is_binary_format((const unsigned char *)cbuf, mf.buflen))
+	    return true;
+	size_t len = (sample_bytes && sample_bytes < mf.buflen) ? sample_bytes : mf.buflen;
+	return (memfind_nontext(cbuf, len)) ? true : false;
+    }
+
+    // Couldn't map it (or it's empty) - scan it a block at a time instead
+    std::ifstream check_fs(fname, std::ios::binary);
+    if (!check_fs.is_open())
+	return false;
+    std::vector<char> block(64 * 1024);
+    size_t scanned = 0;
+    bool first = true;
+    while (check_fs && (!sample_bytes || scanned < sample_bytes)) {
+	check_fs.read(block.data(), block.size());
+	size_t len = (size_t)check_fs.gcount();
+	if (!len)
+	    break;
+	if (first && is_binary_format((const unsigned char *)block.data(), len))
+	    return true;
+	first = false;
+	if (sample_bytes && len > sample_bytes - scanned)
+	    len = sample_bytes - scanned;
+	if (memfind_nontext(block.data(), len))
+	    return true;
+	scanned += len;
+    }
+    return false;
+}
+
+// Whether fname is an archive process_archive can clear (judged from the
+// start of the file)
+static bool
+is_archive(const std::string &fname)
+{
+    MappedFile mf(fname.c_str(), false, 0, 64 * 1024, true);
+    return (mf.buf && archive_format((const char *)mf.buf, mf.buflen) != ARCHIVE_NONE);
+}
+
+// Classify and process a single file.  Returns the number of strings
+// cleared or replaced, or -1 on error.  All reporting goes to the supplied
+// streams so parallel workers can buffer it per file.
+int
+process_file(std::ostream &out, std::ostream &err, const std::string &fname, const PatternSet &ps, const strclear_settings &s, file_stats &fst)
+{
+    // Archives have the strings in their members cleared, rather than
+    // being treated as one big binary.  Members are held in memory whole,
+    // so the chunk size (if any) bounds them too.
+    if (s.archives && !s.swap_mode) {
+	phase_timer ct(&fst.classify_time);
+	bool archive = is_archive(fname);
+	ct.stop();
+	if (archive)
+	    return process_archive(out, err, fname, ps, s.verbose, s.sync, (s.chunk_size) ? s.chunk_size : (size_t)-1, fst);
+    }
+
+    // If we've not been told to treat the file as binary explicitly with
+    // -b, check it.  If we've been told text mode we still check to make
+    // sure we really have a text file before processing.
+    bool binary_mode = s.binary_mode;
+    if (!binary_mode) {
+	phase_timer ct(&fst.classify_time);
+	binary_mode = is_binary(fname, s.classify_bytes);
+    }
+
+    if (binary_mode && s.swap_mode) {
+	if (s.binary_rewrite != STRCLEAR_REWRITE_NONE)
+	    return process_binary_rewrite(out, err, fname, ps, s.binary_rewrite, s.rewrite_pad, s.verbose, s.sync, s.sections, fst);
+	err << "Error:  string replacement indicated, but " << fname << " is binary\n";
+	return -1;
+    }
+
+    // If we're in binary or clear mode we're just nulling out the target
+    // string(s).
+    if (binary_mode || !s.swap_mode)
+	return process_binary(out, err, fname, ps, s.verbose, s.sync, s.chunk_size, s.sections, fst);
+
+    return process_text(out, err, fname, ps, s.verbose, s.sync, fst);
+}
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
@@ -0,0 +1,174 @@
+/*                  L I B S T R C L E A R . H P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file libstrclear.hpp
+ *
+ * The strclear engine, usable without the command line tool.
+ *
+ * There are two levels.  The buffer functions clear, scan or rewrite
+ * memory the caller already holds - archive members, files read some other
+ * way - with no file I/O at all.  The file functions are what the strclear
+ * tool itself runs per file: they pick the fastest safe way to get at the
+ * file (mapping it, windowing it, reading it in), report to the supplied
+ * streams and record what they did in a file_stats.
+ *
+ * Either way the strings are compiled once into a PatternSet, which can be
+ * shared read-only between threads.
+ */
+
+#ifndef LIBSTRCLEAR_HPP
+#define LIBSTRCLEAR_HPP
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "AhoCorasick.hpp"
+#include "PatternSet.hpp"
+#include "Stats.hpp"
+
+/* An instance of a target: its offset in the buffer and the index of the
+ * target in the pattern set */
+typedef AhoCorasick::Match strclear_match;
+
+/* Buffer level API */
+
+/* Search buffers of at least min_size bytes (0 for none) as that many
+ * segments searched in parallel, one per thread (0 threads meaning one per
+ * core).  Results are exactly those of a single pass.  The threads are
+ * started here and shared by every search, so concurrent searches split
+ * the same threads rather than starting their own.  This applies to
+ * everything below, process wide - set it before processing starts.  The
+ * default is a single thread. */
+void strclear_set_split(size_t min_size, size_t threads);
+
+/* Clear every instance of the targets in buf, in place, exactly as the
+ * strclear tool clears a binary file.  If cleared is set the instances
+ * cleared are appended to it, grouped by target in pattern set order and
+ * in offset order within each target.  Returns the number cleared. */
+size_t strclear_clear(char *buf, size_t buflen, const PatternSet &ps, std::vector<strclear_match> *cleared = NULL);
+
+/* Write the verbose report for the instances strclear_clear cleared, as
+ * the strclear tool would for a file called name */
+void strclear_report_cleared(std::ostream &out, const std::string &name, const std::vector<strclear_match> &cleared, const PatternSet &ps);
+
+/* Find every instance of every target in buf (overlapping ones included),
+ * in offset order, replacing the contents of matches.  If first_match is
+ * set stop at the first one.  Returns the number found. */
+size_t strclear_scan(const char *buf, size_t buflen, const PatternSet &ps, std::vector<strclear_match> &matches, bool first_match = false);
+
+/* Find the instances replace mode would replace, in offset order: at each
+ * point the leftmost instance of any target wins, the longest one if
+ * several start there, and the search resumes after it.  ps.replacements
+ * must hold a replacement per target.  Returns the number found. */
+size_t strclear_find_replacements(const char *buf, size_t buflen, const PatternSet &ps, std::vector<strclear_match> &hits);
+
+/* Write buf with those instances replaced to out.  Returns the number of
+ * instances replaced. */
+size_t strclear_replace(const char *buf, size_t buflen, const PatternSet &ps, std::vector<char> &out);
+
+/* How replace mode rewrites binaries, in place.  Either way the buffer
+ * length, and everything outside the strings rewritten, are unchanged.
+ * PAD follows each replacement with enough pad chars to fill out its
+ * target.  SHIFT moves the rest of the NUL terminated string holding the
+ * instance up behind the replacement and NUL pads the end of the string,
+ * so an embedded path keeps its tail. */
+enum strclear_rewrite_t {
+    STRCLEAR_REWRITE_NONE,
+    STRCLEAR_REWRITE_PAD,
+    STRCLEAR_REWRITE_SHIFT
+};
+
+/* Replace the instances strclear_find_replacements finds in buf in place,
+ * as the strclear tool rewrites a binary file (pad is the char PAD fills
+ * with).  Every replacement must be no longer than its target - if any
+ * isn't, nothing is changed.  If hits is set the instances replaced are
+ * stored there.  Returns the number replaced. */
+size_t strclear_rewrite(char *buf, size_t buflen, const PatternSet &ps, strclear_rewrite_t mode, char pad, std::vector<strclear_match> *hits = NULL);
+
+/* File level API.  These return the number of strings cleared, replaced or
+ * found, or -1 (after reporting to err) on error. */
+
+/* Settings shared by every file processed in a run */
+struct strclear_settings {
+    bool binary_mode = false;   /**< treat every file as binary (-b) */
+    bool swap_mode = false;     /**< replace rather than clear (-r) */
+    char clear_char = '\0';     /**< char used to overwrite cleared strings */
+    bool verbose = false;
+    size_t classify_bytes = 0;  /**< only check this many leading bytes when classifying (0 = all) */
+    bool sync = false;          /**< flush files patched in place to disk, and fsync rewritten ones before renaming them into place */
+    size_t chunk_size = 0;      /**< process files larger than this in windows (0 = never) */
+    bool sections = false;      /**< only search the string sections of object files */
+    bool archives = false;      /**< clear the members of tar, tar.gz and zip archives */
+    strclear_rewrite_t binary_rewrite = STRCLEAR_REWRITE_NONE; /**< how replace mode rewrites binaries (NONE rejects them) */
+    char rewrite_pad = '\0';    /**< char STRCLEAR_REWRITE_PAD pads with */
+};
+
+/* Classify the file and clear or replace the strings in it */
+int process_file(std::ostream &out, std::ostream &err, const std::string &fname, const PatternSet &ps, const strclear_settings &s, file_stats &fst);
+
+/* Clear the strings in a file (of any type) in place */
+int process_binary(std::ostream &out, std::ostream &err, const std::string &fname, const PatternSet &ps, bool verbose, bool sync, size_t chunk_size, bool sections, file_stats &fst);
+
+/* Replace the targets in a text file with their replacements */
+int process_text(std::ostream &out, std::ostream &err, const std::string &fname, const PatternSet &ps, bool verbose, bool sync, file_stats &fst);
+
+/* Replace the targets in a binary file in place (see strclear_rewrite_t) */
+int process_binary_rewrite(std::ostream &out, std::ostream &err, const std::string &fname, const PatternSet &ps, strclear_rewrite_t mode, char pad, bool verbose, bool sync, bool sections, file_stats &fst);
+
+/* Report the location of every target in a file without changing it */
+int scan_file(std::ostream &out, std::ostream &err, const std::string &fname, const PatternSet &ps, bool json, bool first_match, size_t chunk_size, bool sections, file_stats &fst);
+
+/* As process_binary and scan_file, for a file whose contents the caller has
+ * already read into buf (the io_uring loader, for one).  clear_loaded
+ * clears buf in place and leaves writing it back to the caller, if the
+ * count returned is non-zero. */
+int clear_loaded(std::ostream &out, const std::string &fname, char *buf, size_t buflen, const PatternSet &ps, bool verbose, bool sections, file_stats &fst);
+int scan_loaded(std::ostream &out, const std::string &fname, const char *buf, size_t buflen, const PatternSet &ps, bool json, bool first_match, bool sections, file_stats &fst);
+
+/* True if the file is a recognized binary format or isn't plain 7-bit
+ * text (checking only the first sample_bytes, if set) */
+bool is_binary(const std::string &fname, size_t sample_bytes = 0);
+
+#endif /* LIBSTRCLEAR_HPP */
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
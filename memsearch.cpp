@@ -0,0 +1,732 @@
+/*                  M E M S E A R C H . C P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file memsearch.cpp
+ *
+ * Substring search kernels and runtime dispatch.
+ *
+ * The vector kernels use the "first and last byte" filter: broadcast the
+ * first and last needle bytes, compare them against a block of candidate
+ * start positions and the block nlen-1 bytes later, and only memcmp the
+ * middle of the needle at positions where both compares hit.  For the
+ * long, low-entropy-at-the-ends path strings we clear this rejects almost
+ * every position with two vector compares per block.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include "memsearch.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define MEMSEARCH_HAVE_X86 1
+#  include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#  define MEMSEARCH_HAVE_NEON 1
+#  include <arm_neon.h>
+#endif
+
+extern "C" char *
+strnstr(const char *h, const char *n, size_t hlen);
+
+static const char *
+search_std(const char *h, size_t hlen, const char *n, size_t nlen)
+{
+    const char *hend = h + hlen;
+    const char *r = std::search(h, hend, n, n + nlen);
+    return (r == hend && nlen) ? NULL : r;
+}
+
+static const char *
+search_strnstr(const char *h, size_t hlen, const char *n, size_t)
+{
+    return strnstr(h, n, hlen);
+}
+
+/* Needle comparisons the kernels are instantiated with.  Each is built
+ * once per search from the needle, and eq(p) tells whether the needle is
+ * at p, p[0] being already known to match and p + nlen being within the
+ * haystack.
+ *
+ * cmp_generic handles any length with memcmp.  The rest are specialized
+ * on a class of needle lengths, to compare with a few word loads and no
+ * call: exact lengths up to 8 compare a single word (masked to the length
+ * at compile time), 9 to 16 and 17 to 32 bytes compare overlapping words
+ * from each end, and longer needles check their first and last 16 bytes
+ * that way before comparing the middle. */
+static inline uint64_t
+load64(const char *p)
+{
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+struct cmp_generic {
+    cmp_generic(const char *needle, size_t len) : n(needle), nlen(len) {}
+    bool eq(const char *p) const
+    {
+	return p[nlen - 1] == n[nlen - 1] && !memcmp(p + 1, n + 1, nlen - 1);
+    }
+    const char *n;
+    size_t nlen;
+};
+
+template <size_t N>
+struct cmp_fixed {
+    static_assert(N >= 2 && N <= 8, "fixed length compares are one word");
+    cmp_fixed(const char *needle, size_t) : nw(load(needle)) {}
+    static uint64_t load(const char *p)
+    {
+	uint64_t w = 0;
+	memcpy(&w, p, N);
+	return w;
+    }
+    bool eq(const char *p) const
+    {
+	return load(p) == nw;
+    }
+    uint64_t nw;
+};
+
+struct cmp_upto16 {
+    cmp_upto16(const char *needle, size_t len) : tail(len - 8), h0(load64(needle)), t0(load64(needle + tail)) {}
+    bool eq(const char *p) const
+    {
+	return load64(p) == h0 && load64(p + tail) == t0;
+    }
+    size_t tail;
+    uint64_t h0, t0;
+};
+
+struct cmp_upto32 {
+    cmp_upto32(const char *needle, size_t len) : tail(len - 16),
+	h0(load64(needle)), h1(load64(needle + 8)), t0(load64(needle + tail)), t1(load64(needle + tail + 8)) {}
+    bool eq(const char *p) const
+    {
+	return ((load64(p) ^ h0) | (load64(p + 8) ^ h1) | (load64(p + tail) ^ t0) | (load64(p + tail + 8) ^ t1)) == 0;
+    }
+    size_t tail;
+    uint64_t h0, h1, t0, t1;
+};
+
+struct cmp_long {
+    cmp_long(const char *needle, size_t len) : ends(needle, len), n(needle), nlen(len) {}
+    bool eq(const char *p) const
+    {
+	// The first and last 16 bytes, then the rest
+	return ends.eq(p) && !memcmp(p + 16, n + 16, nlen - 32);
+    }
+    cmp_upto32 ends;
+    const char *n;
+    size_t nlen;
+};
+
+template <class Cmp>
+static const char *
+search_scalar_t(const char *h, size_t hlen, const char *n, size_t nlen)
+{
+    if (!nlen)
+	return h;
+    if (nlen > hlen)
+	return NULL;
+
+    const Cmp cmp(n, nlen);
+    const char *p = h;
+    const char *last = h + hlen - nlen; /* last possible match start */
+    while (p <= last) {
+	p = (const char *)memchr(p, n[0], last - p + 1);
+	if (!p)
+	    return NULL;
+	if (cmp.eq(p))
+	    return p;
+	p++;
+    }
+    return NULL;
+}
+
+#ifdef MEMSEARCH_HAVE_X86
+template <class Cmp>
+__attribute__((target("sse2"))) static const char *
+search_sse2_t(const char *h, size_t hlen, const char *n, size_t nlen)
+{
+    if (nlen < 2 || nlen > hlen)
+	return search_scalar_t<Cmp>(h, hlen, n, nlen);
+
+    const Cmp cmp(n, nlen);
+    const __m128i first = _mm_set1_epi8(n[0]);
+    const __m128i last = _mm_set1_epi8(n[nlen - 1]);
+
+    /* Each block tests 16 start positions, reading up to h[i + nlen + 14] */
+    size_t i = 0;
+    for (; i + nlen + 15 <= hlen; i += 16) {
+	__m128i bf = _mm_loadu_si128((const __m128i *)(h + i));
+	__m128i bl = _mm_loadu_si128((const __m128i *)(h + i + nlen - 1));
+	__m128i eq = _mm_and_si128(_mm_cmpeq_epi8(first, bf), _mm_cmpeq_epi8(last, bl));
+	unsigned int mask = (unsigned int)_mm_movemask_epi8(eq);
+	while (mask) {
+	    unsigned int bit = __builtin_ctz(mask);
+	    if (cmp.eq(h + i + bit))
+		return h + i + bit;
+	    mask &= mask - 1;
+	}
+    }
+
+    return search_scalar_t<Cmp>(h + i, hlen - i, n, nlen);
+}
+
+template <class Cmp>
+__attribute__((target("avx2"))) static const char *
+search_avx2_t(const char *h, size_t hlen, const char *n, size_t nlen)
+{
+    if (nlen < 2 || nlen > hlen)
+	return search_scalar_t<Cmp>(h, hlen, n, nlen);
+
+    const Cmp cmp(n, nlen);
+    const __m256i first = _mm256_set1_epi8(n[0]);
+    const __m256i last = _mm256_set1_epi8(n[nlen - 1]);
+
+    /* Each block tests 32 start positions, reading up to h[i + nlen + 30] */
+    size_t i = 0;
+    for (; i + nlen + 31 <= hlen; i += 32) {
+	__m256i bf = _mm256_loadu_si256((const __m256i *)(h + i));
+	__m256i bl = _mm256_loadu_si256((const __m256i *)(h + i + nlen - 1));
+	__m256i eq = _mm256_and_si256(_mm256_cmpeq_epi8(first, bf), _mm256_cmpeq_epi8(last, bl));
+	unsigned int mask = (unsigned int)_mm256_movemask_epi8(eq);
+	while (mask) {
+	    unsigned int bit = __builtin_ctz(mask);
+	    if (cmp.eq(h + i + bit))
+		return h + i + bit;
+	    mask &= mask - 1;
+	}
+    }
+
+    return search_sse2_t<Cmp>(h + i, hlen - i, n, nlen);
+}
+#endif /* MEMSEARCH_HAVE_X86 */
+
+#ifdef MEMSEARCH_HAVE_NEON
+template <class Cmp>
+static const char *
+search_neon_t(const char *h, size_t hlen, const char *n, size_t nlen)
+{
+    if (nlen < 2 || nlen > hlen)
+	return search_scalar_t<Cmp>(h, hlen, n, nlen);
+
+    const Cmp cmp(n, nlen);
+    const uint8x16_t first = vdupq_n_u8((uint8_t)n[0]);
+    const uint8x16_t last = vdupq_n_u8((uint8_t)n[nlen - 1]);
+
+    size_t i = 0;
+    for (; i + nlen + 15 <= hlen; i += 16) {
+	uint8x16_t bf = vld1q_u8((const uint8_t *)(h + i));
+	uint8x16_t bl = vld1q_u8((const uint8_t *)(h + i + nlen - 1));
+	uint8x16_t eq = vandq_u8(vceqq_u8(first, bf), vceqq_u8(last, bl));
+	/* No movemask on NEON - narrowing shift packs one nibble per byte */
+	uint8x8_t packed = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+	uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(packed), 0);
+	while (mask) {
+	    unsigned int bit = __builtin_ctzll(mask) >> 2;
+	    if (cmp.eq(h + i + bit))
+		return h + i + bit;
+	    mask &= ~(0xfULL << (bit * 4));
+	}
+    }
+
+    return search_scalar_t<Cmp>(h + i, hlen - i, n, nlen);
+}
+#endif /* MEMSEARCH_HAVE_NEON */
+
+/* Single byte needles need nothing more than memchr */
+static const char *
+search_byte(const char *h, size_t hlen, const char *n, size_t)
+{
+    return (const char *)memchr(h, n[0], hlen);
+}
+
+/* Kernel K instantiated for needles of exactly nlen bytes.  The exact
+ * length instances are laid out in a table built at compile time. */
+#define MEMSEARCH_SPECIALIZE(K, nlen)					\
+    do {								\
+	static constexpr memsearch_func fixed[] = {			\
+	    K<cmp_fixed<2>>, K<cmp_fixed<3>>, K<cmp_fixed<4>>,		\
+	    K<cmp_fixed<5>>, K<cmp_fixed<6>>, K<cmp_fixed<7>>,		\
+	    K<cmp_fixed<8>>						\
+	};								\
+	if (nlen == 1)							\
+	    return search_byte;						\
+	if (nlen <= 8)							\
+	    return fixed[nlen - 2];					\
+	if (nlen <= 16)							\
+	    return K<cmp_upto16>;					\
+	if (nlen <= 32)							\
+	    return K<cmp_upto32>;					\
+	return K<cmp_long>;						\
+    } while (0)
+
+/* Scalar non-text scan, a word at a time: a byte is of interest if its
+ * high bit is set or it is zero. */
+static const char *
+nontext_scalar(const char *buf, size_t buflen)
+{
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t highs = 0x8080808080808080ULL;
+    size_t i = 0;
+    for (; i + 8 <= buflen; i += 8) {
+	uint64_t w;
+	memcpy(&w, buf + i, 8);
+	if ((w & highs) || ((w - ones) & ~w & highs))
+	    break;
+    }
+    for (; i < buflen; i++) {
+	unsigned char c = (unsigned char)buf[i];
+	if (!c || c >= 128)
+	    return buf + i;
+    }
+    return NULL;
+}
+
+#ifdef MEMSEARCH_HAVE_X86
+__attribute__((target("sse2"))) static const char *
+nontext_sse2(const char *buf, size_t buflen)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= buflen; i += 16) {
+	__m128i b = _mm_loadu_si128((const __m128i *)(buf + i));
+	/* movemask picks up the high bits directly */
+	unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_or_si128(b, _mm_cmpeq_epi8(b, zero)));
+	if (mask)
+	    return buf + i + __builtin_ctz(mask);
+    }
+    return nontext_scalar(buf + i, buflen - i);
+}
+
+__attribute__((target("avx2"))) static const char *
+nontext_avx2(const char *buf, size_t buflen)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 64 <= buflen; i += 64) {
+	__m256i b0 = _mm256_loadu_si256((const __m256i *)(buf + i));
+	__m256i b1 = _mm256_loadu_si256((const __m256i *)(buf + i + 32));
+	__m256i t0 = _mm256_or_si256(b0, _mm256_cmpeq_epi8(b0, zero));
+	__m256i t1 = _mm256_or_si256(b1, _mm256_cmpeq_epi8(b1, zero));
+	if (_mm256_movemask_epi8(_mm256_or_si256(t0, t1))) {
+	    unsigned int m0 = (unsigned int)_mm256_movemask_epi8(t0);
+	    if (m0)
+		return buf + i + __builtin_ctz(m0);
+	    return buf + i + 32 + __builtin_ctz((unsigned int)_mm256_movemask_epi8(t1));
+	}
+    }
+    return nontext_sse2(buf + i, buflen - i);
+}
+#endif /* MEMSEARCH_HAVE_X86 */
+
+#ifdef MEMSEARCH_HAVE_NEON
+static const char *
+nontext_neon(const char *buf, size_t buflen)
+{
+    size_t i = 0;
+    for (; i + 16 <= buflen; i += 16) {
+	uint8x16_t b = vld1q_u8((const uint8_t *)(buf + i));
+	/* NUL or high bit set <=> (byte - 1) as unsigned is >= 127 */
+	uint8x16_t t = vcgeq_u8(vsubq_u8(b, vdupq_n_u8(1)), vdupq_n_u8(127));
+	uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(t), 4)), 0);
+	if (mask)
+	    return buf + i + (__builtin_ctzll(mask) >> 2);
+    }
+    return nontext_scalar(buf + i, buflen - i);
+}
+#endif /* MEMSEARCH_HAVE_NEON */
+
+static const char *kernel_names[MEMSEARCH_KERNEL_CNT] = {
+    "auto", "std", "strnstr", "scalar", "sse2", "avx2", "neon"
+};
+
+memsearch_func
+memsearch_kernel(memsearch_kernel_t k)
+{
+    switch (k) {
+	case MEMSEARCH_AUTO:
+	    for (int i = MEMSEARCH_KERNEL_CNT - 1; i > MEMSEARCH_SCALAR; i--) {
+		memsearch_func f = memsearch_kernel((memsearch_kernel_t)i);
+		if (f)
+		    return f;
+	    }
+	    return search_scalar_t<cmp_generic>;
+	case MEMSEARCH_STD:
+	    return search_std;
+	case MEMSEARCH_STRNSTR:
+	    return search_strnstr;
+	case MEMSEARCH_SCALAR:
+	    return search_scalar_t<cmp_generic>;
+#ifdef MEMSEARCH_HAVE_X86
+	case MEMSEARCH_SSE2:
+	    __builtin_cpu_init();
+	    return (__builtin_cpu_supports("sse2")) ? search_sse2_t<cmp_generic> : NULL;
+	case MEMSEARCH_AVX2:
+	    __builtin_cpu_init();
+	    return (__builtin_cpu_supports("avx2")) ? search_avx2_t<cmp_generic> : NULL;
+#endif
+#ifdef MEMSEARCH_HAVE_NEON
+	case MEMSEARCH_NEON:
+	    return search_neon_t<cmp_generic>;
+#endif
+	default:
+	    return NULL;
+    }
+}
+
+memsearch_func
+memsearch_kernel_for(memsearch_kernel_t k, size_t nlen)
+{
+    if (k == MEMSEARCH_AUTO) {
+	k = MEMSEARCH_SCALAR;
+	for (int i = MEMSEARCH_KERNEL_CNT - 1; i > MEMSEARCH_SCALAR; i--) {
+	    if (memsearch_kernel((memsearch_kernel_t)i)) {
+		k = (memsearch_kernel_t)i;
+		break;
+	    }
+	}
+    }
+    if (!nlen || !memsearch_kernel(k))
+	return memsearch_kernel(k);
+    switch (k) {
+	case MEMSEARCH_SCALAR:
+	    MEMSEARCH_SPECIALIZE(search_scalar_t, nlen);
+#ifdef MEMSEARCH_HAVE_X86
+	case MEMSEARCH_SSE2:
+	    MEMSEARCH_SPECIALIZE(search_sse2_t, nlen);
+	case MEMSEARCH_AVX2:
+	    MEMSEARCH_SPECIALIZE(search_avx2_t, nlen);
+#endif
+#ifdef MEMSEARCH_HAVE_NEON
+	case MEMSEARCH_NEON:
+	    MEMSEARCH_SPECIALIZE(search_neon_t, nlen);
+#endif
+	default:
+	    // std and strnstr are only there for comparison
+	    return memsearch_kernel(k);
+    }
+}
+
+const char *
+memsearch_name(memsearch_kernel_t k)
+{
+    if (k < 0 || k >= MEMSEARCH_KERNEL_CNT)
+	return NULL;
+    return kernel_names[k];
+}
+
+/* The selection is resolved once (thread safely, via the static
+ * initializer) and only changed by memsearch_select() */
+static memsearch_func &
+active_func()
+{
+    static memsearch_func f = memsearch_kernel(MEMSEARCH_AUTO);
+    return f;
+}
+
+static memsearch_kernel_t &
+active_kernel()
+{
+    static memsearch_kernel_t k = MEMSEARCH_AUTO;
+    return k;
+}
+
+bool
+memsearch_select(const char *name)
+{
+    if (!name)
+	return false;
+    for (int i = 0; i < MEMSEARCH_KERNEL_CNT; i++) {
+	if (strcmp(name, kernel_names[i]))
+	    continue;
+	memsearch_func f = memsearch_kernel((memsearch_kernel_t)i);
+	if (!f)
+	    return false;
+	active_func() = f;
+	active_kernel() = (memsearch_kernel_t)i;
+	return true;
+    }
+    return false;
+}
+
+memsearch_kernel_t
+memsearch_selected()
+{
+    return active_kernel();
+}
+
+const char *
+memsearch(const char *h, size_t hlen, const char *n, size_t nlen)
+{
+    return active_func()(h, hlen, n, nlen);
+}
+
+typedef const char *(*nontext_func)(const char *buf, size_t buflen);
+
+static nontext_func
+nontext_kernel()
+{
+#ifdef MEMSEARCH_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+	return nontext_avx2;
+    if (__builtin_cpu_supports("sse2"))
+	return nontext_sse2;
+#endif
+#ifdef MEMSEARCH_HAVE_NEON
+    return nontext_neon;
+#endif
+    return nontext_scalar;
+}
+
+const char *
+memfind_nontext(const char *buf, size_t buflen)
+{
+    static nontext_func f = nontext_kernel();
+    return f(buf, buflen);
+}
+
+/* Multi-needle prefilter.  Needles are grouped by their first flen bytes
+ * into 8 buckets, one bit each, and for each of those bytes two 16 entry
+ * tables give the buckets holding a prefix with that low and that high
+ * nibble.  A position is a candidate if some bucket's bit survives ANDing
+ * the lookups for all flen bytes from it - with a byte shuffle doing 16 (or
+ * 32) lookups at once, that's a few instructions per block of positions. */
+template <size_t F>
+static const char *
+prefilter_scalar(const memsearch_prefilter *pf, const char *h, size_t hlen)
+{
+    const unsigned char *u = (const unsigned char *)h;
+    for (size_t i = 0; i + F <= hlen; i++) {
+	unsigned char b = 0xff;
+	for (size_t k = 0; k < F; k++)
+	    b &= pf->lo[k][u[i + k] & 0x0f] & pf->hi[k][u[i + k] >> 4];
+	if (b)
+	    return h + i;
+    }
+    return NULL;
+}
+
+#ifdef MEMSEARCH_HAVE_X86
+template <size_t F>
+__attribute__((target("ssse3"))) static const char *
+prefilter_ssse3(const memsearch_prefilter *pf, const char *h, size_t hlen)
+{
+    const __m128i nib = _mm_set1_epi8(0x0f);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo[F], hi[F];
+    for (size_t k = 0; k < F; k++) {
+	lo[k] = _mm_loadu_si128((const __m128i *)pf->lo[k]);
+	hi[k] = _mm_loadu_si128((const __m128i *)pf->hi[k]);
+    }
+
+    /* Each block tests 16 start positions, reading up to h[i + F + 14] */
+    size_t i = 0;
+    for (; i + F + 15 <= hlen; i += 16) {
+	__m128i res = _mm_set1_epi8(-1);
+	for (size_t k = 0; k < F; k++) {
+	    __m128i v = _mm_loadu_si128((const __m128i *)(h + i + k));
+	    __m128i l = _mm_shuffle_epi8(lo[k], _mm_and_si128(v, nib));
+	    __m128i u = _mm_shuffle_epi8(hi[k], _mm_and_si128(_mm_srli_epi16(v, 4), nib));
+	    res = _mm_and_si128(res, _mm_and_si128(l, u));
+	}
+	unsigned int mask = ~(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(res, zero)) & 0xffff;
+	if (mask)
+	    return h + i + __builtin_ctz(mask);
+    }
+    return prefilter_scalar<F>(pf, h + i, hlen - i);
+}
+
+template <size_t F>
+__attribute__((target("avx2"))) static const char *
+prefilter_avx2(const memsearch_prefilter *pf, const char *h, size_t hlen)
+{
+    /* The shuffle looks up within each 128 bit lane, so both lanes get
+     * a copy of the tables */
+    const __m256i nib = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i lo[F], hi[F];
+    for (size_t k = 0; k < F; k++) {
+	lo[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)pf->lo[k]));
+	hi[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)pf->hi[k]));
+    }
+
+    /* Each block tests 32 start positions, reading up to h[i + F + 30] */
+    size_t i = 0;
+    for (; i + F + 31 <= hlen; i += 32) {
+	__m256i res = _mm256_set1_epi8(-1);
+	for (size_t k = 0; k < F; k++) {
+	    __m256i v = _mm256_loadu_si256((const __m256i *)(h + i + k));
+	    __m256i l = _mm256_shuffle_epi8(lo[k], _mm256_and_si256(v, nib));
+	    __m256i u = _mm256_shuffle_epi8(hi[k], _mm256_and_si256(_mm256_srli_epi16(v, 4), nib));
+	    res = _mm256_and_si256(res, _mm256_and_si256(l, u));
+	}
+	unsigned int mask = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(res, zero));
+	if (mask)
+	    return h + i + __builtin_ctz(mask);
+    }
+    return prefilter_ssse3<F>(pf, h + i, hlen - i);
+}
+#endif /* MEMSEARCH_HAVE_X86 */
+
+#if defined(MEMSEARCH_HAVE_NEON) && defined(__aarch64__)
+template <size_t F>
+static const char *
+prefilter_neon(const memsearch_prefilter *pf, const char *h, size_t hlen)
+{
+    const uint8x16_t nib = vdupq_n_u8(0x0f);
+    uint8x16_t lo[F], hi[F];
+    for (size_t k = 0; k < F; k++) {
+	lo[k] = vld1q_u8(pf->lo[k]);
+	hi[k] = vld1q_u8(pf->hi[k]);
+    }
+
+    size_t i = 0;
+    for (; i + F + 15 <= hlen; i += 16) {
+	uint8x16_t res = vdupq_n_u8(0xff);
+	for (size_t k = 0; k < F; k++) {
+	    uint8x16_t v = vld1q_u8((const uint8_t *)(h + i + k));
+	    uint8x16_t l = vqtbl1q_u8(lo[k], vandq_u8(v, nib));
+	    uint8x16_t u = vqtbl1q_u8(hi[k], vshrq_n_u8(v, 4));
+	    res = vandq_u8(res, vandq_u8(l, u));
+	}
+	/* As in search_neon, a nibble per position */
+	uint8x16_t hit = vtstq_u8(res, res);
+	uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+	if (mask)
+	    return h + i + (__builtin_ctzll(mask) >> 2);
+    }
+    return prefilter_scalar<F>(pf, h + i, hlen - i);
+}
+#endif
+
+#define MEMSEARCH_PREFILTER(K, flen)					\
+    do {								\
+	static constexpr memsearch_prefilter_func fixed[] = {		\
+	    K<1>, K<2>, K<3>						\
+	};								\
+	return fixed[flen - 1];						\
+    } while (0)
+
+/* The vectorized filter for the selected kernel's instruction set, if it
+ * has one */
+static memsearch_prefilter_func
+prefilter_kernel(size_t flen)
+{
+    memsearch_kernel_t k = memsearch_selected();
+#ifdef MEMSEARCH_HAVE_X86
+    __builtin_cpu_init();
+    if ((k == MEMSEARCH_AUTO || k == MEMSEARCH_AVX2) && __builtin_cpu_supports("avx2"))
+	MEMSEARCH_PREFILTER(prefilter_avx2, flen);
+    if ((k == MEMSEARCH_AUTO || k == MEMSEARCH_SSE2) && __builtin_cpu_supports("ssse3"))
+	MEMSEARCH_PREFILTER(prefilter_ssse3, flen);
+#endif
+#if defined(MEMSEARCH_HAVE_NEON) && defined(__aarch64__)
+    if (k == MEMSEARCH_AUTO || k == MEMSEARCH_NEON)
+	MEMSEARCH_PREFILTER(prefilter_neon, flen);
+#endif
+    (void)k;
+    (void)flen;
+    return NULL;
+}
+
+bool
+memsearch_prefilter_init(memsearch_prefilter *pf, const std::vector<std::string> &needles)
+{
+    memset(pf, 0, sizeof(*pf));
+
+    // Test as many leading bytes as every needle has, up to 3
+    size_t flen = 3;
+    std::vector<std::string> prefixes;
+    for (size_t i = 0; i < needles.size(); i++) {
+	if (needles[i].length())
+	    flen = std::min(flen, needles[i].length());
+    }
+    for (size_t i = 0; i < needles.size(); i++) {
+	if (needles[i].length())
+	    prefixes.push_back(needles[i].substr(0, flen));
+    }
+    if (!prefixes.size())
+	return false;
+    std::sort(prefixes.begin(), prefixes.end());
+    prefixes.erase(std::unique(prefixes.begin(), prefixes.end()), prefixes.end());
+
+    // Neighbouring prefixes share a bucket, as they are the likeliest to
+    // share nibbles too
+    for (size_t i = 0; i < prefixes.size(); i++) {
+	unsigned char bit = (unsigned char)(1 << (i * 8 / prefixes.size()));
+	for (size_t k = 0; k < flen; k++) {
+	    unsigned char c = (unsigned char)prefixes[i][k];
+	    pf->lo[k][c & 0x0f] |= bit;
+	    pf->hi[k][c >> 4] |= bit;
+	}
+    }
+
+    // With too many prefixes the tables pass most positions, and the
+    // filter would cost more than it saves.  Estimate the fraction of
+    // random positions that get through.
+    double pass = 0.0;
+    for (int b = 0; b < 8; b++) {
+	double p = 1.0;
+	for (size_t k = 0; k < flen; k++) {
+	    int lcnt = 0, hcnt = 0;
+	    for (int n = 0; n < 16; n++) {
+		lcnt += (pf->lo[k][n] >> b) & 1;
+		hcnt += (pf->hi[k][n] >> b) & 1;
+	    }
+	    p *= (lcnt / 16.0) * (hcnt / 16.0);
+	}
+	pass += p;
+    }
+    pf->next = (pass < 0.02) ? prefilter_kernel(flen) : NULL;
+    if (!pf->next)
+	return false;
+    pf->flen = flen;
+    return true;
+}
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
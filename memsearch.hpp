@@ -0,0 +1,143 @@
+/*                  M E M S E A R C H . H P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file memsearch.hpp
+ *
+ * Length bounded substring search kernels.
+ *
+ * All kernels share one signature and return a pointer to the first
+ * occurrence of the needle in the haystack, or NULL.  Unlike strstr none of
+ * them (except the strnstr wrapper, kept for comparison) treat a NUL byte in
+ * the haystack as the end of the data.
+ *
+ * The default kernel is picked at runtime from what the CPU supports -
+ * AVX2 or SSE2 on x86, NEON on ARM, otherwise a portable memchr/memcmp
+ * loop - and can be overridden by name for testing and benchmarking.
+ * Each can also be had specialized for a given needle length, which is
+ * what the compiled pattern sets use.
+ */
+
+#ifndef MEMSEARCH_HPP
+#define MEMSEARCH_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+typedef const char *(*memsearch_func)(const char *h, size_t hlen, const char *n, size_t nlen);
+
+/* Kernels, in order of preference.  Not all are available on all builds
+ * or all CPUs - see memsearch_kernel(). */
+enum memsearch_kernel_t {
+    MEMSEARCH_AUTO = 0,
+    MEMSEARCH_STD,          /**< std::search */
+    MEMSEARCH_STRNSTR,      /**< strnstr.c (stops at NUL, needle must be NUL terminated) */
+    MEMSEARCH_SCALAR,       /**< memchr on the first byte + memcmp */
+    MEMSEARCH_SSE2,         /**< 16 byte first/last byte broadcast compare */
+    MEMSEARCH_AVX2,         /**< 32 byte first/last byte broadcast compare */
+    MEMSEARCH_NEON,         /**< 16 byte first/last byte broadcast compare */
+    MEMSEARCH_KERNEL_CNT
+};
+
+/* Return the kernel implementation, or NULL if it isn't supported here.
+ * MEMSEARCH_AUTO gives the best supported kernel. */
+memsearch_func memsearch_kernel(memsearch_kernel_t k);
+
+/* The kernel specialized for needles of exactly nlen bytes, comparing
+ * candidates with a few word loads sized for that length instead of a
+ * memcmp call.  The result must only be used with needles of that length.
+ * Kernels without specializations (std, strnstr) are returned as they
+ * are, and NULL if the kernel isn't supported here. */
+memsearch_func memsearch_kernel_for(memsearch_kernel_t k, size_t nlen);
+
+/* Name of the kernel, as accepted by memsearch_select() */
+const char *memsearch_name(memsearch_kernel_t k);
+
+/* Set the kernel used by memsearch() by name ("auto", "std", "strnstr",
+ * "scalar", "sse2", "avx2" or "neon").  Returns false if the name is
+ * unknown or the kernel isn't supported on this host.  Not thread safe -
+ * select before starting any workers. */
+bool memsearch_select(const char *name);
+
+/* Currently selected kernel */
+memsearch_kernel_t memsearch_selected();
+
+/* Search with the currently selected kernel */
+const char *memsearch(const char *h, size_t hlen, const char *n, size_t nlen);
+
+/* Return a pointer to the first byte in buf that can't appear in a plain
+ * ASCII text file (a NUL or anything with the high bit set), or NULL if
+ * there is none.  Vectorized the same way as the search kernels. */
+const char *memfind_nontext(const char *buf, size_t buflen);
+
+/* Prefilter for searching many needles at once.  It finds the positions
+ * where the first few bytes (up to 3, as many as the shortest needle has)
+ * could start one of the needles, testing a vector's worth of positions at
+ * a time with nibble lookup tables (the "Teddy" scheme).  A candidate only
+ * might start a needle - the caller still has to look - but no position
+ * that isn't a candidate does, so for the usual case of data holding none
+ * of them the needles never have to be looked for at all. */
+struct memsearch_prefilter;
+typedef const char *(*memsearch_prefilter_func)(const memsearch_prefilter *pf, const char *h, size_t hlen);
+struct memsearch_prefilter {
+    size_t flen;                  /**< leading bytes of each needle tested (0 if no filter) */
+    unsigned char lo[3][16];      /**< per byte, the buckets holding a prefix with this low nibble */
+    unsigned char hi[3][16];      /**< per byte, the buckets holding a prefix with this high nibble */
+    memsearch_prefilter_func next;
+};
+
+/* Set up pf for needles (empty ones being ignored), vectorized with the
+ * selected kernel's instruction set.  Returns false, leaving flen 0, if
+ * there's no vector filter for the kernel or the needles have too many
+ * different prefixes for it to reject enough positions. */
+bool memsearch_prefilter_init(memsearch_prefilter *pf, const std::vector<std::string> &needles);
+
+/* The first candidate in h (no closer than flen bytes to the end), or
+ * NULL if there is none */
+inline const char *
+memsearch_prefilter_next(const memsearch_prefilter *pf, const char *h, size_t hlen)
+{
+    return pf->next(pf, h, hlen);
+}
+
+#endif /* MEMSEARCH_HPP */
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
@@ -40,145 +40,300 @@
  * string in the binary with null chars.
  *
  * Given a text file, a target string and a replacement string, replace all
- * instances of the target string with the replacement string.
- * TODO: For the moment, the replacement string can't contain the target string.
+ * instances of the target string with the replacement string.  Instances are
+ * replaced in a single left to right pass (replacements are not rescanned).
+ * Any number of target=replacement pairs (--pair, --pairs-file) can be
+ * applied in that same single pass.  Files whose replacements are all the
+ * same length as their targets (or padded out to it with --pad) are
+ * patched in place, which is faster but not atomic; any others are
+ * rewritten to a temporary file that then replaces the original.
+ *
+ * With --binary-replace, replace mode rewrites binaries as well, in place,
+ * as long as no replacement is longer than its target: each replacement is
+ * either padded out to its target's length or has the rest of the NUL
+ * terminated string it is in shifted up behind it (so an embedded path can
+ * be given a shorter prefix and keep its tail), the string NUL padded.
+ *
+ * A third, read-only mode (--scan) just reports where the strings are.
+ *
+ * Any mode can also be run in batch over many files (listed with -f,
+ * read from @listfile lists, or read NUL separated from stdin with -0) so
+ * the options and strings are only parsed once for a whole install tree, or
+ * walk whole directory trees itself with -R.  Walked files are handed to
+ * the workers as their directories are listed, so work on a large tree
+ * starts before the walk has finished.
+ *
+ * Files larger than --chunk-size are cleared or scanned through a sliding
+ * window rather than mapped whole, so memory use stays bounded for images
+ * larger than RAM (or, on 32 bit hosts, than the address space).
+ *
+ * With --archives, tar, gzipped tar and zip files have the strings in
+ * their members cleared, streaming the archive through decompression,
+ * clearing and recompression without extracting it.
+ *
+ * With --io-uring, batches of small files are loaded and written back
+ * through io_uring, so the per-file system calls are batched across many
+ * files in flight rather than each costing a worker a round trip.
+ *
+ * With --sections, object files are parsed and only their string holding
+ * sections are touched, leaving code (which may happen to contain the
+ * target bytes) alone.
+ *
+ * With --serve, strclear stays running on a Unix domain socket and runs
+ * the command lines sent with --client itself, keeping the compiled
+ * strings and clean caches warm between them - for build systems that run
+ * it from many separate steps.  Only the server's own user can connect.
  */
 
 #include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
-#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
 #include <vector>
-#include "cxxopts.hpp"
-#include "MappedFile.hpp"
-
-extern "C" char *
-strnstr(const char *h, const char *n, size_t hlen);
 
+// File names may legitimately contain commas, so don't let cxxopts split
+// repeated -f values on them.
+#define CXXOPTS_VECTOR_DELIMITER '\0'
+#include "cxxopts.hpp"
+#include "libstrclear.hpp"
+#include "AtomicFile.hpp"
+#include "CleanCache.hpp"
+#include "DirWalker.hpp"
+#include "Server.hpp"
+#include "Stats.hpp"
+#include "UringIO.hpp"
+#include "WorkerPool.hpp"
+#include "memsearch.hpp"
+
+
+// Expand the batch file sources (other than -R walks) into a single list of
+// file names.  Entries
+// of the form @listfile are replaced by the newline separated names in
+// listfile, and if requested a NUL separated list is read from stdin.
 int
-process_binary(std::string &fname, std::vector<std::string> &target_strs, char clear_char, bool verbose)
+collect_files(std::vector<std::string> &files, std::vector<std::string> &file_args, bool stdin_files, std::ostream &err)
 {
-    // Read binary contents
-    std::ifstream input_fs;
-    input_fs.open(fname, std::ios::binary);
-    if (!input_fs.is_open()) {
-	std::cerr << "Unable to open file " << fname << "\n";
-	return -1;
-    }
-    std::vector<char> bin_contents(std::istreambuf_iterator<char>(input_fs), {});
-    input_fs.close();
-
-    // Set up vectors of target and array of null chars
-    int grcnt = 0;
-    for (size_t i = 0; i < target_strs.size(); i++) {
-	std::vector<char> search_chars(target_strs[i].begin(), target_strs[i].end());
-	std::vector<char> null_chars;
-	for (size_t j = 0; j < search_chars.size(); j++)
-	    null_chars.push_back(clear_char);
-
-	// Find instances of target string in binary, and replace any we find
-	auto position = std::search(bin_contents.begin(), bin_contents.end(), search_chars.begin(), search_chars.end());
-	int rcnt = 0;
-	while (position != bin_contents.end()) {
-	    std::copy(null_chars.begin(), null_chars.end(), position);
-	    rcnt++;
-	    if (verbose && rcnt == 1)
-		std::cout << fname << ":\n";
-	    if (verbose) {
-		std::string cchar(1, clear_char);
-		if (clear_char == '\0')
-		    cchar = std::string("\\0");
-		std::cout << "\tclearing instance #" << rcnt << " of " << target_strs[i] << " with the '" << cchar << "' char\n";
-	    }
-	    position = std::search(position, bin_contents.end(), search_chars.begin(), search_chars.end());
+    for (size_t i = 0; i < file_args.size(); i++) {
+	if (file_args[i].length() < 2 || file_args[i][0] != '@') {
+	    files.push_back(file_args[i]);
+	    continue;
+	}
+	std::string lname = file_args[i].substr(1);
+	std::ifstream list_fs(lname);
+	if (!list_fs.is_open()) {
+	    err << "Unable to open file list " << lname << "\n";
+	    return -1;
+	}
+	std::string line;
+	while (std::getline(list_fs, line)) {
+	    if (line.length() && line[line.length() - 1] == '\r')
+		line.pop_back();
+	    if (line.length())
+		files.push_back(line);
 	}
-	grcnt += rcnt;
-    }
-    if (!grcnt)
-	return 0;
-
-    // If we changed the contents, write them back out
-    std::ofstream output_fs;
-    output_fs.open(fname, std::ios::binary);
-    if (!output_fs.is_open()) {
-	std::cerr << "Unable to write updated file contents for " << fname << "\n";
-	return -1;
     }
 
-    std::copy(bin_contents.begin(), bin_contents.end(), std::ostreambuf_iterator<char>(output_fs));
-    output_fs.close();
+    if (stdin_files) {
+	std::string entry;
+	while (std::getline(std::cin, entry, '\0')) {
+	    if (entry.length())
+		files.push_back(entry);
+	}
+    }
 
     return 0;
 }
 
-int
-process_text(std::string &fname, std::string &target_str, std::string &replace_str, bool verbose)
+// Split replace mode pairs of the form target=replacement (at the first
+// '=') from --pair arguments and, if set, the newline separated pairs in
+// pairs_file, in that order.
+static int
+collect_pairs(std::vector<std::string> &targets, std::vector<std::string> &replacements, const std::vector<std::string> &pair_args, const std::string &pairs_file, std::ostream &err)
 {
-    // Make sure the replacement doesn't contain the target.  If we need that
-    // we'll have to be more sophisticated about the replacement logic, but
-    // for now just be simple
-    auto loop_check = std::search(replace_str.begin(), replace_str.end(), target_str.begin(), target_str.end());
-    if (loop_check != replace_str.end()) {
-	std::cerr << "Replacement string \"" << replace_str << "\" contains target string \"" << target_str << "\" - unsupported.\n";
-	return -1;
+    std::vector<std::string> pairs = pair_args;
+    if (pairs_file.length()) {
+	std::ifstream pairs_fs(pairs_file);
+	if (!pairs_fs.is_open()) {
+	    err << "Unable to open pairs file " << pairs_file << "\n";
+	    return -1;
+	}
+	std::string line;
+	while (std::getline(pairs_fs, line)) {
+	    if (line.length() && line[line.length() - 1] == '\r')
+		line.pop_back();
+	    if (line.length())
+		pairs.push_back(line);
+	}
     }
 
-    // See if the target string is present
-    MappedFile *mf = new MappedFile(fname.c_str());
-    bool process = true;
-    if (mf && mf->buf && !strnstr((const char *)mf->buf, target_str.c_str(), mf->buflen))
-	process = false;
-    delete mf;
-    if (!process)
-	return 0;
-
-    std::ifstream input_fs(fname);
-    std::stringstream fbuffer;
-    fbuffer << input_fs.rdbuf();
-    std::string nfile_contents = fbuffer.str();
-    input_fs.close();
-    if (!nfile_contents.length())
-	return 0;
-    auto position = std::search(nfile_contents.begin(), nfile_contents.end(), target_str.begin(), target_str.end());
-    if (position == nfile_contents.end())
-	return 0;
-    int rcnt = 0;
-    while (position != nfile_contents.end()) {
-	nfile_contents.replace(nfile_contents.find(target_str), target_str.size(), replace_str);
-	rcnt++;
-	if (verbose && rcnt == 1)
-	    std::cout << fname << ":\n";
-	if (verbose)
-	    std::cout << "\treplacing instance #" << rcnt << " of " << target_str << " with " << replace_str << "\n";
-	position = std::search(nfile_contents.begin(), nfile_contents.end(), target_str.begin(), target_str.end());
+    for (size_t i = 0; i < pairs.size(); i++) {
+	size_t eq = pairs[i].find('=');
+	if (eq == std::string::npos || !eq) {
+	    err << "Error:  invalid replacement pair \"" << pairs[i] << "\" (expected target=replacement)\n";
+	    return -1;
+	}
+	targets.push_back(pairs[i].substr(0, eq));
+	replacements.push_back(pairs[i].substr(eq + 1));
     }
-    if (!rcnt)
-	return 0;
-
-    // If we changed the contents, write them back out
-    std::ofstream output_fs;
-    output_fs.open(fname, std::ios::trunc);
-    if (!output_fs.is_open()) {
-	std::cerr << "Unable to write updated file contents for " << fname << "\n";
+    return 0;
+}
+
+// Parse a byte count with an optional K, M or G (binary multiple) suffix
+static int
+parse_size(const std::string &str, size_t &size)
+{
+    char *end = NULL;
+    errno = 0;
+    unsigned long long val = strtoull(str.c_str(), &end, 10);
+    if (errno || end == str.c_str() || str[0] == '-')
 	return -1;
+    unsigned long long mult = 1;
+    if (*end) {
+	switch (*end) {
+	    case 'k':
+	    case 'K':
+		mult = 1024ULL;
+		break;
+	    case 'm':
+	    case 'M':
+		mult = 1024ULL * 1024;
+		break;
+	    case 'g':
+	    case 'G':
+		mult = 1024ULL * 1024 * 1024;
+		break;
+	    default:
+		return -1;
+	}
+	if (*(end + 1))
+	    return -1;
     }
-    output_fs << nfile_contents;
-    output_fs.close();
+    if (val > (unsigned long long)((size_t)-1) / mult)
+	return -1;
+    size = (size_t)(val * mult);
     return 0;
 }
 
-int
-main(int argc, const char *argv[])
+// Files the io_uring loader reads in whole - anything bigger is better
+// off mapped (or chunked) by the usual path
+#define URING_MAX_FILE (1024 * 1024)
+
+// Clear or scan a file the io_uring loader has read in, writing it back
+// through the ring if anything was cleared.  A file that can't be
+// written in place (being read-only, or a running executable) is
+// rewritten through AtomicFile, as process_binary would.
+static int
+process_loaded(std::ostream &out, std::ostream &err, const std::string &fname, UringIO &uring, UringIO::file &lf, const PatternSet &ps, const strclear_settings &s, bool scan_mode, bool json, bool first_match, file_stats &fst)
+{
+    fst.bytes_read += lf.data.size();
+    fst.peak_buffer = lf.data.size();
+    if (scan_mode)
+	return scan_loaded(out, fname, lf.data.data(), lf.data.size(), ps, json, first_match, s.sections, fst);
+
+    int grcnt = clear_loaded(out, fname, lf.data.data(), lf.data.size(), ps, s.verbose, s.sections, fst);
+    if (grcnt <= 0)
+	return grcnt;
+
+    phase_timer wt(&fst.write_time);
+    if (uring.write_back(lf, s.sync)) {
+	AtomicFile af(fname.c_str(), s.sync);
+	if (!af.write(lf.data.data(), lf.data.size()) || !af.commit()) {
+	    err << "Unable to write updated file contents for " << fname << ": " << af.error() << "\n";
+	    return -1;
+	}
+    }
+    fst.bytes_written += lf.data.size();
+    return grcnt;
+}
+
+// What a --serve daemon keeps warm between requests: the pattern sets
+// compiled for recent requests, and the clean caches - one per cache file
+// named, plus one held in memory for the requests that don't name one.
+#define SERVE_MAX_SETS 32
+struct serve_state {
+    std::map<std::string, std::shared_ptr<PatternSet>> sets;
+    std::deque<std::string> set_lru;  /**< keys of sets, most recently used last */
+    std::map<std::string, std::unique_ptr<CleanCache>> caches;
+};
+
+// The compiled set for these strings, from the server's warm sets if a
+// request has compiled it already
+static std::shared_ptr<PatternSet>
+compile_set(serve_state *state, const std::vector<std::string> &targets, const std::vector<std::string> &replacements, char clear_char)
 {
-    bool binary_mode = false;
+    std::string key;
+    if (state) {
+	// The search kernel is resolved when the set is compiled
+	std::ostringstream kss;
+	kss << memsearch_name(memsearch_selected()) << ":" << (int)clear_char << ":" << targets.size();
+	for (size_t i = 0; i < targets.size(); i++)
+	    kss << ":" << targets[i].length() << ":" << targets[i];
+	for (size_t i = 0; i < replacements.size(); i++)
+	    kss << ":" << replacements[i].length() << ":" << replacements[i];
+	key = kss.str();
+	std::deque<std::string>::iterator it = std::find(state->set_lru.begin(), state->set_lru.end(), key);
+	if (it != state->set_lru.end()) {
+	    state->set_lru.erase(it);
+	    state->set_lru.push_back(key);
+	    return state->sets[key];
+	}
+    }
+
+    std::shared_ptr<PatternSet> ps = std::make_shared<PatternSet>(targets, clear_char);
+    ps->replacements = replacements;
+    if (state) {
+	if (state->set_lru.size() >= SERVE_MAX_SETS) {
+	    state->sets.erase(state->set_lru.front());
+	    state->set_lru.pop_front();
+	}
+	state->sets[key] = ps;
+	state->set_lru.push_back(key);
+    }
+    return ps;
+}
+
+// Run a strclear command line, reporting to sout and serr.  state is set
+// when a --serve daemon is running it for a client.
+static int
+strclear_main(int argc, const char *argv[], std::ostream &sout, std::ostream &serr, serve_state *state)
+{
+    strclear_settings s;
     bool binary_test_mode = false;
     bool clear_mode = false;
-    char clear_char = '\0';
-    bool swap_mode = false;
+    bool scan_mode = false;
+    bool json = false;
+    bool first_match = false;
     bool text_mode = false;
-    bool verbose = false;
+    bool stdin_files = false;
+    bool use_uring = false;
+    size_t nthreads = 1;
+    std::string search_kernel;
+    std::string chunk_arg;
+    std::string split_arg;
+    char pad_char = ' ';
+    bool pad = false;
+    std::string rewrite_arg;
+    std::string serve_socket;
+    std::string client_socket;
+    std::string stats_fmt;
+    std::string cache_file;
+    std::string pairs_file;
+    std::vector<std::string> pair_args;
+    std::vector<std::string> file_args;
+    std::vector<std::string> walk_roots;
+    std::vector<std::string> includes;
+    std::vector<std::string> excludes;
 
     cxxopts::Options options(argv[0], "A program to clear or replace strings in files\n");
 
@@ -192,98 +347,538 @@ main(int argc, const char *argv[])
 	    .set_width(70)
 	    .add_options()
 	    ("B,is_binary","Test the file to see if it is a binary file.)", cxxopts::value<bool>(binary_test_mode))
-	    ("b,binary",   "Treat the input file as binary.  (Note that only string clearing is supported with binary files.)", cxxopts::value<bool>(binary_mode))
+	    ("b,binary",   "Treat the input file as binary.  (Note that only string clearing is supported with binary files, unless --binary-replace is given.)", cxxopts::value<bool>(s.binary_mode))
 	    ("c,clear",    "Replace strings in files by overwriting a specified character (defaults to NULL)", cxxopts::value<bool>(clear_mode))
-	    ("clear_char", "Specify a character to use when clearing strings in files", cxxopts::value<char>(clear_char))
-	    ("r,replace",  "Replace one string with another (text mode only).", cxxopts::value<bool>(swap_mode))
+	    ("clear_char", "Specify a character to use when clearing strings in files", cxxopts::value<char>(s.clear_char))
+	    ("r,replace",  "Replace one string with another (text mode only, unless --binary-replace is given).", cxxopts::value<bool>(s.swap_mode))
+	    ("pair",       "With -r, replace the target with the replacement in a target=replacement pair (may be repeated).  All pairs are applied in a single pass, the longest target winning where several match at the same place.", cxxopts::value<std::vector<std::string>>(pair_args))
+	    ("pairs-file", "With -r, read newline separated target=replacement pairs from this file (as with --pair)", cxxopts::value<std::string>(pairs_file))
+	    ("pad",        "Pad a replacement shorter than its target out to the target's length with this character, so the file can be patched in place.  (Patching in place is not atomic - a crash part way through can leave some instances replaced and others not.)", cxxopts::value<char>(pad_char))
+	    ("binary-replace", "With -r, also replace strings in binary files, in place.  Each replacement must be no longer than its target, and is either padded out to the target's length (pad - with NULs, or the --pad character) or followed by the rest of the NUL terminated string it is in, shifted up, with the string NUL padded at its end (shift).", cxxopts::value<std::string>(rewrite_arg))
+	    ("scan",       "Report the location of each string in the file(s) without changing anything.  Returns success (0) if any were found.", cxxopts::value<bool>(scan_mode))
+	    ("json",       "Report scan results as JSON Lines", cxxopts::value<bool>(json))
+	    ("first-match","Stop scanning each file at the first string found", cxxopts::value<bool>(first_match))
+	    ("sections",   "For ELF, Mach-O and PE files, only clear or scan the sections that hold string data (string tables, read-only data, debug strings and line tables) and report which section each string was found in.  Code sections are left untouched.", cxxopts::value<bool>(s.sections))
+	    ("archives",   "Clear the strings inside the members of tar, gzipped tar and zip archives (rewriting the archive), rather than in the archive file itself", cxxopts::value<bool>(s.archives))
 	    ("t,text",     "Refuse to run unless the input file is a text file.", cxxopts::value<bool>(text_mode))
-	    ("v,verbose",  "Verbose reporting during processing", cxxopts::value<bool>(verbose))
+	    ("v,verbose",  "Verbose reporting during processing", cxxopts::value<bool>(s.verbose))
+	    ("fsync",      "Flush changed files to disk - files patched in place once each is done, rewritten ones before moving them into place", cxxopts::value<bool>(s.sync))
+	    ("stats",      "Report per-file and total time spent in each processing phase, I/O volumes and page fault and context switch counts on stderr.  --stats=json reports them as JSON Lines.", cxxopts::value<std::string>(stats_fmt)->implicit_value("text"))
+	    ("cache",      "Record files found to contain none of the strings in this cache file, and skip them on later runs (with the same strings and options) if they haven't changed", cxxopts::value<std::string>(cache_file))
+	    ("classify-bytes", "Only check the first N bytes of a file when deciding if it is binary (0 checks the whole file)", cxxopts::value<size_t>(s.classify_bytes))
+	    ("f,file",     "Process the specified file (may be repeated).  @listfile reads newline separated file names from listfile.  When files are specified this way, all non-option arguments are strings.", cxxopts::value<std::vector<std::string>>(file_args))
+	    ("R,recursive","Process every regular file below the specified directory (may be repeated).  Symbolic links are skipped, as are extra hard links to files already seen.", cxxopts::value<std::vector<std::string>>(walk_roots))
+	    ("include",    "With -R, only process files matching this glob (may be repeated)", cxxopts::value<std::vector<std::string>>(includes))
+	    ("exclude",    "With -R, skip files and directories matching this glob (may be repeated)", cxxopts::value<std::vector<std::string>>(excludes))
+	    ("j,jobs",     "Number of worker threads to use in batch mode (0 uses all available cores)", cxxopts::value<size_t>(nthreads))
+	    ("chunk-size", "Process files larger than this many bytes (K, M or G suffixes accepted) a window at a time instead of mapping them whole.  0 disables chunking, which is the default on 64 bit systems.", cxxopts::value<std::string>(chunk_arg))
+	    ("split-size", "Search files larger than this many bytes (K, M or G suffixes accepted, default 64M) as -j segments in parallel, so a single huge file isn't left to one core.  0 disables splitting.", cxxopts::value<std::string>(split_arg))
+	    ("search",     "Substring search kernel to use (auto, std, strnstr, scalar, sse2, avx2 or neon)", cxxopts::value<std::string>(search_kernel))
+	    ("io-uring",   "In batch mode, open, read and write files of up to 1M through io_uring (on Linux), many at a time, while the workers search the ones already read.  Falls back to the worker pool alone where io_uring isn't available.", cxxopts::value<bool>(use_uring))
+	    ("0,null",     "Read a NUL separated list of files to process from stdin (batch mode, as with -f)", cxxopts::value<bool>(stdin_files))
+	    ("serve",      "Run as a server on this Unix domain socket, running the requests --client sends it with the compiled strings and clean caches of earlier requests kept in memory.  Requests not given a --cache file share one held in memory.  The socket is owner-only, and requests from other users are refused.  Stops on SIGINT or SIGTERM.", cxxopts::value<std::string>(serve_socket))
+	    ("client",     "Have the server on this socket run the rest of the command line, instead of running it here.  If no server is listening (or with -0, whose list is read here) the command is run here as usual.", cxxopts::value<std::string>(client_socket))
 	    ("h,help",     "Print help")
 	    ;
 	auto result = options.parse(argc, argv);
 
 	nonopts = result.unmatched();
+	pad = (result.count("pad") > 0);
 
 	if (result.count("help")) {
-	    std::cout << options.help({""}) << std::endl;
+	    sout << options.help({""}) << std::endl;
 	    return 0;
 	}
 
-	if (binary_mode && text_mode) {
-	    std::cerr << "Error:  need to specify either binary or text mode, not both\n";
+	if (state && (serve_socket.length() || client_socket.length())) {
+	    serr << "Error:  --serve and --client can't be sent to a server\n";
+	    return -1;
+	}
+
+	// (A --client command line that gets this far is being run here,
+	// main() having found no server to send it to)
+	if (serve_socket.length() && client_socket.length()) {
+	    serr << "Error:  need to specify either --serve or --client, not both\n";
+	    return -1;
+	}
+
+	if (serve_socket.length()) {
+	    serve_state st;
+	    return serve(serve_socket, [&st](const std::vector<std::string> &args, std::ostream &out, std::ostream &err) {
+		std::vector<const char *> av(1, "strclear");
+		for (size_t i = 0; i < args.size(); i++)
+		    av.push_back(args[i].c_str());
+		return strclear_main((int)av.size(), av.data(), out, err, &st);
+	    }, serr);
+	}
+
+	if (s.binary_mode && text_mode) {
+	    serr << "Error:  need to specify either binary or text mode, not both\n";
+	    return -1;
+	}
+
+	if (!clear_mode && !s.swap_mode && !binary_test_mode && !scan_mode) {
+	    serr << "Error:  need to specify either clear mode (-c), replace mode (-r), scan mode (--scan) or binary file test mode (-B)\n";
+	    return -1;
+	}
+
+	if (scan_mode && (clear_mode || s.swap_mode)) {
+	    serr << "Error:  scan mode doesn't modify files - can't combine it with clear or replace mode\n";
+	    return -1;
+	}
+
+	if (s.archives && (scan_mode || s.swap_mode)) {
+	    serr << "Error:  archive members can only be cleared - --archives can't be combined with scan or replace mode\n";
+	    return -1;
+	}
+
+	if (clear_mode && s.swap_mode) {
+	    serr << "Error:  need to specify either clear or replace mode, not both\n";
+	    return -1;
+	}
+
+	if (rewrite_arg.length()) {
+	    if (rewrite_arg == "pad") {
+		s.binary_rewrite = STRCLEAR_REWRITE_PAD;
+	    } else if (rewrite_arg == "shift") {
+		s.binary_rewrite = STRCLEAR_REWRITE_SHIFT;
+	    } else {
+		serr << "Error:  unknown binary replace mode \"" << rewrite_arg << "\" (expected pad or shift)\n";
+		return -1;
+	    }
+	    if (!s.swap_mode) {
+		serr << "Error:  --binary-replace given, but replace mode (-r) not indicated\n";
+		return -1;
+	    }
+	    // Padded replacements leave nothing to shift
+	    if (s.binary_rewrite == STRCLEAR_REWRITE_SHIFT && pad) {
+		serr << "Error:  --pad can't be combined with --binary-replace shift\n";
+		return -1;
+	    }
+	    if (pad)
+		s.rewrite_pad = pad_char;
+	}
+
+	// 32 bit hosts can't map large files whole, so default to chunking
+	// anything too big to comfortably fit in the address space
+	if (sizeof(void *) < 8)
+	    s.chunk_size = 64 * 1024 * 1024;
+	if (chunk_arg.length() && parse_size(chunk_arg, s.chunk_size) < 0) {
+	    serr << "Error:  invalid chunk size \"" << chunk_arg << "\"\n";
 	    return -1;
 	}
 
-	if (!clear_mode && !swap_mode && !binary_test_mode) {
-	    std::cerr << "Error:  need to specify either clear mode (-c), replace mode (-r), or binary file test mode (-B)\n";
+	size_t split_size = 64 * 1024 * 1024;
+	if (split_arg.length() && parse_size(split_arg, split_size) < 0) {
+	    serr << "Error:  invalid split size \"" << split_arg << "\"\n";
 	    return -1;
 	}
+	strclear_set_split(split_size, nthreads);
 
-	if (clear_mode && swap_mode) {
-	    std::cerr << "Error:  need to specify either clear or replace mode, not both\n";
+	if (stats_fmt.length() && stats_fmt != "text" && stats_fmt != "json") {
+	    serr << "Error:  unknown stats format \"" << stats_fmt << "\" (expected text or json)\n";
+	    return -1;
+	}
+
+	// A server's kernel would otherwise stay as the last request set it
+	if ((search_kernel.length() || state) && !memsearch_select((search_kernel.length()) ? search_kernel.c_str() : "auto")) {
+	    serr << "Error:  search kernel \"" << search_kernel << "\" is unknown or not supported on this system\n";
 	    return -1;
 	}
     }
     catch (const cxxopts::exceptions::exception& e)
     {
-	std::cerr << "error parsing options: " << e.what() << std::endl;
+	serr << "error parsing options: " << e.what() << std::endl;
 	return -1;
     }
 
-    // Unless the goal is strictly to test file type, we need at least two args
-    if (nonopts.size() < 2 && !binary_test_mode) {
-	std::cout << options.help({""}) << std::endl;
+    // Replacement pairs take the place of the string arguments
+    bool have_pairs = (pair_args.size() || pairs_file.length());
+    if (have_pairs && !s.swap_mode) {
+	serr << "Error:  replacement pairs given, but replace mode (-r) not indicated\n";
+	return -1;
+    }
+
+    // In batch mode all non-option arguments are strings - otherwise the
+    // first one is the file to process
+    bool batch_mode = (file_args.size() || stdin_files || walk_roots.size());
+    size_t min_args = (batch_mode) ? 1 : 2;
+    if (have_pairs)
+	min_args--;
+
+    // Unless the goal is strictly to test file type, we need at least a
+    // file and a string
+    if ((nonopts.size() < min_args && !binary_test_mode) || (!batch_mode && !nonopts.size())) {
+	sout << options.help({""}) << std::endl;
 	return -1;
     }
 
     // If we only have a filename and a single string, the only thing we can
     // do is treat the file as binary and replace the string
-    if (nonopts.size() == 2 && swap_mode) {
-	std::cerr << "Error:  string replacement mode indicated, but no replacement specified\n";
+    if (nonopts.size() == min_args && s.swap_mode && !have_pairs) {
+	serr << "Error:  string replacement mode indicated, but no replacement specified\n";
 	return -1;
     }
 
-    std::string fname(nonopts[0]);
-
-    // Determine if the file is a binary or text file, if we've not been told
-    // to treat it as binary explicitly with -b.  If we've been told text mode
-    // we still check to make sure we really have a text file before processing.
-    if (!binary_mode) {
-	// TODO - can we do this faster?
-	std::ifstream check_fs;
-	check_fs.open(fname);
-	int c;
-	while ((c = check_fs.get()) != EOF && c < 128);
-	binary_mode = (c == EOF) ? false : true;
-	check_fs.close();
+    if (s.swap_mode && nonopts.size() > min_args + ((have_pairs) ? 0 : 1)) {
+	if (have_pairs)
+	    serr << "Error:  target and replacement strings can't be given both as arguments and as pairs\n";
+	else
+	    serr << "Error:  replacing string in text file - need file, target string and replacement string as arguments.\n";
+	return -1;
     }
 
+    double run_time = 0.0;
+    phase_timer run_timer(&run_time);
+    // A -R walk is normally streamed to the workers, so they can start
+    // on the first files while a big tree is still being listed.  The
+    // binary test and the io_uring path need the whole list up front, so
+    // for those the walk is finished (and sorted) first.
+    std::vector<std::string> files;
+    DirWalker walker(nthreads);
+    walker.includes = includes;
+    walker.excludes = excludes;
+    bool uring_batch = (use_uring && batch_mode && !s.swap_mode && !s.archives);
+    bool stream_walk = (walk_roots.size() && !binary_test_mode && !uring_batch);
+    if (batch_mode) {
+	if (collect_files(files, file_args, stdin_files, serr) < 0)
+	    return -1;
+	if (stream_walk) {
+	    if (walker.check(walk_roots, serr) < 0)
+		return -1;
+	} else if (walk_roots.size()) {
+	    if (walker.walk(walk_roots, files, serr) < 0)
+		return -1;
+	}
+    } else {
+	files.push_back(nonopts[0]);
+	nonopts.erase(nonopts.begin());
+    }
+
+    WorkerPool pool(nthreads);
+
     // If all we're supposed to do is determine the type, return success (0) if
-    // the file is binary, else 1
-    if (binary_test_mode)
-	return (binary_mode) ? 0 : 1;
+    // the file is binary, else 1.  In batch mode, list the binary files and
+    // return success if we found any.
+    if (binary_test_mode) {
+	std::vector<char> binary_files(files.size(), s.binary_mode);
+	if (!s.binary_mode) {
+	    pool.run(files.size(), [&](size_t i, size_t) {
+		binary_files[i] = is_binary(files[i], s.classify_bytes);
+	    });
+	}
+	bool have_binary = false;
+	for (size_t i = 0; i < files.size(); i++) {
+	    if (!binary_files[i])
+		continue;
+	    have_binary = true;
+	    if (batch_mode)
+		sout << files[i] << "\n";
+	}
+	return (have_binary) ? 0 : 1;
+    }
 
-    if (binary_mode && swap_mode) {
-	std::cerr << "Error:  string replacement indicated, but file is binary\n";
-	return -1;
+    // Compile the strings once for the whole run - the workers share the
+    // set read-only.  In replace mode there is either one target, with the
+    // second string replacing it, or a list of pairs.  Padding replacements
+    // out to their targets' lengths keeps the file length unchanged, which
+    // lets process_text patch the file in place.
+    std::vector<std::string> targets = nonopts;
+    std::vector<std::string> replacements;
+    if (have_pairs) {
+	targets.clear();
+	if (collect_pairs(targets, replacements, pair_args, pairs_file, serr) < 0)
+	    return -1;
+    } else if (s.swap_mode) {
+	targets.resize(1);
+	replacements.push_back(nonopts[1]);
+    }
+    for (size_t i = 0; i < replacements.size(); i++) {
+	std::string &replace_str = replacements[i];
+	if (pad && replace_str.length() < targets[i].length())
+	    replace_str.append(targets[i].length() - replace_str.length(), pad_char);
+	if (s.binary_rewrite != STRCLEAR_REWRITE_NONE && replace_str.length() > targets[i].length()) {
+	    serr << "Error:  replacement \"" << replace_str << "\" is longer than its target \"" << targets[i] << "\" - binary strings can only be replaced in place by strings no longer than themselves\n";
+	    return -1;
+	}
+    }
+    std::shared_ptr<PatternSet> psp = compile_set(state, targets, replacements, s.clear_char);
+    const PatternSet &ps = *psp;
+
+    // A cached "clean" verdict is only good for the same strings and the
+    // settings that change what matches or how files are classified.  A
+    // server keeps its caches loaded between requests.
+    CleanCache *cache = NULL;
+    std::unique_ptr<CleanCache> own_cache;
+    if (cache_file.length() || state) {
+	std::ostringstream key;
+	key << scan_mode << s.swap_mode << s.binary_mode << (int)s.clear_char << s.sections << s.archives << (int)s.binary_rewrite << (int)s.rewrite_pad << ":" << s.classify_bytes;
+	std::string kstr = key.str();
+	uint64_t h = fnv1a_hash(kstr.data(), kstr.length());
+	for (size_t i = 0; i < ps.targets.size(); i++) {
+	    uint64_t len = ps.targets[i].length();
+	    h = fnv1a_hash(&len, sizeof(len), h);
+	    h = fnv1a_hash(ps.targets[i].data(), len, h);
+	}
+	for (size_t i = 0; i < ps.replacements.size(); i++) {
+	    uint64_t len = ps.replacements[i].length();
+	    h = fnv1a_hash(&len, sizeof(len), h);
+	    h = fnv1a_hash(ps.replacements[i].data(), len, h);
+	}
+	if (state) {
+	    std::error_code ec;
+	    std::string cname = (cache_file.length()) ? std::filesystem::absolute(cache_file, ec).string() : std::string();
+	    std::unique_ptr<CleanCache> &c = state->caches[cname];
+	    if (!c)
+		c.reset(new CleanCache((cname.length()) ? cname.c_str() : NULL, h));
+	    c->set_hash = h;
+	    cache = c.get();
+	} else {
+	    own_cache.reset(new CleanCache(cache_file.c_str(), h));
+	    cache = own_cache.get();
+	}
+    }
+
+    // Each file's reporting is buffered and written out in one piece when
+    // the file is done, so output from different workers doesn't interleave.
+    // A streamed walk adds files while the workers run - the deque keeps
+    // the entries in place as it grows, but looking one up must be locked.
+    struct batch_file {
+	std::string name;
+	int result = 0;
+	file_stats fst;
+	char skipped = 0;
+    };
+    std::deque<batch_file> batch(files.size());
+    for (size_t i = 0; i < files.size(); i++)
+	batch[i].name = files[i];
+    std::mutex batch_lock;
+    auto entry = [&](size_t i) -> batch_file & {
+	std::lock_guard<std::mutex> guard(batch_lock);
+	return batch[i];
+    };
+    std::mutex report_lock;
+    auto process = [&](batch_file &f, UringIO *uring, UringIO::file *lf) {
+	std::ostringstream out, err;
+	{
+	    phase_timer et(&f.fst.elapsed);
+	    rusage_delta ru(f.fst);
+	    if (lf && lf->loaded)
+		f.result = process_loaded(out, err, f.name, *uring, *lf, ps, s, scan_mode, json, first_match, f.fst);
+	    else if (scan_mode)
+		f.result = scan_file(out, err, f.name, ps, json, first_match, s.chunk_size, s.sections, f.fst);
+	    else
+		f.result = process_file(out, err, f.name, ps, s, f.fst);
+	}
+	if (f.result > 0)
+	    f.fst.matches = f.result;
+	// A file we couldn't check all of (see fst.unchecked) may not be
+	// clean, and a build that can check it may share the cache
+	if (cache)
+	    cache->record(f.name, f.result == 0 && !f.fst.unchecked);
+	if (stats_fmt.length())
+	    print_stats(err, f.name, f.fst, stats_fmt == "json");
+	if (out.tellp() > 0 || err.tellp() > 0) {
+	    std::lock_guard<std::mutex> guard(report_lock);
+	    sout << out.str() << std::flush;
+	    serr << err.str() << std::flush;
+	}
+    };
+
+    // With io_uring the ring does the opens and reads (and the writes in
+    // place) for all the small files, and the workers take the files in
+    // whatever order they finish loading.  Replace mode and archives need
+    // the file level paths, so they don't use it.
+    std::unique_ptr<UringIO> uring;
+    int walk_ret = 0;
+    auto process_job = [&](size_t i, size_t) {
+	batch_file &f = entry(i);
+	if (cache && cache->is_clean(f.name)) {
+	    f.skipped = 1;
+	    return;
+	}
+	process(f, NULL, NULL);
+    };
+    if (uring_batch) {
+	std::vector<size_t> order;
+	if (cache) {
+	    pool.run(batch.size(), [&](size_t i, size_t) {
+		batch[i].skipped = cache->is_clean(batch[i].name);
+	    });
+	}
+	for (size_t i = 0; i < batch.size(); i++) {
+	    if (!batch[i].skipped)
+		order.push_back(i);
+	}
+	size_t max_file = (s.chunk_size && s.chunk_size < URING_MAX_FILE) ? s.chunk_size : URING_MAX_FILE;
+	uring.reset(new UringIO(files, order, max_file));
+	if (uring->valid) {
+	    pool.run(order.size(), [&](size_t, size_t) {
+		UringIO::file lf;
+		double wait = 0.0;
+		phase_timer wt(&wait);
+		if (!uring->next(lf))
+		    return;
+		wt.stop();
+		if (lf.loaded)
+		    batch[lf.index].fst.read_time += wait;
+		process(batch[lf.index], uring.get(), &lf);
+		uring->release(lf);
+	    });
+	} else {
+	    if (s.verbose)
+		serr << "strclear: io_uring is not available, using the worker pool alone\n";
+	    pool.run(order.size(), [&](size_t i, size_t) {
+		process(batch[order[i]], NULL, NULL);
+	    });
+	}
+    } else if (stream_walk) {
+	pool.run_streamed([&](const std::function<void(size_t)> &add) {
+	    for (size_t i = 0; i < batch.size(); i++)
+		add(i);
+	    walk_ret = walker.walk(walk_roots, [&](const std::string &path) {
+		size_t i;
+		{
+		    std::lock_guard<std::mutex> guard(batch_lock);
+		    batch.emplace_back();
+		    batch.back().name = path;
+		    i = batch.size() - 1;
+		}
+		add(i);
+	    }, serr);
+	}, process_job);
+    } else {
+	pool.run(batch.size(), process_job);
     }
 
-    // If we're in binary mode we're just nulling out the target string(s).
-    if (binary_mode) {
-	std::vector<std::string> target_strs;
-	for (size_t i = 1; i < nonopts.size(); i++) {
-	    target_strs.push_back(nonopts[i]);
+    int errcnt = (walk_ret < 0) ? 1 : 0;
+    size_t modcnt = 0;
+    size_t strcnt = 0;
+    size_t skipcnt = 0;
+    if (cache && cache->save(serr) < 0)
+	errcnt++;
+    for (size_t i = 0; i < batch.size(); i++) {
+	skipcnt += batch[i].skipped;
+	if (batch[i].result < 0) {
+	    errcnt++;
+	    continue;
+	}
+	if (batch[i].result > 0) {
+	    modcnt++;
+	    strcnt += batch[i].result;
 	}
-	return process_binary(fname, target_strs, clear_char, verbose);
     }
 
-    if (nonopts.size() > 3) {
-	std::cerr << "Error:  replacing string in text file - need file, target string and replacement string as arguments.\n";
-	return -1;
+    // The total's fault and switch counts are process-wide, so they also
+    // cover the setup and directory walking
+    if (stats_fmt.length()) {
+	file_stats total;
+	for (size_t i = 0; i < batch.size(); i++)
+	    total.add(batch[i].fst);
+	run_timer.stop();
+	total.elapsed = run_time;
+	process_rusage(total);
+	print_stats(serr, std::string(), total, stats_fmt == "json");
     }
-    std::string target_str(nonopts[1]);
-    std::string replace_str(nonopts[2]);
-    return process_text(fname, target_str, replace_str, verbose);
+
+    // Scan output may be machine read, so keep the summary off stdout
+    if (scan_mode) {
+	if (s.verbose) {
+	    serr << "strclear: scanned " << batch.size() << " files, " << modcnt << " with matches";
+	    serr << " (" << strcnt << " instances), " << errcnt << " errors\n";
+	}
+	if (errcnt)
+	    return -1;
+	return (strcnt) ? 0 : 1;
+    }
+
+    if (batch_mode) {
+	sout << "strclear: processed " << batch.size() << " files, modified " << modcnt;
+	sout << " (" << strcnt << " instances), " << errcnt << " errors";
+	if (cache_file.length() || skipcnt)
+	    sout << ", " << skipcnt << " skipped as unchanged";
+	sout << "\n";
+    }
+
+    return (errcnt) ? -1 : 0;
+}
+
+// Short options whose value follows them, in the same argument or the next
+#define VALUE_SHORT_OPTS "fRj"
+
+// Whether the short option cluster arg ("-0", "-c0v") sets -0.  Scanning
+// stops at the first option taking a value, as the rest of the argument
+// (if any) is its value - "-j0" is a job count, not -j and -0.  If that
+// option's value is the next argument, value_next is set.
+static bool
+sets_null(const std::string &arg, bool &value_next)
+{
+    value_next = false;
+    for (size_t i = 1; i < arg.length(); i++) {
+	if (arg[i] == '0')
+	    return true;
+	if (strchr(VALUE_SHORT_OPTS, arg[i])) {
+	    value_next = (i == arg.length() - 1);
+	    return false;
+	}
+    }
+    return false;
+}
+
+// Send a --client command line to the server, everything but the --client
+// option itself.  This happens before any option parsing - with thousands
+// of strings on the command line, parsing them is a good part of a run's
+// start up.  -0 lists are read from our own stdin, so those are run here
+// (as is anything, if no server answers).  Returns true if the server ran
+// the command, with its exit status in ret.
+static bool
+forward_request(int argc, const char *argv[], int &ret)
+{
+    std::string socket;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++) {
+	std::string arg(argv[i]);
+	if (arg == "--")
+	    break;
+	if (arg == "--null")
+	    return false;
+	if (arg.length() > 1 && arg[0] == '-' && arg[1] != '-') {
+	    bool value_next;
+	    if (sets_null(arg, value_next))
+		return false;
+	    if (value_next)
+		i++;
+	}
+    }
+    bool opts = true;
+    for (int i = 1; i < argc; i++) {
+	std::string arg(argv[i]);
+	if (arg == "--")
+	    opts = false;
+	if (opts && arg == "--client" && i + 1 < argc) {
+	    socket = argv[++i];
+	    continue;
+	}
+	if (opts && arg.compare(0, 9, "--client=") == 0) {
+	    socket = arg.substr(9);
+	    continue;
+	}
+	args.push_back(arg);
+    }
+    if (!socket.length())
+	return false;
+    bool connected = false;
+    ret = serve_request(socket, args, std::cout, std::cerr, connected);
+    return connected;
+}
+
+int
+main(int argc, const char *argv[])
+{
+    int ret;
+    if (forward_request(argc, argv, ret))
+	return ret;
+    return strclear_main(argc, argv, std::cout, std::cerr, NULL);
 }
 
 // Local Variables:
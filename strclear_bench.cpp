@@ -0,0 +1,334 @@
+/*                  S T R C L E A R _ B E N C H . C P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file strclear_bench.cpp
+ *
+ * Benchmarks for the substring search kernels, the multi-target automaton
+ * and the end to end file processing paths.
+ *
+ * The corpora are generated - English-like text with no hits, one hit or
+ * a hit every few hundred bytes, and random binary data - plus this
+ * executable itself as a real-world binary image.  Set
+ * STRCLEAR_BENCH_CORPUS to the name of a file to add that as well.  The
+ * needles are prefixes of a build-path-like string, from 2 to 64 bytes.
+ *
+ * Benchmarks are named kind/variant/corpus/size, so a subset can be
+ * selected with --benchmark_filter=<regex> - e.g. "text_sparse/4$" to
+ * compare every kernel on 4 byte needles.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "AhoCorasick.hpp"
+#include "PatternSet.hpp"
+#include "Stats.hpp"
+#include "libstrclear.hpp"
+#include "memsearch.hpp"
+
+#define CORPUS_SIZE (4 * 1024 * 1024)
+#define DENSE_INTERVAL 512
+
+static const std::string needle_str("/home/builder/work/brlcad/build-x86_64/lib/strclear/share/data/");
+static const size_t needle_lens[] = {2, 4, 8, 16, 32, 64};
+
+struct corpus {
+    std::string name;
+    std::string data;
+    bool has_nul;   /**< strnstr stops at the first NUL, so can't search this */
+};
+
+static std::string
+gen_text(size_t len, std::mt19937 &rng)
+{
+    static const char *words[] = {
+	"the", "of", "build", "install", "directory", "library", "path",
+	"include", "source", "share", "lib", "bin", "configuration", "and",
+	"to", "file", "value", "data", "home", "/usr/lib/", "/opt/"
+    };
+    std::uniform_int_distribution<size_t> wd(0, sizeof(words) / sizeof(words[0]) - 1);
+    std::string ret;
+    while (ret.length() < len) {
+	ret.append(words[wd(rng)]);
+	ret.push_back((rng() % 12) ? ' ' : '\n');
+    }
+    ret.resize(len);
+    return ret;
+}
+
+static std::string
+gen_binary(size_t len, std::mt19937 &rng)
+{
+    std::string ret(len, '\0');
+    for (size_t i = 0; i < len; i++)
+	ret[i] = (char)(rng() & 0xff);
+    return ret;
+}
+
+// Put the full needle string into data every interval bytes, or once near
+// the end if interval is 0
+static void
+plant(std::string &data, size_t interval)
+{
+    if (!interval) {
+	memcpy(&data[data.length() - 2 * needle_str.length()], needle_str.data(), needle_str.length());
+	return;
+    }
+    for (size_t off = interval / 2; off + needle_str.length() <= data.length(); off += interval)
+	memcpy(&data[off], needle_str.data(), needle_str.length());
+}
+
+static bool
+read_file(const char *fname, std::string &data)
+{
+    std::ifstream fs(fname, std::ios::binary);
+    if (!fs.is_open())
+	return false;
+    data.assign(std::istreambuf_iterator<char>(fs), std::istreambuf_iterator<char>());
+    return data.length() > 0;
+}
+
+// Distinct targets of similar shape to the needle, the first being the
+// needle itself (so the planted hits are found)
+static std::vector<std::string>
+gen_targets(size_t cnt)
+{
+    std::vector<std::string> targets;
+    targets.push_back(needle_str);
+    for (size_t i = 1; i < cnt; i++)
+	targets.push_back("/home/builder/work/pkg" + std::to_string(i) + "/lib/");
+    return targets;
+}
+
+static void
+bm_search(benchmark::State &state, memsearch_func f, const corpus *c, size_t nlen)
+{
+    if (!f || (f == memsearch_kernel(MEMSEARCH_STRNSTR) && c->has_nul)) {
+	state.SkipWithError("kernel can't search this corpus");
+	return;
+    }
+    std::string n = needle_str.substr(0, nlen);
+    const char *h = c->data.data();
+    size_t hlen = c->data.length();
+    size_t hits = 0;
+    for (auto _ : state) {
+	hits = 0;
+	const char *p = f(h, hlen, n.data(), nlen);
+	while (p) {
+	    hits++;
+	    p++;
+	    p = f(p, h + hlen - p, n.data(), nlen);
+	}
+	benchmark::DoNotOptimize(hits);
+    }
+    state.SetBytesProcessed((int64_t)state.iterations() * hlen);
+    state.counters["hits"] = (double)hits;
+}
+
+// Find every instance of every target, with the automaton or with one
+// memsearch pass per target
+static void
+bm_multi(benchmark::State &state, const corpus *c, size_t tcnt, bool automaton)
+{
+    std::vector<std::string> targets = gen_targets(tcnt);
+    AhoCorasick ac(targets);
+    std::vector<AhoCorasick::Match> matches;
+    const char *h = c->data.data();
+    size_t hlen = c->data.length();
+    size_t hits = 0;
+    for (auto _ : state) {
+	hits = 0;
+	if (automaton) {
+	    matches.clear();
+	    hits = ac.find_all(h, hlen, matches);
+	} else {
+	    for (size_t i = 0; i < targets.size(); i++) {
+		const char *p = memsearch(h, hlen, targets[i].data(), targets[i].length());
+		while (p) {
+		    hits++;
+		    p++;
+		    p = memsearch(p, h + hlen - p, targets[i].data(), targets[i].length());
+		}
+	    }
+	}
+	benchmark::DoNotOptimize(hits);
+    }
+    state.SetBytesProcessed((int64_t)state.iterations() * hlen);
+    state.counters["hits"] = (double)hits;
+}
+
+static std::string tmpfile_name;
+
+static void
+write_tmpfile(const corpus *c)
+{
+    std::ofstream fs(tmpfile_name, std::ios::binary | std::ios::trunc);
+    fs.write(c->data.data(), c->data.length());
+}
+
+// process_binary on a file holding the corpus, restored before each run
+static void
+bm_clear(benchmark::State &state, const corpus *c, size_t tcnt)
+{
+    PatternSet ps(gen_targets(tcnt));
+    std::ostringstream out, err;
+    file_stats fst;
+    for (auto _ : state) {
+	state.PauseTiming();
+	write_tmpfile(c);
+	state.ResumeTiming();
+	if (process_binary(out, err, tmpfile_name, ps, false, false, 0, false, fst) < 0) {
+	    state.SkipWithError(err.str().c_str());
+	    break;
+	}
+    }
+    state.SetBytesProcessed((int64_t)state.iterations() * c->data.length());
+}
+
+// process_text, with a replacement the same length as the target (patched
+// in place) or longer (file rewritten)
+static void
+bm_replace(benchmark::State &state, const corpus *c, bool same_len)
+{
+    PatternSet ps(std::vector<std::string>(1, needle_str));
+    std::string replace_str(needle_str);
+    std::replace(replace_str.begin(), replace_str.end(), 'b', 'B');
+    if (!same_len)
+	replace_str.append("longer/");
+    ps.replacements.push_back(replace_str);
+    std::ostringstream out, err;
+    file_stats fst;
+    for (auto _ : state) {
+	state.PauseTiming();
+	write_tmpfile(c);
+	state.ResumeTiming();
+	if (process_text(out, err, tmpfile_name, ps, false, false, fst) < 0) {
+	    state.SkipWithError(err.str().c_str());
+	    break;
+	}
+    }
+    state.SetBytesProcessed((int64_t)state.iterations() * c->data.length());
+}
+
+int
+main(int argc, char **argv)
+{
+    std::mt19937 rng(20231);
+    std::vector<corpus> corpora;
+    corpora.push_back({"text_none", gen_text(CORPUS_SIZE, rng), false});
+    corpora.push_back({"text_sparse", corpora[0].data, false});
+    plant(corpora.back().data, 0);
+    corpora.push_back({"text_dense", corpora[0].data, false});
+    plant(corpora.back().data, DENSE_INTERVAL);
+    corpora.push_back({"binary_sparse", gen_binary(CORPUS_SIZE, rng), true});
+    plant(corpora.back().data, 0);
+    corpus exe = {"exe", std::string(), true};
+    if (read_file(argv[0], exe.data))
+	corpora.push_back(exe);
+    const char *user_corpus = getenv("STRCLEAR_BENCH_CORPUS");
+    corpus user = {"user", std::string(), true};
+    if (user_corpus && read_file(user_corpus, user.data)) {
+	user.has_nul = (memchr(user.data.data(), 0, user.data.length()) != NULL);
+	corpora.push_back(user);
+    }
+
+    for (int k = MEMSEARCH_AUTO + 1; k < MEMSEARCH_KERNEL_CNT; k++) {
+	memsearch_func f = memsearch_kernel((memsearch_kernel_t)k);
+	if (!f)
+	    continue;
+	for (size_t i = 0; i < corpora.size(); i++) {
+	    for (size_t j = 0; j < sizeof(needle_lens) / sizeof(needle_lens[0]); j++) {
+		std::string name = std::string("search/") + memsearch_name((memsearch_kernel_t)k) + "/" + corpora[i].name + "/" + std::to_string(needle_lens[j]);
+		benchmark::RegisterBenchmark(name.c_str(), bm_search, f, &corpora[i], needle_lens[j]);
+		// The same kernel specialized for the needle length, as used
+		// by the compiled pattern sets
+		memsearch_func sf = memsearch_kernel_for((memsearch_kernel_t)k, needle_lens[j]);
+		if (sf == f)
+		    continue;
+		name = std::string("search/") + memsearch_name((memsearch_kernel_t)k) + "_len/" + corpora[i].name + "/" + std::to_string(needle_lens[j]);
+		benchmark::RegisterBenchmark(name.c_str(), bm_search, sf, &corpora[i], needle_lens[j]);
+	    }
+	}
+    }
+
+    static const size_t tcnts[] = {2, 8, 32};
+    for (size_t i = 0; i < corpora.size(); i++) {
+	for (size_t j = 0; j < sizeof(tcnts) / sizeof(tcnts[0]); j++) {
+	    std::string suffix = corpora[i].name + "/" + std::to_string(tcnts[j]);
+	    benchmark::RegisterBenchmark(("multi/automaton/" + suffix).c_str(), bm_multi, &corpora[i], tcnts[j], true);
+	    benchmark::RegisterBenchmark(("multi/sequential/" + suffix).c_str(), bm_multi, &corpora[i], tcnts[j], false);
+	}
+    }
+
+    for (size_t i = 0; i < corpora.size(); i++) {
+	benchmark::RegisterBenchmark(("process_binary/" + corpora[i].name + "/1").c_str(), bm_clear, &corpora[i], 1);
+	benchmark::RegisterBenchmark(("process_binary/" + corpora[i].name + "/8").c_str(), bm_clear, &corpora[i], 8);
+	if (corpora[i].has_nul)
+	    continue;
+	benchmark::RegisterBenchmark(("process_text/" + corpora[i].name + "/same_length").c_str(), bm_replace, &corpora[i], true);
+	benchmark::RegisterBenchmark(("process_text/" + corpora[i].name + "/longer").c_str(), bm_replace, &corpora[i], false);
+    }
+
+    std::random_device rd;
+    tmpfile_name = (std::filesystem::temp_directory_path() / ("strclear_bench_" + std::to_string(rd()) + ".tmp")).string();
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+	return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    std::error_code ec;
+    std::filesystem::remove(tmpfile_name, ec);
+    return 0;
+}
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
@@ -0,0 +1,1503 @@
+/*                  S T R C L E A R _ T E S T . C P P
+ * BRL-CAD
+ *
+ * Copyright (c) 2023 United States Government as represented by
+ * the U.S. Army Research Laboratory.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/** @file strclear_test.cpp
+ *
+ * Regression and performance tests for the strclear engine, run by ctest.
+ *
+ * The fixtures are generated rather than stored: large sparse binaries, an
+ * ELF object with path-dense debug string sections, large text files with
+ * a hit every few hundred bytes, instances planted across every chunk and
+ * split segment boundary, and tar and zip archives of such files.  Each is
+ * cleared or rewritten through the library (and, for the cli, cache and
+ * client tests, the strclear tool) and the result is checked byte for byte
+ * against a deliberately naive reference implementation of the same rules
+ * - so a faster engine can't quietly change what gets cleared.  The
+ * atomic_file test checks the metadata and hard links of rewritten files.
+ *
+ * The perf_ tests time the same paths on larger fixtures and report the
+ * throughput.  Given a --baseline file they also fail if it falls more than
+ * the tolerance below the figure stored there.  Throughput is specific to
+ * the machine (and build) it was measured on, so there is no default
+ * baseline - record one with --record on the machine the tests run on, and
+ * again after knowingly trading speed for something else.
+ *
+ * Usage: strclear_test [options] [test...] (all tests if none are named,
+ * and --list lists them)
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cxxopts.hpp"
+#include "AhoCorasick.hpp"
+#include "Archive.hpp"
+#include "AtomicFile.hpp"
+#include "ObjectFormat.hpp"
+#include "PatternSet.hpp"
+#include "Stats.hpp"
+#include "libstrclear.hpp"
+#include "memsearch.hpp"
+
+#ifdef HAVE_SYS_STAT_H
+#  include <sys/stat.h>
+#endif
+
+extern "C" char *
+strnstr(const char *h, const char *n, size_t hlen);
+
+#define MAX_REPORTED 10
+#define PERF_RUNS 3
+#define MB (1024 * 1024)
+
+static size_t failures = 0;
+static std::filesystem::path work_dir;
+static std::string strclear_path;
+
+// Throughput (MB/s) measured by the perf_ tests, by name
+static std::map<std::string, double> measured;
+
+// Report a failed check - only the first few in detail, as one bug tends
+// to fail the same check over and over
+static void
+fail(const std::string &what)
+{
+    if (failures < MAX_REPORTED)
+	std::cerr << "FAIL: " << what << "\n";
+    else if (failures == MAX_REPORTED)
+	std::cerr << "(further failures not shown)\n";
+    failures++;
+}
+
+// Printable form of str, for failure reports
+static std::string
+quote(const std::string &str)
+{
+    std::string ret("\"");
+    for (size_t i = 0; i < str.length(); i++) {
+	unsigned char c = (unsigned char)str[i];
+	if (c >= ' ' && c < 0x7f && c != '"' && c != '\\') {
+	    ret.push_back((char)c);
+	    continue;
+	}
+	static const char hex[] = "0123456789abcdef";
+	ret.append("\\x");
+	ret.push_back(hex[c >> 4]);
+	ret.push_back(hex[c & 0xf]);
+    }
+    ret.push_back('"');
+    return ret;
+}
+
+static void
+check_count(const std::string &what, long long got, long long want)
+{
+    if (got != want)
+	fail(what + ": got " + std::to_string(got) + ", reference " + std::to_string(want));
+}
+
+// Compare a result with the reference's, reporting where they first differ
+static void
+check_same(const std::string &what, const std::string &got, const std::string &want)
+{
+    if (got == want)
+	return;
+    size_t i = 0;
+    while (i < got.length() && i < want.length() && got[i] == want[i])
+	i++;
+    fail(what + ": differs from the reference at offset " + std::to_string(i) + " (" + std::to_string(got.length()) + " bytes, reference " + std::to_string(want.length()) + ")");
+}
+
+/* Reference implementations.  These are the rules spelled out as plainly
+ * as possible, with no regard for speed beyond skipping on the first byte
+ * of a string. */
+
+static const char *
+ref_find(const char *h, size_t hlen, const char *n, size_t nlen)
+{
+    if (!nlen)
+	return h;
+    for (size_t i = 0; i + nlen <= hlen; i++) {
+	if (h[i] == n[0] && !memcmp(h + i, n, nlen))
+	    return h + i;
+    }
+    return NULL;
+}
+
+// strnstr: the first instance of n within the first hlen bytes of h, not
+// looking past a NUL in h
+static const char *
+ref_strnstr(const char *h, const char *n, size_t hlen)
+{
+    size_t len = 0;
+    while (len < hlen && h[len])
+	len++;
+    return ref_find(h, len, n, strlen(n));
+}
+
+// Every instance of every target, overlapping ones included, sorted by
+// offset and then target
+static void
+ref_all(const char *buf, size_t buflen, const std::vector<std::string> &targets, std::vector<AhoCorasick::Match> &found)
+{
+    found.clear();
+    for (size_t t = 0; t < targets.size(); t++) {
+	if (targets[t].empty())
+	    continue;
+	const char *p = buf;
+	while ((p = ref_find(p, buf + buflen - p, targets[t].data(), targets[t].length()))) {
+	    found.push_back({(size_t)(p - buf), t});
+	    p++;
+	}
+    }
+    std::sort(found.begin(), found.end(), [](const AhoCorasick::Match &m1, const AhoCorasick::Match &m2) {
+	return (m1.pos != m2.pos) ? m1.pos < m2.pos : m1.pattern < m2.pattern;
+    });
+}
+
+// Clearing: each target in turn, in each span, taking its instances left
+// to right and resuming one byte into each one cleared.  Returns the number
+// cleared.
+static size_t
+ref_clear(std::string &buf, const std::vector<std::string> &targets, char clear_char, const std::vector<obj_section> *spans = NULL)
+{
+    std::vector<obj_section> whole(1, {std::string(), 0, buf.length()});
+    if (!spans)
+	spans = &whole;
+    size_t cnt = 0;
+    for (size_t t = 0; t < targets.size(); t++) {
+	size_t tlen = targets[t].length();
+	if (!tlen)
+	    continue;
+	for (size_t s = 0; s < spans->size(); s++) {
+	    char *sbuf = &buf[0] + (*spans)[s].offset;
+	    size_t slen = (*spans)[s].size;
+	    size_t pos = 0;
+	    const char *p;
+	    while ((p = ref_find(sbuf + pos, slen - pos, targets[t].data(), tlen))) {
+		size_t at = (size_t)(p - sbuf);
+		memset(sbuf + at, clear_char, tlen);
+		cnt++;
+		pos = at + 1;
+	    }
+	}
+    }
+    return cnt;
+}
+
+// Replacing: at each point the longest target starting there (the first
+// listed, of equal ones) is replaced and the search resumes after it.
+// Returns the number replaced.
+static size_t
+ref_replace(const std::string &in, const std::vector<std::string> &targets, const std::vector<std::string> &replacements, std::string &out)
+{
+    bool first[256] = {false};
+    for (size_t t = 0; t < targets.size(); t++) {
+	if (targets[t].length())
+	    first[(unsigned char)targets[t][0]] = true;
+    }
+    out.clear();
+    size_t cnt = 0;
+    size_t i = 0;
+    while (i < in.length()) {
+	size_t best = targets.size();
+	size_t blen = 0;
+	if (first[(unsigned char)in[i]]) {
+	    for (size_t t = 0; t < targets.size(); t++) {
+		size_t tlen = targets[t].length();
+		if (tlen > blen && i + tlen <= in.length() && !in.compare(i, tlen, targets[t])) {
+		    best = t;
+		    blen = tlen;
+		}
+	    }
+	}
+	if (best == targets.size()) {
+	    out.push_back(in[i++]);
+	    continue;
+	}
+	out.append(replacements[best]);
+	i += blen;
+	cnt++;
+    }
+    return cnt;
+}
+
+/* Fixtures */
+
+// Build paths to clear.  Some overlap - one is a prefix of another, one
+// starts inside two others - so the order targets are applied in matters.
+static const char *build_paths[] = {
+    "/home/builder/work/brlcad/build",
+    "/home/builder/work/brlcad/src",
+    "/home/builder/work/brlcad/build/lib",
+    "build/lib/librt",
+    "/opt/brlcad/share",
+    "/tmp/brlcad-build/include",
+    "/usr/local/brlcad",
+    "/home/builder/.cache",
+};
+#define BUILD_PATH_CNT (sizeof(build_paths) / sizeof(build_paths[0]))
+
+static std::vector<std::string>
+path_targets(size_t cnt = BUILD_PATH_CNT)
+{
+    return std::vector<std::string>(build_paths, build_paths + cnt);
+}
+
+static std::string
+gen_binary(size_t len, std::mt19937 &rng)
+{
+    std::string ret(len, '\0');
+    for (size_t i = 0; i < len; i += 4) {
+	uint32_t v = rng();
+	for (size_t j = 0; j < 4 && i + j < len; j++)
+	    ret[i + j] = (char)(v >> (8 * j));
+    }
+    return ret;
+}
+
+static std::string
+gen_text(size_t len, std::mt19937 &rng)
+{
+    static const char *words[] = {
+	"the", "of", "build", "install", "directory", "library", "path",
+	"include", "source", "share", "lib", "bin", "configuration", "and",
+	"to", "file", "value", "data", "home", "/usr/lib/", "/opt/", "brlcad"
+    };
+    std::string ret;
+    ret.reserve(len + 16);
+    while (ret.length() < len) {
+	ret.append(words[rng() % (sizeof(words) / sizeof(words[0]))]);
+	ret.push_back((rng() % 12) ? ' ' : '\n');
+    }
+    ret.resize(len);
+    return ret;
+}
+
+// A path made up of the usual components, sometimes under a build path
+static std::string
+gen_path(std::mt19937 &rng)
+{
+    static const char *parts[] = {
+	"src", "lib", "include", "share", "data", "librt", "libbu", "libged",
+	"x86_64", "debug", "release", "CMakeFiles", "brlcad.dir", "db", "tcl"
+    };
+    std::string ret = (rng() % 3) ? std::string() : std::string(build_paths[rng() % BUILD_PATH_CNT]);
+    size_t n = 1 + rng() % 6;
+    for (size_t i = 0; i < n; i++) {
+	ret.push_back('/');
+	ret.append(parts[rng() % (sizeof(parts) / sizeof(parts[0]))]);
+    }
+    return ret;
+}
+
+// NUL separated paths, the way string tables and .debug_str hold them
+static std::string
+gen_strings(size_t len, std::mt19937 &rng)
+{
+    std::string ret;
+    ret.reserve(len + 256);
+    while (ret.length() < len) {
+	ret.append(gen_path(rng));
+	ret.push_back('\0');
+    }
+    ret.resize(len);
+    return ret;
+}
+
+// Overwrite data with str at off
+static void
+plant(std::string &data, size_t off, const std::string &str)
+{
+    if (off + str.length() <= data.length())
+	memcpy(&data[off], str.data(), str.length());
+}
+
+// Plant cnt build paths at random offsets
+static void
+plant_random(std::string &data, size_t cnt, std::mt19937 &rng)
+{
+    for (size_t i = 0; i < cnt; i++)
+	plant(data, rng() % data.length(), build_paths[rng() % BUILD_PATH_CNT]);
+}
+
+static void
+put_le(std::string &data, size_t off, uint64_t val, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+	data[off + i] = (char)(val >> (8 * i));
+}
+
+// A 64 bit little endian ELF relocatable object - code and debug info
+// (random, but with build paths in) around path-dense string sections.
+// The string bearing sections, which are all --sections should clear, are
+// returned in spans in file order.
+static std::string
+gen_elf(size_t code_size, size_t str_size, std::mt19937 &rng, std::vector<obj_section> &spans)
+{
+    struct elf_section {
+	const char *name;
+	uint32_t type;
+	uint64_t flags;
+	std::string data;
+	bool strings;
+    };
+    std::vector<elf_section> secs = {
+	{".text", 1, 0x6, gen_binary(code_size, rng), false},
+	{".rodata", 1, 0x2, gen_strings(str_size / 8, rng), true},
+	{".debug_info", 1, 0, gen_binary(code_size / 2, rng), false},
+	{".debug_str", 1, 0x30, gen_strings(str_size, rng), true},
+	{".debug_line_str", 1, 0x30, gen_strings(str_size / 4, rng), true},
+	{".shstrtab", 3, 0, std::string(1, '\0'), true},
+    };
+    plant_random(secs[0].data, 16, rng);
+    plant_random(secs[2].data, 16, rng);
+
+    std::vector<size_t> name_offs;
+    for (size_t i = 0; i < secs.size(); i++) {
+	name_offs.push_back(secs.back().data.length());
+	secs.back().data.append(secs[i].name);
+	secs.back().data.push_back('\0');
+    }
+
+    std::string elf(64, '\0');
+    std::vector<size_t> offs;
+    spans.clear();
+    for (size_t i = 0; i < secs.size(); i++) {
+	offs.push_back(elf.length());
+	elf.append(secs[i].data);
+	if (secs[i].strings && secs[i].data.length())
+	    spans.push_back({secs[i].name, offs.back(), secs[i].data.length()});
+	elf.resize((elf.length() + 7) & ~(size_t)7, '\0');
+    }
+
+    size_t shoff = elf.length();
+    elf.resize(shoff + 64 * (secs.size() + 1), '\0');
+    memcpy(&elf[0], "\x7f" "ELF\x02\x01\x01", 7);
+    put_le(elf, 0x10, 1, 2);		// ET_REL
+    put_le(elf, 0x12, 62, 2);		// EM_X86_64
+    put_le(elf, 0x14, 1, 4);
+    put_le(elf, 0x28, shoff, 8);
+    put_le(elf, 0x34, 64, 2);
+    put_le(elf, 0x3a, 64, 2);
+    put_le(elf, 0x3c, secs.size() + 1, 2);
+    put_le(elf, 0x3e, secs.size(), 2);	// .shstrtab is last
+    for (size_t i = 0; i < secs.size(); i++) {
+	size_t sh = shoff + 64 * (i + 1);
+	put_le(elf, sh, name_offs[i], 4);
+	put_le(elf, sh + 4, secs[i].type, 4);
+	put_le(elf, sh + 8, secs[i].flags, 8);
+	put_le(elf, sh + 24, offs[i], 8);
+	put_le(elf, sh + 32, secs[i].data.length(), 8);
+	put_le(elf, sh + 48, 1, 8);
+	put_le(elf, sh + 56, (secs[i].flags & 0x20) ? 1 : 0, 8);
+    }
+    return elf;
+}
+
+// A ustar archive of the named members (names ending in '/' are
+// directories), with the two zero blocks ending it
+static std::string
+gen_tar(const std::vector<std::pair<std::string, std::string>> &members)
+{
+    std::string tar;
+    for (size_t i = 0; i < members.size(); i++) {
+	const std::string &name = members[i].first;
+	const std::string &data = members[i].second;
+	bool dir = (name.back() == '/');
+	std::string hdr(512, '\0');
+	hdr.replace(0, name.length(), name);
+	char field[16];
+	snprintf(field, sizeof(field), "%07o", (dir) ? 0755 : 0644);
+	hdr.replace(100, 8, field, 8);
+	hdr.replace(108, 8, "0000000", 8);
+	hdr.replace(116, 8, "0000000", 8);
+	snprintf(field, sizeof(field), "%011llo", (unsigned long long)data.length());
+	hdr.replace(124, 12, field, 12);
+	hdr.replace(136, 12, "14000000000", 12);
+	hdr[156] = (dir) ? '5' : '0';
+	hdr.replace(257, 8, "ustar\0" "00", 8);
+	unsigned sum = 8 * ' ';
+	for (size_t b = 0; b < 512; b++)
+	    sum += (b >= 148 && b < 156) ? 0 : (unsigned char)hdr[b];
+	snprintf(field, sizeof(field), "%06o", sum);
+	hdr.replace(148, 8, field, 8);
+	hdr[155] = ' ';
+	tar += hdr + data;
+	tar.append((512 - data.length() % 512) % 512, '\0');
+    }
+    tar.append(1024, '\0');
+    return tar;
+}
+
+static uint32_t
+ref_crc32(const std::string &data)
+{
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < data.length(); i++) {
+	crc ^= (unsigned char)data[i];
+	for (int b = 0; b < 8; b++)
+	    crc = (crc >> 1) ^ (0xedb88320U & (0U - (crc & 1)));
+    }
+    return crc ^ 0xffffffff;
+}
+
+// A zip archive of the named members, all stored (zlib isn't needed to
+// build or check it)
+static std::string
+gen_zip(const std::vector<std::pair<std::string, std::string>> &members)
+{
+    std::string zip, cd;
+    for (size_t i = 0; i < members.size(); i++) {
+	const std::string &name = members[i].first;
+	const std::string &data = members[i].second;
+	uint32_t crc = ref_crc32(data);
+	std::string lh(30, '\0');
+	put_le(lh, 0, 0x04034b50, 4);
+	put_le(lh, 4, 20, 2);
+	put_le(lh, 14, crc, 4);
+	put_le(lh, 18, data.length(), 4);
+	put_le(lh, 22, data.length(), 4);
+	put_le(lh, 26, name.length(), 2);
+	std::string ch(46, '\0');
+	put_le(ch, 0, 0x02014b50, 4);
+	put_le(ch, 4, 20, 2);
+	put_le(ch, 6, 20, 2);
+	put_le(ch, 16, crc, 4);
+	put_le(ch, 20, data.length(), 4);
+	put_le(ch, 24, data.length(), 4);
+	put_le(ch, 28, name.length(), 2);
+	put_le(ch, 42, zip.length(), 4);
+	zip += lh + name + data;
+	cd += ch + name;
+    }
+    std::string eocd(22, '\0');
+    put_le(eocd, 0, 0x06054b50, 4);
+    put_le(eocd, 8, members.size(), 2);
+    put_le(eocd, 10, members.size(), 2);
+    put_le(eocd, 12, cd.length(), 4);
+    put_le(eocd, 16, zip.length(), 4);
+    return zip + cd + eocd;
+}
+
+static std::string
+work_file(const std::string &name)
+{
+    return (work_dir / name).string();
+}
+
+static void
+write_file(const std::string &fname, const std::string &data)
+{
+    std::ofstream fs(fname, std::ios::binary | std::ios::trunc);
+    fs.write(data.data(), data.length());
+    if (!fs)
+	fail("unable to write " + fname);
+}
+
+static std::string
+read_file(const std::string &fname)
+{
+    std::ifstream fs(fname, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(fs), std::istreambuf_iterator<char>());
+}
+
+// Clear data (as a file) with process_binary, leaving the result in data.
+// Returns the count process_binary returned.
+static int
+clear_file(std::string &data, const PatternSet &ps, size_t chunk_size, bool sections)
+{
+    std::string fname = work_file("clear.bin");
+    write_file(fname, data);
+    std::ostringstream out, err;
+    file_stats fst;
+    int ret = process_binary(out, err, fname, ps, false, false, chunk_size, sections, fst);
+    if (ret < 0)
+	fail("process_binary: " + err.str());
+    data = read_file(fname);
+    return ret;
+}
+
+// Replace in data (as a file) with process_text, leaving the result in data
+static int
+replace_file(std::string &data, const PatternSet &ps)
+{
+    std::string fname = work_file("replace.txt");
+    write_file(fname, data);
+    std::ostringstream out, err;
+    file_stats fst;
+    int ret = process_text(out, err, fname, ps, false, false, fst);
+    if (ret < 0)
+	fail("process_text: " + err.str());
+    data = read_file(fname);
+    return ret;
+}
+
+// Clear data every way the library can - as a file, in windows of
+// chunk_size if set, and as a buffer - and check each against the
+// reference
+static void
+check_clear(const std::string &what, const std::string &data, const std::vector<std::string> &targets, char clear_char, size_t chunk_size = 0)
+{
+    PatternSet ps(targets, clear_char);
+    std::string want(data);
+    size_t wcnt = ref_clear(want, targets, clear_char);
+
+    std::string got(data);
+    int cnt = clear_file(got, ps, 0, false);
+    check_same(what + ", process_binary", got, want);
+    check_count(what + ", process_binary count", cnt, wcnt);
+
+    if (chunk_size) {
+	got = data;
+	cnt = clear_file(got, ps, chunk_size, false);
+	check_same(what + ", process_binary in " + std::to_string(chunk_size) + " byte chunks", got, want);
+	check_count(what + ", process_binary count in " + std::to_string(chunk_size) + " byte chunks", cnt, wcnt);
+    }
+
+    got = data;
+    std::vector<strclear_match> cleared;
+    size_t bcnt = strclear_clear(&got[0], got.length(), ps, &cleared);
+    check_same(what + ", strclear_clear", got, want);
+    check_count(what + ", strclear_clear count", bcnt, wcnt);
+    check_count(what + ", strclear_clear list", cleared.size(), wcnt);
+}
+
+/* Regression tests */
+
+static void
+test_strnstr()
+{
+    std::mt19937 rng(1);
+    for (int it = 0; it < 50000; it++) {
+	// Small alphabets, so needles recur and periodic ones come up.  The
+	// bytes past hlen may hold the needle, but mustn't be searched.
+	static const char alpha[] = "ab/\0";
+	bool nuls = (it % 2 == 0);
+	size_t hlen = rng() % ((it % 10) ? 64 : 400);
+	std::string h(hlen + 16, '\0');
+	for (size_t i = 0; i < h.length(); i++)
+	    h[i] = alpha[rng() % ((nuls) ? 4 : 3)];
+	if (!nuls && hlen && rng() % 2)
+	    h[rng() % hlen] = '\0';
+	std::string n(((it % 10) ? rng() % 8 : rng() % 40), 'a');
+	for (size_t i = 0; i < n.length(); i++)
+	    n[i] = alpha[rng() % ((it % 3) ? 2 : 3)];
+	if (it % 3 == 0)
+	    plant(h, rng() % (hlen + 1), n);
+	const char *got = strnstr(h.data(), n.c_str(), hlen);
+	const char *want = ref_strnstr(h.data(), n.c_str(), hlen);
+	if (got != want)
+	    fail("strnstr(" + quote(h.substr(0, hlen)) + ", " + quote(n) + "): got " + ((got) ? std::to_string(got - h.data()) : "NULL") + ", reference " + ((want) ? std::to_string(want - h.data()) : "NULL"));
+    }
+}
+
+static void
+test_memsearch()
+{
+    std::mt19937 rng(2);
+    for (int k = MEMSEARCH_AUTO + 1; k < MEMSEARCH_KERNEL_CNT; k++) {
+	if (k == MEMSEARCH_STRNSTR || !memsearch_kernel((memsearch_kernel_t)k))
+	    continue;
+	std::string kname = memsearch_name((memsearch_kernel_t)k);
+	for (int it = 0; it < 20000; it++) {
+	    // Haystacks at every alignment, followed by copies of the needle
+	    // that mustn't be found
+	    static const char alpha[] = "ab\0\xff";
+	    size_t nlen = 1 + rng() % ((it % 4) ? 8 : 70);
+	    size_t hlen = rng() % 300;
+	    size_t align = rng() % 32;
+	    std::string n(nlen, 'a');
+	    for (size_t i = 0; i < nlen; i++)
+		n[i] = alpha[rng() % 4];
+	    std::string buf(align + hlen, 'a');
+	    for (size_t i = align; i < buf.length(); i++)
+		buf[i] = alpha[rng() % ((it % 2) ? 2 : 4)];
+	    if (it % 3 == 0 && hlen >= nlen)
+		plant(buf, align + ((it % 6) ? rng() % (hlen - nlen + 1) : hlen - nlen), n);
+	    buf.append(n).append(n);
+	    const char *h = buf.data() + align;
+	    const char *want = ref_find(h, hlen, n.data(), nlen);
+	    const char *got = memsearch_kernel((memsearch_kernel_t)k)(h, hlen, n.data(), nlen);
+	    const char *sgot = memsearch_kernel_for((memsearch_kernel_t)k, nlen)(h, hlen, n.data(), nlen);
+	    if (got != want || sgot != want)
+		fail(kname + " search of " + std::to_string(hlen) + " bytes at alignment " + std::to_string(align) + " for " + quote(n) + ": got " + ((got) ? std::to_string(got - h) : "NULL") + " (" + ((sgot) ? std::to_string(sgot - h) : "NULL") + " specialized), reference " + ((want) ? std::to_string(want - h) : "NULL"));
+	}
+    }
+}
+
+static void
+test_automaton()
+{
+    std::mt19937 rng(3);
+    // The plain automaton, then with the prefilter in front of it (if this
+    // host has one)
+    static const char *kernels[] = {"scalar", "auto"};
+    for (size_t k = 0; k < 2; k++) {
+	memsearch_select(kernels[k]);
+	for (int it = 0; it < 3000; it++) {
+	    static const char narrow[] = "abc/\0\xff";
+	    static const char wide[] = "abcdefghijklmnopqrstuvwxyz/._-0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ\x80\xff\x01";
+	    const char *alpha = (it % 2) ? wide : narrow;
+	    size_t alen = (it % 2) ? sizeof(wide) - 1 : sizeof(narrow) - 1;
+	    // Mostly small sets, some big enough to defeat the prefilter
+	    size_t pcnt = (it % 25) ? 1 + rng() % 12 : 100 + rng() % 200;
+	    std::vector<std::string> pats;
+	    for (size_t i = 0; i < pcnt; i++) {
+		std::string p(1 + rng() % ((it % 3) ? 12 : 2), 'a');
+		for (size_t j = 0; j < p.length(); j++)
+		    p[j] = alpha[rng() % alen];
+		if (std::find(pats.begin(), pats.end(), p) == pats.end())
+		    pats.push_back(p);
+	    }
+	    // And now and then a haystack long enough for the automaton to
+	    // give up on the prefilter partway through
+	    std::string h((it % 50 != 1) ? rng() % 4000 : 200000 + rng() % 1000, 'a');
+	    for (size_t i = 0; i < h.length(); i++)
+		h[i] = alpha[rng() % alen];
+	    for (int i = 0; i < 5 && h.length(); i++)
+		plant(h, rng() % h.length(), pats[rng() % pats.size()]);
+
+	    AhoCorasick ac(pats);
+	    std::vector<AhoCorasick::Match> got, want;
+	    ac.find_all(h.data(), h.length(), got);
+	    ref_all(h.data(), h.length(), pats, want);
+	    std::string what = std::string(kernels[k]) + " automaton, " + std::to_string(pats.size()) + " patterns over " + std::to_string(h.length()) + " bytes";
+	    for (size_t i = 1; i < got.size(); i++) {
+		if (got[i].pos + pats[got[i].pattern].length() < got[i - 1].pos + pats[got[i - 1].pattern].length()) {
+		    fail(what + ": matches out of end offset order");
+		    break;
+		}
+	    }
+
+	    // A limited search finds the same first matches
+	    if (got.size() > 1) {
+		size_t max = 1 + rng() % (got.size() - 1);
+		std::vector<AhoCorasick::Match> first;
+		ac.find_all(h.data(), h.length(), first, max);
+		bool same = (first.size() == max);
+		for (size_t i = 0; same && i < max; i++)
+		    same = (first[i].pos == got[i].pos && first[i].pattern == got[i].pattern);
+		if (!same)
+		    fail(what + ": the first " + std::to_string(max) + " matches differ from a full search's");
+	    }
+
+	    std::sort(got.begin(), got.end(), [](const AhoCorasick::Match &m1, const AhoCorasick::Match &m2) {
+		return (m1.pos != m2.pos) ? m1.pos < m2.pos : m1.pattern < m2.pattern;
+	    });
+	    bool same = (got.size() == want.size());
+	    for (size_t i = 0; same && i < got.size(); i++)
+		same = (got[i].pos == want[i].pos && got[i].pattern == want[i].pattern);
+	    if (!same)
+		fail(what + ": found " + std::to_string(got.size()) + " matches, reference " + std::to_string(want.size()));
+	}
+    }
+    memsearch_select("auto");
+}
+
+// Large, mostly clean binaries, with the few instances in the awkward
+// places: the very start and end, back to back, and overlapping each other
+static void
+test_clear_binary()
+{
+    std::mt19937 rng(4);
+    std::string data = gen_binary(8 * MB, rng);
+    plant_random(data, 200, rng);
+    plant(data, 0, build_paths[0]);
+    plant(data, data.length() - strlen(build_paths[4]), build_paths[4]);
+    std::string run = std::string(build_paths[1]) + build_paths[1] + "/home/builder/work/brlcad/build/lib/librt";
+    for (size_t i = 0; i < 20; i++)
+	plant(data, rng() % data.length(), run);
+    // Self-overlapping instances
+    std::string abab(101, 'a');
+    for (size_t i = 1; i < abab.length(); i += 2)
+	abab[i] = 'b';
+    plant(data, data.length() / 2, abab);
+
+    std::vector<std::string> all = path_targets();
+    check_clear("one target", data, path_targets(1), '\0');
+    check_clear("all targets", data, all, '\0');
+    check_clear("all targets, cleared with x", data, all, 'x');
+    // Every target holds the clear char, so they're cleared one at a time
+    check_clear("all targets, cleared with /", data, all, '/');
+    std::vector<std::string> odd = {"abab", "", "bab", "abab", build_paths[2], build_paths[0]};
+    check_clear("overlapping, empty and repeated targets", data, odd, '\0');
+    check_clear("overlapping, empty and repeated targets, cleared with a", data, odd, 'a');
+}
+
+// With --sections, only the string sections of an object are cleared
+static void
+test_clear_sections()
+{
+    std::mt19937 rng(5);
+    std::vector<obj_section> spans;
+    std::string elf = gen_elf(2 * MB, 2 * MB, rng, spans);
+
+    std::vector<obj_section> found;
+    if (!string_sections(elf.data(), elf.length(), found))
+	fail("fixture ELF object not recognized");
+    bool same = (found.size() == spans.size());
+    for (size_t i = 0; same && i < spans.size(); i++)
+	same = (found[i].offset == spans[i].offset && found[i].size == spans[i].size);
+    if (!same)
+	fail("string sections of the fixture ELF object not found");
+
+    struct {
+	const char *what;
+	std::vector<std::string> targets;
+	char clear_char;
+    } sets[] = {
+	{"one target", path_targets(1), '\0'},
+	{"all targets", path_targets(), '\0'},
+	{"all targets, cleared with /", path_targets(), '/'},
+    };
+    for (size_t i = 0; i < sizeof(sets) / sizeof(sets[0]); i++) {
+	PatternSet ps(sets[i].targets, sets[i].clear_char);
+	std::string want(elf);
+	size_t wcnt = ref_clear(want, sets[i].targets, sets[i].clear_char, &spans);
+	std::string got(elf);
+	int cnt = clear_file(got, ps, 0, true);
+	check_same(std::string(sets[i].what) + ", string sections", got, want);
+	check_count(std::string(sets[i].what) + ", string sections count", cnt, wcnt);
+	if (wcnt < 1000)
+	    fail(std::string(sets[i].what) + ": fixture debug strings aren't path-dense (only " + std::to_string(wcnt) + " instances)");
+
+	// And everything, but the same way, without --sections
+	check_clear(std::string(sets[i].what) + ", whole object", elf, sets[i].targets, sets[i].clear_char);
+    }
+}
+
+// Large text files with a hit every few hundred bytes, replaced in place
+// (same length replacements) and rewritten (longer and shorter ones)
+static void
+test_replace_text()
+{
+    std::mt19937 rng(6);
+    std::string text = gen_text(8 * MB, rng);
+    for (size_t off = 0; off < text.length(); off += 100 + rng() % 400)
+	plant(text, off, gen_path(rng));
+
+    std::vector<std::string> all = path_targets();
+    std::vector<std::string> same, longer, shorter;
+    for (size_t i = 0; i < all.size(); i++) {
+	std::string r(all[i]);
+	std::replace(r.begin(), r.end(), 'b', 'B');
+	same.push_back(r);
+	longer.push_back(all[i] + "/relocated");
+	shorter.push_back("/p" + std::to_string(i));
+    }
+    // Replacements holding targets aren't searched again
+    std::vector<std::string> recursive(longer);
+    recursive[0] = std::string(build_paths[1]) + build_paths[0];
+
+    struct {
+	const char *what;
+	std::vector<std::string> targets;
+	std::vector<std::string> replacements;
+    } sets[] = {
+	{"one target, same length", path_targets(1), std::vector<std::string>(same.begin(), same.begin() + 1)},
+	{"all targets, same length", all, same},
+	{"all targets, longer", all, longer},
+	{"all targets, shorter", all, shorter},
+	{"all targets, replacements holding targets", all, recursive},
+    };
+    for (size_t i = 0; i < sizeof(sets) / sizeof(sets[0]); i++) {
+	PatternSet ps(sets[i].targets);
+	ps.replacements = sets[i].replacements;
+	std::string want;
+	size_t wcnt = ref_replace(text, sets[i].targets, sets[i].replacements, want);
+	std::string got(text);
+	int cnt = replace_file(got, ps);
+	check_same(std::string(sets[i].what) + ", process_text", got, want);
+	check_count(std::string(sets[i].what) + ", process_text count", cnt, wcnt);
+
+	std::vector<char> out;
+	size_t bcnt = strclear_replace(text.data(), text.length(), ps, out);
+	check_same(std::string(sets[i].what) + ", strclear_replace", std::string(out.begin(), out.end()), want);
+	check_count(std::string(sets[i].what) + ", strclear_replace count", bcnt, wcnt);
+    }
+}
+
+// Instances straddling every window boundary of a chunked file, split at
+// every point, and a run of overlapping instances across one
+static void
+test_chunk_boundaries()
+{
+    std::mt19937 rng(7);
+    static const size_t chunks[] = {4096, 4099, 65536};
+    std::vector<std::string> all = path_targets();
+    all.push_back("abab");
+    for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+	size_t chunk = chunks[c];
+	std::string data = gen_binary(chunk * 12 + 777, rng);
+	size_t k = 0;
+	for (size_t b = chunk; b < data.length(); b += chunk, k++) {
+	    const char *t = build_paths[k % BUILD_PATH_CNT];
+	    plant(data, b - 1 - k % (strlen(t) - 1), t);
+	}
+	std::string abab(64, 'a');
+	for (size_t i = 1; i < abab.length(); i += 2)
+	    abab[i] = 'b';
+	plant(data, 3 * chunk - 31, abab);
+
+	std::string what = std::to_string(chunk) + " byte chunks";
+	check_clear(what + ", one target", data, path_targets(1), '\0', chunk);
+	check_clear(what + ", all targets", data, all, '\0', chunk);
+	check_clear(what + ", all targets, cleared with /", data, all, '/', chunk);
+	check_clear(what + ", all targets, cleared with a", data, all, 'a', chunk);
+
+	// Scanning through windows finds every instance exactly once
+	std::vector<AhoCorasick::Match> want;
+	ref_all(data.data(), data.length(), all, want);
+	std::string fname = work_file("scan.bin");
+	write_file(fname, data);
+	PatternSet ps(all);
+	std::ostringstream out, err;
+	file_stats fst;
+	check_count(what + ", scan_file count", scan_file(out, err, fname, ps, false, false, chunk, false, fst), want.size());
+    }
+}
+
+// Buffers searched as parallel segments, with instances across the seams
+static void
+test_split_segments()
+{
+    std::mt19937 rng(8);
+    strclear_set_split(16384, 4);
+    std::string data = gen_binary(16384 * 4 * 3 + 123, rng);
+    for (size_t off = 0; off < data.length(); off += 20 + rng() % 60)
+	plant(data, off, build_paths[rng() % BUILD_PATH_CNT]);
+    std::vector<std::string> all = path_targets();
+
+    check_clear("split, one target", data, path_targets(1), '\0');
+    check_clear("split, all targets", data, all, '\0');
+    check_clear("split, all targets, cleared with /", data, all, '/');
+
+    PatternSet ps(all);
+    std::vector<AhoCorasick::Match> got, want;
+    strclear_scan(data.data(), data.length(), ps, got);
+    ref_all(data.data(), data.length(), all, want);
+    std::sort(got.begin(), got.end(), [](const AhoCorasick::Match &m1, const AhoCorasick::Match &m2) {
+	return (m1.pos != m2.pos) ? m1.pos < m2.pos : m1.pattern < m2.pattern;
+    });
+    bool same = (got.size() == want.size());
+    for (size_t i = 0; same && i < got.size(); i++)
+	same = (got[i].pos == want[i].pos && got[i].pattern == want[i].pattern);
+    if (!same)
+	fail("split, strclear_scan: found " + std::to_string(got.size()) + " instances, reference " + std::to_string(want.size()));
+
+    for (size_t i = 0; i < all.size(); i++)
+	ps.replacements.push_back(all[i] + "/relocated");
+    std::string wout;
+    size_t wcnt = ref_replace(data, all, ps.replacements, wout);
+    std::vector<char> out;
+    size_t cnt = strclear_replace(data.data(), data.length(), ps, out);
+    check_same("split, strclear_replace", std::string(out.begin(), out.end()), wout);
+    check_count("split, strclear_replace count", cnt, wcnt);
+
+    // Back to the default
+    strclear_set_split(64 * MB, 1);
+}
+
+// The file's inode, to tell whether it was replaced (0 if unknown)
+static unsigned long long
+file_ino(const std::string &fname)
+{
+#ifdef HAVE_SYS_STAT_H
+    struct stat sb;
+    if (!stat(fname.c_str(), &sb))
+	return (unsigned long long)sb.st_ino;
+#endif
+    (void)fname;
+    return 0;
+}
+
+// Members of tar and zip archives are cleared in place, leaving everything
+// else as it was - so the result is the archive of the cleared members -
+// and an archive with nothing to clear isn't rewritten at all
+static void
+test_archives()
+{
+    std::mt19937 rng(16);
+    std::vector<std::string> targets = path_targets();
+    PatternSet ps(targets);
+    std::vector<std::pair<std::string, std::string>> members, cleared;
+    members.push_back({"pkg/", ""});
+    members.push_back({"pkg/lib.so", gen_binary(300 * 1024, rng)});
+    plant_random(members.back().second, 40, rng);
+    members.push_back({"pkg/notes.txt", gen_text(100 * 1024, rng)});
+    plant_random(members.back().second, 40, rng);
+    members.push_back({"pkg/clean.txt", "nothing to see\n"});
+    cleared = members;
+    for (size_t i = 0; i < cleared.size(); i++)
+	ref_clear(cleared[i].second, targets, '\0');
+    std::vector<std::pair<std::string, std::string>> clean(1, members.back());
+
+    typedef std::string (*archive_gen)(const std::vector<std::pair<std::string, std::string>> &);
+    const archive_gen gens[] = {gen_tar, gen_zip};
+    const char *names[] = {"test.tar", "test.zip"};
+    for (size_t g = 0; g < 2; g++) {
+	std::string fname = work_file(names[g]);
+	std::string want = gens[g](cleared);
+	write_file(fname, gens[g](members));
+	std::ostringstream out, err;
+	file_stats fst;
+	int ret = process_archive(out, err, fname, ps, false, false, (size_t)-1, fst);
+	if (ret <= 0)
+	    fail(std::string(names[g]) + ": process_archive returned " + std::to_string(ret) + " " + err.str());
+	check_same(std::string(names[g]) + " cleared", read_file(fname), want);
+
+	write_file(fname, gens[g](clean));
+	unsigned long long ino = file_ino(fname);
+	ret = process_archive(out, err, fname, ps, false, false, (size_t)-1, fst);
+	check_count(std::string(names[g]) + " clean, strings cleared", ret, 0);
+	check_same(std::string(names[g]) + " clean", read_file(fname), gens[g](clean));
+	if (file_ino(fname) != ino)
+	    fail(std::string(names[g]) + ": clean archive was rewritten");
+    }
+}
+
+// AtomicFile keeps a replaced file's mode and timestamps, copies back over
+// a multiply linked file so the links stay together, and leaves the
+// original alone if not committed
+static void
+test_atomic_file()
+{
+    namespace fs = std::filesystem;
+    std::string fname = work_file("atomic.txt");
+    write_file(fname, "original contents\n");
+    fs::permissions(fname, fs::perms::owner_read | fs::perms::owner_write | fs::perms::group_read);
+    fs::file_time_type mtime = fs::last_write_time(fname) - std::chrono::hours(24);
+    fs::last_write_time(fname, mtime);
+    {
+	AtomicFile af(fname.c_str());
+	if (!af.write("discarded\n", 10))
+	    fail("AtomicFile write failed");
+    }
+    check_same("uncommitted AtomicFile", read_file(fname), "original contents\n");
+    for (fs::directory_iterator it(work_dir), end; it != end; ++it) {
+	if (it->path().filename().string().find(".strclear") != std::string::npos)
+	    fail("uncommitted AtomicFile left " + it->path().string());
+    }
+
+    {
+	AtomicFile af(fname.c_str());
+	if (!af.write("new contents\n", 13) || !af.commit())
+	    fail("AtomicFile commit failed: " + af.error());
+    }
+    check_same("AtomicFile", read_file(fname), "new contents\n");
+    if (fs::status(fname).permissions() != (fs::perms::owner_read | fs::perms::owner_write | fs::perms::group_read))
+	fail("AtomicFile did not keep the file's mode");
+    if (fs::last_write_time(fname) != mtime)
+	fail("AtomicFile did not keep the file's modification time");
+
+    // Hard linked - longer, then shorter, contents
+    std::string link = work_file("atomic.link");
+    fs::create_hard_link(fname, link);
+    const char *contents[] = {"much longer replacement contents\n", "short\n"};
+    for (size_t i = 0; i < 2; i++) {
+	unsigned long long ino = file_ino(fname);
+	{
+	    AtomicFile af(fname.c_str(), true);
+	    if (!af.write(contents[i], strlen(contents[i])) || !af.commit())
+		fail("AtomicFile commit over a hard link failed: " + af.error());
+	}
+	check_same("AtomicFile over a hard link", read_file(fname), contents[i]);
+	check_same("AtomicFile, other link", read_file(link), contents[i]);
+	check_count("AtomicFile, link count", fs::hard_link_count(fname), 2);
+	if (file_ino(fname) != ino)
+	    fail("AtomicFile replaced a hard linked file instead of copying back");
+    }
+}
+
+// The strclear tool itself, clearing a small tree in batch mode
+static void
+test_cli()
+{
+    if (!strclear_path.length()) {
+	std::cout << "cli: no --strclear given, skipped\n";
+	return;
+    }
+    std::mt19937 rng(9);
+    std::filesystem::path root = work_dir / "tree";
+    std::filesystem::create_directories(root / "sub");
+    std::vector<obj_section> spans;
+    std::map<std::string, std::string> files;
+    files["a.bin"] = gen_binary(1 * MB, rng);
+    plant_random(files["a.bin"], 50, rng);
+    files["sub/b.txt"] = gen_text(1 * MB, rng);
+    plant_random(files["sub/b.txt"], 50, rng);
+    files["sub/c.o"] = gen_elf(256 * 1024, 256 * 1024, rng, spans);
+    files["clean.txt"] = gen_text(64 * 1024, rng);
+    for (auto &f : files)
+	write_file((root / f.first).string(), f.second);
+
+    std::vector<std::string> targets = path_targets();
+    std::string scan = "\"" + strclear_path + "\" --scan -R \"" + root.string() + "\"";
+    for (size_t i = 0; i < targets.size(); i++)
+	scan.append(" '" + targets[i] + "'");
+
+    // A leading '**' component also covers files at the top of the tree
+    if (std::system((scan + " --include '**/a.bin' > \"" + work_file("walk.out") + "\"").c_str()) != 0)
+	fail("strclear --include '**/a.bin' did not find the top level file");
+
+    std::string cmd = "\"" + strclear_path + "\" -c -j 2 -R \"" + root.string() + "\"";
+    for (size_t i = 0; i < targets.size(); i++)
+	cmd.append(" '" + targets[i] + "'");
+    if (std::system((cmd + " > \"" + work_file("cli.out") + "\"").c_str()) != 0)
+	fail("strclear failed: " + cmd);
+    for (auto &f : files) {
+	std::string want(f.second);
+	ref_clear(want, targets, '\0');
+	check_same("strclear -R, " + f.first, read_file((root / f.first).string()), want);
+    }
+
+    // Nothing left to find
+    if (std::system((scan + " > \"" + work_file("scan.out") + "\"").c_str()) == 0)
+	fail("strclear --scan still found strings after clearing");
+}
+
+// --cache skips a file found clean by an earlier run, until it changes
+static void
+test_cache()
+{
+    if (!strclear_path.length()) {
+	std::cout << "cache: no --strclear given, skipped\n";
+	return;
+    }
+    std::mt19937 rng(17);
+    std::vector<std::string> targets = path_targets();
+    std::string fname = work_file("cached.bin");
+    std::string out = work_file("cache.out");
+    std::string cmd = "\"" + strclear_path + "\" -c --cache \"" + work_file("clean.cache") + "\" -f \"" + fname + "\"";
+    for (size_t i = 0; i < targets.size(); i++)
+	cmd.append(" '" + targets[i] + "'");
+    cmd.append(" > \"" + out + "\"");
+
+    std::string data = gen_binary(256 * 1024, rng);
+    write_file(fname, data);
+    for (int r = 0; r < 2; r++) {
+	if (std::system(cmd.c_str()) != 0)
+	    fail("strclear --cache failed: " + cmd);
+    }
+    if (read_file(out).find("1 skipped as unchanged") == std::string::npos)
+	fail("strclear --cache did not skip a file already found clean");
+
+    // Changed since - checked (and cleared) again
+    data += build_paths[0];
+    plant_random(data, 20, rng);
+    write_file(fname, data);
+    if (std::system(cmd.c_str()) != 0)
+	fail("strclear --cache failed: " + cmd);
+    std::string report = read_file(out);
+    if (report.find("modified 1") == std::string::npos || report.find("1 skipped") != std::string::npos)
+	fail("strclear --cache skipped a changed file: " + report);
+    ref_clear(data, targets, '\0');
+    check_same("strclear --cache, changed file", read_file(fname), data);
+}
+
+// A --client run is forwarded to a --serve server, job counts and all.  A
+// forwarded request shares the server's in-memory clean cache, so running
+// the same clean file twice shows whether the second run was served - a
+// local run has no cache to skip it with.
+static void
+test_client()
+{
+    if (!strclear_path.length()) {
+	std::cout << "client: no --strclear given, skipped\n";
+	return;
+    }
+#if defined(_WIN32) && !defined(__CYGWIN__)
+    std::cout << "client: no Unix domain sockets, skipped\n";
+#else
+    std::string sock = work_file("serve.sock");
+    std::string pidfile = work_file("serve.pid");
+    std::string cmd = "\"" + strclear_path + "\"";
+    if (std::system((cmd + " --serve \"" + sock + "\" > \"" + work_file("serve.out") + "\" 2>&1 & echo $! > \"" + pidfile + "\"").c_str()) != 0) {
+	fail("unable to start strclear --serve");
+	return;
+    }
+    for (int i = 0; i < 100 && !std::filesystem::exists(sock); i++)
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    if (!std::filesystem::exists(sock))
+	fail("strclear --serve did not create its socket");
+
+    std::string fname = work_file("client.txt");
+    write_file(fname, "nothing to clear here\n");
+    const char *jobs[] = {"-j0", "-j10", "-vj0", "-j 0"};
+    for (size_t i = 0; i < sizeof(jobs) / sizeof(jobs[0]); i++) {
+	std::string out = work_file("client.out");
+	std::string run = cmd + " --client \"" + sock + "\" -c " + jobs[i] + " -f \"" + fname + "\" /opt/brlcad";
+	for (int r = 0; r < 2; r++) {
+	    if (std::system((run + " > \"" + out + "\"").c_str()) != 0)
+		fail("strclear --client failed: " + run);
+	}
+	if (read_file(out).find("1 skipped as unchanged") == std::string::npos)
+	    fail(std::string("strclear --client ") + jobs[i] + " was not run by the server");
+    }
+
+    // The server clears the file, and its report comes back
+    std::string data = "a /opt/brlcad/lib/libfoo.so path\n";
+    write_file(fname, data);
+    std::string out = work_file("client.out");
+    std::string run = cmd + " --client \"" + sock + "\" -c -f \"" + fname + "\" /opt/brlcad > \"" + out + "\"";
+    if (std::system(run.c_str()) != 0)
+	fail("strclear --client failed: " + run);
+    if (read_file(out).find("modified 1 (1 instances)") == std::string::npos)
+	fail("strclear --client output was not returned: " + read_file(out));
+    ref_clear(data, std::vector<std::string>(1, "/opt/brlcad"), '\0');
+    check_same("strclear --client", read_file(fname), data);
+
+    std::ifstream pf(pidfile);
+    long pid = 0;
+    if (pf >> pid && pid > 0)
+	(void)std::system(("kill " + std::to_string(pid)).c_str());
+    for (int i = 0; i < 100 && std::filesystem::exists(sock); i++)
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+#endif
+}
+
+/* Performance tests */
+
+// Record the best throughput of PERF_RUNS runs of run() over bytes of
+// data, with prep() (if set) untimed before each
+static void
+measure(const std::string &name, size_t bytes, const std::function<void()> &prep, const std::function<void()> &run)
+{
+    double best = 0;
+    for (int i = 0; i < PERF_RUNS; i++) {
+	if (prep)
+	    prep();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	run();
+	std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+	best = std::max(best, (double)bytes / MB / std::max(secs.count(), 1e-9));
+    }
+    measured[name] = best;
+}
+
+// process_binary on a file holding data, restored before each run
+static void
+measure_clear(const std::string &name, const std::string &data, const PatternSet &ps, size_t chunk_size, bool sections)
+{
+    std::string fname = work_file("perf.bin");
+    measure(name, data.length(), [&]() { write_file(fname, data); }, [&]() {
+	std::ostringstream out, err;
+	file_stats fst;
+	if (process_binary(out, err, fname, ps, false, false, chunk_size, sections, fst) < 0)
+	    fail(name + ": " + err.str());
+    });
+}
+
+static void
+perf_strnstr()
+{
+    std::mt19937 rng(10);
+    std::string text = gen_text(32 * MB, rng);
+    const char *n = "/opt/brlcad/share/never/found";
+    measure("strnstr", text.length(), NULL, [&]() {
+	if (strnstr(text.c_str(), n, text.length()))
+	    fail("strnstr found a string not in the text");
+    });
+}
+
+static void
+perf_memsearch()
+{
+    std::mt19937 rng(11);
+    std::string text = gen_text(32 * MB, rng);
+    std::string n("/opt/brlcad/nope");
+    measure("memsearch", text.length(), NULL, [&]() {
+	if (memsearch(text.data(), text.length(), n.data(), n.length()))
+	    fail("memsearch found a string not in the text");
+    });
+}
+
+static void
+perf_clear_binary()
+{
+    std::mt19937 rng(12);
+    std::string data = gen_binary(64 * MB, rng);
+    plant_random(data, 16, rng);
+    measure_clear("clear_binary_1", data, PatternSet(path_targets(1)), 0, false);
+    measure_clear("clear_binary_8", data, PatternSet(path_targets()), 0, false);
+}
+
+static void
+perf_clear_sections()
+{
+    std::mt19937 rng(13);
+    std::vector<obj_section> spans;
+    std::string elf = gen_elf(16 * MB, 8 * MB, rng, spans);
+    measure_clear("clear_sections", elf, PatternSet(path_targets()), 0, true);
+}
+
+static void
+perf_replace_text()
+{
+    std::mt19937 rng(14);
+    std::string text = gen_text(32 * MB, rng);
+    for (size_t off = 0; off < text.length(); off += 100 + rng() % 400)
+	plant(text, off, gen_path(rng));
+    std::vector<std::string> all = path_targets();
+    PatternSet same(all), longer(all);
+    for (size_t i = 0; i < all.size(); i++) {
+	std::string r(all[i]);
+	std::replace(r.begin(), r.end(), 'b', 'B');
+	same.replacements.push_back(r);
+	longer.replacements.push_back(all[i] + "/relocated");
+    }
+    std::string fname = work_file("perf.txt");
+    const PatternSet *sets[] = {&same, &longer};
+    const char *names[] = {"replace_text_same", "replace_text_longer"};
+    for (size_t i = 0; i < 2; i++) {
+	measure(names[i], text.length(), [&]() { write_file(fname, text); }, [&]() {
+	    std::ostringstream out, err;
+	    file_stats fst;
+	    if (process_text(out, err, fname, *sets[i], false, false, fst) < 0)
+		fail(std::string(names[i]) + ": " + err.str());
+	});
+    }
+}
+
+static void
+perf_chunked()
+{
+    std::mt19937 rng(15);
+    std::string data = gen_binary(64 * MB, rng);
+    plant_random(data, 16, rng);
+    measure_clear("clear_chunked", data, PatternSet(path_targets()), 1 * MB, false);
+}
+
+struct test_case {
+    const char *name;
+    void (*run)();
+};
+
+static const test_case tests[] = {
+    {"strnstr", test_strnstr},
+    {"memsearch", test_memsearch},
+    {"automaton", test_automaton},
+    {"clear_binary", test_clear_binary},
+    {"clear_sections", test_clear_sections},
+    {"replace_text", test_replace_text},
+    {"chunk_boundaries", test_chunk_boundaries},
+    {"split_segments", test_split_segments},
+    {"archives", test_archives},
+    {"atomic_file", test_atomic_file},
+    {"cli", test_cli},
+    {"cache", test_cache},
+    {"client", test_client},
+    {"perf_strnstr", perf_strnstr},
+    {"perf_memsearch", perf_memsearch},
+    {"perf_clear_binary", perf_clear_binary},
+    {"perf_clear_sections", perf_clear_sections},
+    {"perf_replace_text", perf_replace_text},
+    {"perf_chunked", perf_chunked},
+};
+#define TEST_CNT (sizeof(tests) / sizeof(tests[0]))
+
+// Baseline files hold a name and a throughput in MB/s per line, with #
+// starting a comment
+static bool
+read_baseline(const std::string &fname, std::map<std::string, double> &baseline, std::vector<std::string> *lines = NULL)
+{
+    std::ifstream fs(fname);
+    if (!fs.is_open())
+	return false;
+    std::string line;
+    while (std::getline(fs, line)) {
+	if (lines)
+	    lines->push_back(line);
+	std::istringstream ls(line.substr(0, line.find('#')));
+	std::string name;
+	double mbs;
+	if (ls >> name >> mbs)
+	    baseline[name] = mbs;
+    }
+    return true;
+}
+
+// Update the entries in the baseline file for what was measured, keeping
+// everything else in it
+static bool
+record_baseline(const std::string &fname)
+{
+    std::map<std::string, double> old;
+    std::vector<std::string> lines;
+    read_baseline(fname, old, &lines);
+    std::map<std::string, double> pending(measured);
+    for (size_t i = 0; i < lines.size(); i++) {
+	std::istringstream ls(lines[i].substr(0, lines[i].find('#')));
+	std::string name;
+	if (!(ls >> name) || pending.find(name) == pending.end())
+	    continue;
+	std::ostringstream ns;
+	ns << name << " " << (long long)pending[name];
+	lines[i] = ns.str();
+	pending.erase(name);
+    }
+    for (auto &p : pending) {
+	std::ostringstream ns;
+	ns << p.first << " " << (long long)p.second;
+	lines.push_back(ns.str());
+    }
+    std::ofstream fs(fname, std::ios::trunc);
+    for (size_t i = 0; i < lines.size(); i++)
+	fs << lines[i] << "\n";
+    return (bool)fs;
+}
+
+int
+main(int argc, char **argv)
+{
+    std::string baseline_file, record_file;
+    double tolerance = 0.5;
+    bool list = false;
+    std::vector<std::string> names;
+
+    try {
+	cxxopts::Options options(argv[0], "Regression and performance tests for strclear\n");
+	options.add_options()
+	    ("baseline",  "Check the throughput measured by the perf_ tests against this baseline file", cxxopts::value<std::string>(baseline_file))
+	    ("tolerance", "Fraction of the baseline throughput a perf_ test may fall short by before it fails (default 0.5)", cxxopts::value<double>(tolerance))
+	    ("record",    "Store the throughput measured in this baseline file (replacing any entries for the same measurements) instead of checking it", cxxopts::value<std::string>(record_file))
+	    ("strclear",  "The strclear tool, for the cli test", cxxopts::value<std::string>(strclear_path))
+	    ("list",      "List the tests", cxxopts::value<bool>(list))
+	    ("h,help",    "Print help")
+	    ("tests",     "Tests to run", cxxopts::value<std::vector<std::string>>(names))
+	    ;
+	options.parse_positional({"tests"});
+	options.positional_help("[test...]");
+	auto result = options.parse(argc, argv);
+	if (result.count("help")) {
+	    std::cout << options.help({""}) << std::endl;
+	    return 0;
+	}
+    }
+    catch (const cxxopts::exceptions::exception& e)
+    {
+	std::cerr << "error parsing options: " << e.what() << std::endl;
+	return 1;
+    }
+
+    if (list) {
+	for (size_t i = 0; i < TEST_CNT; i++)
+	    std::cout << tests[i].name << "\n";
+	return 0;
+    }
+
+    std::vector<const test_case *> run;
+    for (size_t i = 0; i < names.size(); i++) {
+	size_t t = 0;
+	while (t < TEST_CNT && names[i] != tests[t].name)
+	    t++;
+	if (t == TEST_CNT) {
+	    std::cerr << "Error:  unknown test \"" << names[i] << "\" (see --list)\n";
+	    return 1;
+	}
+	run.push_back(&tests[t]);
+    }
+    if (!names.size()) {
+	for (size_t i = 0; i < TEST_CNT; i++)
+	    run.push_back(&tests[i]);
+    }
+
+    std::map<std::string, double> baseline;
+    if (baseline_file.length() && !read_baseline(baseline_file, baseline)) {
+	std::cerr << "Error:  unable to read baseline file " << baseline_file << "\n";
+	return 1;
+    }
+
+    std::random_device rd;
+    work_dir = std::filesystem::temp_directory_path() / ("strclear_test_" + std::to_string(rd()));
+    std::error_code ec;
+    if (!std::filesystem::create_directories(work_dir, ec)) {
+	std::cerr << "Error:  unable to create " << work_dir.string() << "\n";
+	return 1;
+    }
+
+    for (size_t i = 0; i < run.size(); i++) {
+	size_t before = failures;
+	run[i]->run();
+	if (failures > before)
+	    std::cout << run[i]->name << ": " << failures - before << " failures\n";
+	else
+	    std::cout << run[i]->name << ": ok\n";
+    }
+    std::filesystem::remove_all(work_dir, ec);
+
+    for (auto &m : measured) {
+	std::cout << m.first << ": " << (long long)m.second << " MB/s";
+	auto b = baseline.find(m.first);
+	if (record_file.length() || b == baseline.end()) {
+	    std::cout << "\n";
+	    continue;
+	}
+	double floor = b->second * (1 - tolerance);
+	std::cout << " (baseline " << (long long)b->second << ", failing below " << (long long)floor << ")\n";
+	if (m.second < floor)
+	    fail(m.first + ": throughput " + std::to_string((long long)m.second) + " MB/s is below the baseline's " + std::to_string((long long)b->second) + " MB/s");
+    }
+    if (record_file.length() && measured.size() && !record_baseline(record_file)) {
+	std::cerr << "Error:  unable to write baseline file " << record_file << "\n";
+	return 1;
+    }
+
+    return (failures) ? 1 : 0;
+}
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
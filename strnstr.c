@@ -36,75 +36,54 @@
 #include <string.h>
 #include <stdint.h>
 
+/* The short needle searches slide a 2-4 byte window over the haystack,
+ * stopping at hlen or at a NUL (strstr semantics).  The caller guarantees
+ * at least one byte of haystack. */
 static char *
 twobyte_strstr(const unsigned char *h, const unsigned char *n, size_t hlen)
 {
-    size_t hpos = 0;
-    uint16_t nw = n[0]<<8 | n[1], hw = h[0]<<8 | h[1];
+    size_t hpos;
+    uint16_t nw = n[0]<<8 | n[1], hw = h[0];
 
-    // for (h++; *h && hw != nw; hw = hw<<8 | *++h);
-    while (hpos < hlen && h) {
-	h++;
-	hpos++;
-	if (hpos == hlen || !(*h))
-	    break;
+    for (hpos = 1; hpos < hlen && h[hpos]; hpos++) {
+	hw = hw<<8 | h[hpos];
 	if (hw == nw)
-	    break;
-	hpos++;
-	if (hpos >= hlen)
-	    break;
-	hw = hw<<8 | *++h;
+	    return (char *)h + hpos - 1;
     }
 
-    return (hpos < hlen && *h) ? (char *)h-1 : 0;
+    return 0;
 }
 
 static char *
 threebyte_strstr(const unsigned char *h, const unsigned char *n, size_t hlen)
 {
-    size_t hpos = 0;
-    uint32_t nw = n[0]<<24 | n[1]<<16 | n[2]<<8;
-    uint32_t hw = h[0]<<24 | h[1]<<16 | h[2]<<8;
-
-    // for (h+=2; *h && hw != nw; hw = (hw|*++h)<<8);
-    while (hpos < hlen && h) {
-	h+=2;
-	hpos+=2;
-	if (hpos >= hlen || !(*h))
-	    break;
-	if (hw == nw)
-	    break;
-	hpos++;
-	if (hpos >= hlen)
-	    break;
-	hw = (hw|*++h)<<8;
+    size_t hpos;
+    uint32_t nw = n[0]<<16 | n[1]<<8 | n[2];
+    uint32_t hw = h[0];
+
+    for (hpos = 1; hpos < hlen && h[hpos]; hpos++) {
+	hw = (hw<<8 | h[hpos]) & 0xffffff;
+	if (hpos >= 2 && hw == nw)
+	    return (char *)h + hpos - 2;
     }
 
-    return (hpos < hlen && *h) ? (char *)h-2 : 0;
+    return 0;
 }
 
 static char *
 fourbyte_strstr(const unsigned char *h, const unsigned char *n, size_t hlen)
 {
-    size_t hpos = 0;
-    uint32_t nw = n[0]<<24 | n[1]<<16 | n[2]<<8 | n[3];
-    uint32_t hw = h[0]<<24 | h[1]<<16 | h[2]<<8 | h[3];
-
-    // for (h+=3; *h && hw != nw; hw = hw<<8 | *++h);
-     while (hpos < hlen && h) {
-	h+=3;
-	hpos+=3;
-	if (hpos >= hlen || !(*h))
-	    break;
-	if (hw == nw)
-	    break;
-	hpos++;
-	if (hpos >= hlen)
-	    break;
-	hw = hw<<8 | *++h;
+    size_t hpos;
+    uint32_t nw = (uint32_t)n[0]<<24 | n[1]<<16 | n[2]<<8 | n[3];
+    uint32_t hw = h[0];
+
+    for (hpos = 1; hpos < hlen && h[hpos]; hpos++) {
+	hw = hw<<8 | h[hpos];
+	if (hpos >= 3 && hw == nw)
+	    return (char *)h + hpos - 3;
     }
 
-    return (hpos < hlen && *h) ? (char *)h-3 : 0;
+    return 0;
 }
 
 #define MAX(a,b) ((a)>(b)?(a):(b))
@@ -126,7 +105,7 @@ twoway_strstr(const unsigned char *h, const unsigned char *n, size_t hlen)
     size_t shift[256];
 
     /* Computing length of needle and fill shift table */
-    for (l=0; n[l] && h[l]; l++)
+    for (l=0; n[l] && l < hlen && h[l]; l++)
 	BITOP(byteset, n[l], |=), shift[n[l]] = l+1;
     if (n[l]) return 0; /* hit the end of h */
 
@@ -178,33 +157,28 @@ twoway_strstr(const unsigned char *h, const unsigned char *n, size_t hlen)
     mem = 0;
 
     /* Initialize incremental end-of-haystack pointer */
-    size_t hcnt = 0;
+    const unsigned char *hend = h + hlen;
     z = h;
 
     /* Search loop */
     for (;;) {
-	if (hcnt >= hlen) return 0;
-
-	/* Update incremental end-of-haystack pointer */
-	if (z-h < (long)l) {
+	/* Update incremental end-of-haystack pointer, which never moves
+	 * past the first NUL or the end of the buffer */
+	while (z-h < (long)l) {
 	    /* Fast estimate for MIN(l,63) */
 	    size_t grow = l | 63;
-	    if (grow + hcnt > hlen) {
-		grow = hlen - hcnt;
-	    }
+	    if (grow > (size_t)(hend - z))
+		grow = hend - z;
+	    if (!grow) return 0;
 	    const unsigned char *z2 = (const unsigned char *)memchr(z, 0, grow);
 	    if (z2) {
 		z = z2;
 		if (z-h < (long)l) return 0;
 	    } else {
 		z += grow;
-		hcnt = hcnt + grow;
 	    }
 	}
 
-	/* Re-validate hcnt, since we may have incremented it above */
-	if (hcnt >= hlen) return 0;
-
 	/* Check last byte first; advance by shift on mismatch */
 	if (BITOP(byteset, h[l-1], &)) {
 	    k = l-shift[h[l-1]];
@@ -241,14 +215,20 @@ strnstr(const char *h, const char *n, size_t hlen)
     /* Return immediately on empty needle */
     if (!n[0]) return (char *)h;
 
-    /* Use faster algorithms for short needles */
+    /* Skip ahead to the first possible match - unless that skips over
+     * the end of the haystack string */
     const char *tmph = (const char *)memchr((void *)h, *n, hlen);
-    if (!tmph || !n[1]) return (char *)h;
-    if (!h[1]) return 0;
+    if (!tmph || memchr((void *)h, 0, tmph - h)) return 0;
+    hlen -= tmph - h;
+    h = tmph;
+    if (!n[1]) return (char *)h;
+
+    /* Use faster algorithms for short needles */
+    if (hlen < 2 || !h[1]) return 0;
     if (!n[2]) return twobyte_strstr((const unsigned char *)h, (const unsigned char *)n, hlen);
-    if (!h[2]) return 0;
+    if (hlen < 3 || !h[2]) return 0;
     if (!n[3]) return threebyte_strstr((const unsigned char *)h, (const unsigned char *)n, hlen);
-    if (!h[3]) return 0;
+    if (hlen < 4 || !h[3]) return 0;
     if (!n[4]) return fourbyte_strstr((const unsigned char *)h, (const unsigned char *)n, hlen);
 
     return twoway_strstr((const unsigned char *)h, (const unsigned char *)n, hlen);